@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for AST nodes. Allocation is a pointer increment, nodes are
+// never freed one by one, and release() drops the whole tree at once. Only
+// types that need a destructor pay for a bookkeeping entry.
+class Arena
+{
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Destructor
+    {
+        void* m_object;
+        void (*m_destroy)(void*);
+    };
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::byte* m_cursor = nullptr;
+    std::byte* m_end = nullptr;
+    std::vector<Destructor> m_destructors;
+
+    void* allocate(size_t size, size_t align)
+    {
+        size_t padding = -reinterpret_cast<uintptr_t>(m_cursor) & (align - 1);
+        if (m_cursor == nullptr || padding + size > static_cast<size_t>(m_end - m_cursor))
+        {
+            size_t block_size = std::max(BLOCK_SIZE, size + align);
+            m_blocks.emplace_back(new std::byte[block_size]);
+            m_cursor = m_blocks.back().get();
+            m_end = m_cursor + block_size;
+            padding = -reinterpret_cast<uintptr_t>(m_cursor) & (align - 1);
+        }
+
+        void* memory = m_cursor + padding;
+        m_cursor += padding + size;
+        return memory;
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { release(); }
+
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            m_destructors.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+
+        return object;
+    }
+
+    void release()
+    {
+        for (auto it = m_destructors.rbegin(); it != m_destructors.rend(); ++it)
+            it->m_destroy(it->m_object);
+
+        m_destructors.clear();
+        m_blocks.clear();
+        m_cursor = m_end = nullptr;
+    }
+};
@@ -4,67 +4,200 @@
 #include <sstream>
 #include <vector>
 #include "expr.h"
+#include "object.h"
+#include "stmt.h"
 
-class AstPrinter : public VisitorExpr
+// Prints the tree as s-expressions, one statement per line and nested
+// statements indented under the one that holds them.
+class AstPrinter : public VisitorExpr, public VisitorStmt
 {
 public:
-    std::string print(std::shared_ptr<Expr> expr){ return std::any_cast<std::string>(expr->accept(*this)); };
+    std::string print(Expr* expr)
+    {
+        expr->accept(*this);
+        return m_text;
+    };
 
-    std::any visit_binary(std::shared_ptr<Binary> expr) override
+    std::string print(const std::vector<Stmt*>& statements)
     {
-      return parenthesize(expr->m_operator.m_lexeme, expr->m_left, expr->m_right);
+        std::stringstream builder;
+        for (Stmt* statement : statements)
+            builder << print(statement);
+
+        return builder.str();
     }
 
-    std::any visit_grouping(std::shared_ptr<Grouping> expr) override
+    Value visit_assign(Assign* expr) override
     {
-      return parenthesize("group", expr->m_expression);
+      m_text = parenthesize("= " + std::string{expr->m_name.m_lexeme}, expr->m_value);
+      return Value{};
     }
 
-    std::any visit_literal(std::shared_ptr<Literal> expr) override
+    Value visit_binary(Binary* expr) override
     {
-      auto& value_type = expr->m_value.type();
+      m_text = parenthesize(std::string{expr->m_operator.m_lexeme}, expr->m_left, expr->m_right);
+      return Value{};
+    }
 
-      if (value_type == typeid(nullptr)) {
-        return "nil";
-      } else if (value_type == typeid(std::string)) {
-        return std::any_cast<std::string>(expr->m_value);
-      } else if (value_type == typeid(double)) {
-        std::string text;
-        text = std::to_string(std::any_cast<double>(expr->m_value));
-        size_t dotPos = text.find('.');
-        if (dotPos != std::string::npos) 
-        {
-            size_t lastNonZeroPos = text.size() - 1;
-            while (text[lastNonZeroPos] == '0' && lastNonZeroPos > dotPos)
-                lastNonZeroPos--;
+    Value visit_call(Call* expr) override
+    {
+      std::stringstream builder;
+      builder << "(call " << print(expr->m_calee);
+      for (Expr* argument : expr->m_arguments)
+          builder << " " << print(argument);
+      builder << ")";
 
-            if (text[lastNonZeroPos] == '.') 
-                text.erase(lastNonZeroPos, std::string::npos);
-            else
-                text.erase(lastNonZeroPos + 1, std::string::npos);
-        }
+      m_text = builder.str();
+      return Value{};
+    }
 
-        return text;
-      } else if (value_type == typeid(bool)) {
-        return std::any_cast<bool>(expr->m_value) ? "true" : "false";
-      }
+    Value visit_get(Get* expr) override
+    {
+      m_text = "(. " + print(expr->m_object) + " " + std::string{expr->m_name.m_lexeme} + ")";
+      return Value{};
+    }
+
+    Value visit_grouping(Grouping* expr) override
+    {
+      m_text = parenthesize("group", expr->m_expression);
+      return Value{};
+    }
+
+    Value visit_literal(Literal* expr) override
+    {
+      if (is_obj_type(expr->m_value, OBJ_STRING))
+          m_text = "\"" + to_string(expr->m_value) + "\"";
+      else
+          m_text = to_string(expr->m_value);
+      return Value{};
+    }
+
+    Value visit_logical(Logical* expr) override
+    {
+      m_text = parenthesize(std::string{expr->m_operator.m_lexeme}, expr->m_left, expr->m_right);
+      return Value{};
     }
 
-    std::any visit_unary(std::shared_ptr<Unary> expr) override
+    Value visit_set(Set* expr) override
     {
-      return parenthesize(expr->m_operator.m_lexeme, expr->m_right);
+      std::string target = "(. " + print(expr->m_object) + " " + std::string{expr->m_name.m_lexeme} + ")";
+      m_text = "(= " + target + " " + print(expr->m_value) + ")";
+      return Value{};
     }
 
-    std::any visit_assign(std::shared_ptr<Assign> expr) override {};
-    std::any visit_call(std::shared_ptr<Call> expr) override {};
-    std::any visit_get(std::shared_ptr<Get> expr) override {};
-    std::any visit_logical(std::shared_ptr<Logical> expr) override {};
-    std::any visit_set(std::shared_ptr<Set> expr) override {};
-    std::any visit_super(std::shared_ptr<Super> expr) override {};
-    std::any visit_this(std::shared_ptr<This> expr) override {};
-    std::any visit_variable(std::shared_ptr<Variable> expr) override {};
+    Value visit_super(Super* expr) override
+    {
+      m_text = "(super " + std::string{expr->m_method.m_lexeme} + ")";
+      return Value{};
+    }
+
+    Value visit_this(This* expr) override
+    {
+      m_text = "this";
+      return Value{};
+    }
+
+    Value visit_unary(Unary* expr) override
+    {
+      m_text = parenthesize(std::string{expr->m_operator.m_lexeme}, expr->m_right);
+      return Value{};
+    }
+
+    Value visit_variable(Variable* expr) override
+    {
+      m_text = std::string{expr->m_name.m_lexeme};
+      return Value{};
+    }
+
+    void visit_block(Block* stmt) override
+    {
+      m_text = line("(block") + nested(stmt->m_statements) + line(")");
+    }
+
+    void visit_class(Class* stmt) override
+    {
+      std::string header = "(class " + std::string{stmt->m_name.m_lexeme};
+      if (stmt->m_superclass != nullptr)
+          header += " < " + std::string{stmt->m_superclass->m_name.m_lexeme};
+
+      std::string methods;
+      ++m_indent;
+      for (Function* method : stmt->m_methods)
+          methods += print(method);
+      --m_indent;
+
+      m_text = line(header) + methods + line(")");
+    }
+
+    void visit_expression(Expression* stmt) override
+    {
+      m_text = line(parenthesize(";", stmt->m_expression));
+    }
+
+    void visit_function(Function* stmt) override
+    {
+      std::string header = "(fun " + std::string{stmt->m_name.m_lexeme} + " (";
+      for (size_t i = 0; i < stmt->m_params.size(); ++i)
+          header += (i > 0 ? " " : "") + std::string{stmt->m_params[i].m_lexeme};
+      header += ")";
+
+      m_text = line(header) + nested(stmt->m_body) + line(")");
+    }
+
+    void visit_if(If* stmt) override
+    {
+      std::string text = line("(if " + print(stmt->m_condition)) + nested(stmt->m_thenBranch);
+      if (stmt->m_elseBranch != nullptr)
+          text += line("else") + nested(stmt->m_elseBranch);
+
+      m_text = text + line(")");
+    }
+
+    void visit_print(Print* stmt) override
+    {
+      m_text = line(parenthesize("print", stmt->m_expression));
+    }
+
+    void visit_return(Return* stmt) override
+    {
+      m_text = line(stmt->m_value != nullptr ? parenthesize("return", stmt->m_value) : "(return)");
+    }
+
+    void visit_var(Var* stmt) override
+    {
+      std::string name = "var " + std::string{stmt->m_name.m_lexeme};
+      m_text = line(stmt->m_initializer != nullptr ? parenthesize(name, stmt->m_initializer) : "(" + name + ")");
+    }
+
+    void visit_while(While* stmt) override
+    {
+      m_text = line("(while " + print(stmt->m_condition)) + nested(stmt->m_body) + line(")");
+    }
 
 private:
+    std::string m_text;
+    int m_indent = 0;
+
+    std::string print(Stmt* stmt)
+    {
+        stmt->accept(*this);
+        return m_text;
+    }
+
+    std::string line(const std::string& text)
+    {
+        return std::string(m_indent * 2, ' ') + text + "\n";
+    }
+
+    template <class S>
+    std::string nested(const S& statements)
+    {
+        ++m_indent;
+        std::string text = print(statements);
+        --m_indent;
+        return text;
+    }
+
     template <class... E>
     std::string parenthesize(const std::string& name, E... expr)
     {
@@ -75,4 +208,4 @@ private:
 
         return builder.str();
     }
-};
\ No newline at end of file
+};
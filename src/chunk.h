@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "value.h"
+
+enum OpCode : uint8_t {
+  // Constants and literals.
+  OP_CONSTANT, OP_NIL, OP_TRUE, OP_FALSE, OP_POP,
+
+  // Variables. Constant and global operands are 16 bit, slots are 8 bit.
+  OP_GET_LOCAL, OP_SET_LOCAL,
+  OP_GET_GLOBAL, OP_DEFINE_GLOBAL, OP_SET_GLOBAL,
+  OP_GET_UPVALUE, OP_SET_UPVALUE,
+
+  // Operators.
+  OP_EQUAL, OP_GREATER, OP_GREATER_EQUAL, OP_LESS, OP_LESS_EQUAL,
+  OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE, OP_NOT, OP_NEGATE,
+
+  // Statements and control flow. Jump offsets are 16 bit.
+  OP_PRINT, OP_JUMP, OP_JUMP_IF_FALSE, OP_LOOP,
+  OP_CALL, OP_CLOSURE, OP_CLOSE_UPVALUE, OP_RETURN,
+
+  // Superinstructions, which run the sequence they are named after. The
+  // compiler fuses a sequence by rewriting only its first opcode, and the
+  // operands stay where they were, so a jump into the middle of the
+  // sequence still lands on the original instructions.
+  OP_POP_GET_LOCAL, OP_GET_LOCAL_GET_LOCAL, OP_SET_LOCAL_POP,
+  OP_GET_LOCAL_CONSTANT_ADD, OP_GET_LOCAL_CONSTANT_SUBTRACT, OP_GET_LOCAL_CONSTANT_LESS,
+  OP_JUMP_IF_FALSE_POP, OP_LESS_JUMP_IF_FALSE_POP,
+
+  OP_COUNT
+};
+
+class Chunk
+{
+public:
+    std::vector<uint8_t> m_code;
+    std::vector<int> m_lines;
+    std::vector<Value> m_constants;
+
+    void write(uint8_t byte, int line)
+    {
+        m_code.push_back(byte);
+        m_lines.push_back(line);
+    }
+
+    int add_constant(Value value)
+    {
+        // Compared bit for bit: -0 equals 0 but prints differently.
+        for (size_t i = 0; i < m_constants.size(); ++i)
+            if (m_constants[i].bits() == value.bits()) return i;
+
+        m_constants.push_back(value);
+        return m_constants.size() - 1;
+    }
+};
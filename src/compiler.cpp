@@ -0,0 +1,546 @@
+#include <limits>
+
+#include "compiler.h"
+#include "memory.h"
+
+void error(Token token, std::string message);
+
+static constexpr int MAX_SLOTS = std::numeric_limits<uint8_t>::max() + 1;
+
+void Compiler::error(const Token& token, const std::string& message)
+{
+    ::error(token, message);
+    m_had_error = true;
+}
+
+void Compiler::emit_byte(uint8_t byte)
+{
+    current_chunk().write(byte, m_line);
+}
+
+void Compiler::emit_bytes(uint8_t byte1, uint8_t byte2)
+{
+    emit_byte(byte1);
+    emit_byte(byte2);
+}
+
+void Compiler::emit_short(uint16_t operand)
+{
+    emit_byte((operand >> 8) & 0xff);
+    emit_byte(operand & 0xff);
+}
+
+uint16_t Compiler::make_constant(Value value)
+{
+    int constant = current_chunk().add_constant(value);
+    if (constant > std::numeric_limits<uint16_t>::max())
+    {
+        error(Token{END, "", m_line}, "Too many constants in one chunk.");
+        return 0;
+    }
+
+    return constant;
+}
+
+void Compiler::emit_constant(Value value)
+{
+    emit_byte(OP_CONSTANT);
+    emit_short(make_constant(value));
+}
+
+uint16_t Compiler::identifier_constant(const Token& name)
+{
+    return make_constant(heap().intern(name.m_lexeme));
+}
+
+int Compiler::emit_jump(uint8_t instruction)
+{
+    emit_byte(instruction);
+    emit_short(0xffff);
+    return current_chunk().m_code.size() - 2;
+}
+
+void Compiler::patch_jump(int offset)
+{
+    int jump = current_chunk().m_code.size() - offset - 2;
+    if (jump > std::numeric_limits<uint16_t>::max())
+        error(Token{END, "", m_line}, "Too much code to jump over.");
+
+    current_chunk().m_code[offset] = (jump >> 8) & 0xff;
+    current_chunk().m_code[offset + 1] = jump & 0xff;
+}
+
+void Compiler::emit_loop(int loop_start)
+{
+    emit_byte(OP_LOOP);
+
+    int offset = current_chunk().m_code.size() - loop_start + 2;
+    if (offset > std::numeric_limits<uint16_t>::max())
+        error(Token{END, "", m_line}, "Loop body too large.");
+
+    emit_short(offset);
+}
+
+void Compiler::begin_function(FunctionState& state, FunctionType type, ObjString* name)
+{
+    state.m_enclosing = m_current;
+    state.m_function = heap().allocate<ObjFunction>();
+    state.m_function->m_name = name;
+    state.m_type = type;
+    m_current = &state;
+
+    // Slot zero holds the callee itself.
+    m_current->m_locals.push_back(Local{"", 0, false});
+}
+
+#ifdef LOX_SUPERINSTRUCTIONS
+// Bytes taken by the instruction at offset, opcode included.
+static size_t instruction_length(const std::vector<uint8_t>& code, const std::vector<Value>& constants, size_t offset)
+{
+    switch (code[offset])
+    {
+        case OP_GET_LOCAL: case OP_SET_LOCAL:
+        case OP_GET_UPVALUE: case OP_SET_UPVALUE:
+        case OP_CALL:
+            return 2;
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL: case OP_DEFINE_GLOBAL: case OP_SET_GLOBAL:
+        case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LOOP:
+            return 3;
+        case OP_CLOSURE:
+        {
+            uint16_t constant = (code[offset + 1] << 8) | code[offset + 2];
+            auto function = static_cast<ObjFunction*>(constants[constant].as_obj());
+            return 3 + 2 * function->m_upvalue_count;
+        }
+        default:
+            return 1;
+    }
+}
+
+// The sequences fused are the ones most executed by loops, conditions and
+// recursive calls like those in example/. Each instruction is matched
+// against the original code, not the fused opcodes before it, so one that
+// is also the start of a sequence is rewritten too, for jumps that land
+// on it.
+static void fuse_superinstructions(Chunk& chunk)
+{
+    const std::vector<uint8_t> code = chunk.m_code;
+
+    // The opcodes of the instruction at offset and the two after it, or
+    // -1 past the end.
+    auto sequence = [&](size_t offset, int (&opcodes)[3]) {
+        for (int& opcode : opcodes)
+        {
+            opcode = offset < code.size() ? code[offset] : -1;
+            if (opcode >= 0) offset += instruction_length(code, chunk.m_constants, offset);
+        }
+    };
+
+    for (size_t offset = 0; offset < code.size(); offset += instruction_length(code, chunk.m_constants, offset))
+    {
+        int opcodes[3];
+        sequence(offset, opcodes);
+        auto [first, second, third] = opcodes;
+
+        uint8_t fused = first;
+        if (first == OP_GET_LOCAL && second == OP_CONSTANT && third == OP_ADD)
+            fused = OP_GET_LOCAL_CONSTANT_ADD;
+        else if (first == OP_GET_LOCAL && second == OP_CONSTANT && third == OP_SUBTRACT)
+            fused = OP_GET_LOCAL_CONSTANT_SUBTRACT;
+        else if (first == OP_GET_LOCAL && second == OP_CONSTANT && third == OP_LESS)
+            fused = OP_GET_LOCAL_CONSTANT_LESS;
+        else if (first == OP_LESS && second == OP_JUMP_IF_FALSE && third == OP_POP)
+            fused = OP_LESS_JUMP_IF_FALSE_POP;
+        else if (first == OP_GET_LOCAL && second == OP_GET_LOCAL)
+            fused = OP_GET_LOCAL_GET_LOCAL;
+        else if (first == OP_POP && second == OP_GET_LOCAL)
+            fused = OP_POP_GET_LOCAL;
+        else if (first == OP_SET_LOCAL && second == OP_POP)
+            fused = OP_SET_LOCAL_POP;
+        else if (first == OP_JUMP_IF_FALSE && second == OP_POP)
+            fused = OP_JUMP_IF_FALSE_POP;
+
+        chunk.m_code[offset] = fused;
+    }
+}
+#endif
+
+ObjFunction* Compiler::end_function()
+{
+    emit_byte(OP_NIL);
+    emit_byte(OP_RETURN);
+
+#ifdef LOX_SUPERINSTRUCTIONS
+    fuse_superinstructions(current_chunk());
+#endif
+
+    ObjFunction* function = m_current->m_function;
+    function->m_upvalue_count = m_current->m_upvalues.size();
+    m_current = m_current->m_enclosing;
+    return function;
+}
+
+void Compiler::begin_scope()
+{
+    m_current->m_scope_depth++;
+}
+
+void Compiler::end_scope()
+{
+    m_current->m_scope_depth--;
+
+    std::vector<Local>& locals = m_current->m_locals;
+    while (!locals.empty() && locals.back().m_depth > m_current->m_scope_depth)
+    {
+        emit_byte(locals.back().m_captured ? OP_CLOSE_UPVALUE : OP_POP);
+        locals.pop_back();
+    }
+}
+
+void Compiler::add_local(const Token& name)
+{
+    if (m_current->m_locals.size() == MAX_SLOTS)
+    {
+        error(name, "Too many local variables in function.");
+        return;
+    }
+
+    m_current->m_locals.push_back(Local{name.m_lexeme, m_current->m_scope_depth, false});
+}
+
+int Compiler::resolve_local(FunctionState* state, const Token& name)
+{
+    for (int i = state->m_locals.size() - 1; i >= 0; --i)
+        if (state->m_locals[i].m_name == name.m_lexeme)
+            return i;
+
+    return -1;
+}
+
+int Compiler::add_upvalue(FunctionState* state, uint8_t index, bool is_local)
+{
+    std::vector<Upvalue>& upvalues = state->m_upvalues;
+    for (size_t i = 0; i < upvalues.size(); ++i)
+        if (upvalues[i].m_index == index && upvalues[i].m_is_local == is_local)
+            return i;
+
+    if (upvalues.size() == MAX_SLOTS)
+    {
+        error(Token{END, "", m_line}, "Too many closure variables in function.");
+        return 0;
+    }
+
+    upvalues.push_back(Upvalue{index, is_local});
+    return upvalues.size() - 1;
+}
+
+int Compiler::resolve_upvalue(FunctionState* state, const Token& name)
+{
+    if (state->m_enclosing == nullptr) return -1;
+
+    int local = resolve_local(state->m_enclosing, name);
+    if (local != -1)
+    {
+        state->m_enclosing->m_locals[local].m_captured = true;
+        return add_upvalue(state, local, true);
+    }
+
+    int upvalue = resolve_upvalue(state->m_enclosing, name);
+    if (upvalue != -1)
+        return add_upvalue(state, upvalue, false);
+
+    return -1;
+}
+
+void Compiler::named_variable(const Token& name, bool assign)
+{
+    m_line = name.m_line;
+
+    int arg = resolve_local(m_current, name);
+    if (arg != -1)
+    {
+        emit_bytes(assign ? OP_SET_LOCAL : OP_GET_LOCAL, arg);
+        return;
+    }
+
+    arg = resolve_upvalue(m_current, name);
+    if (arg != -1)
+    {
+        emit_bytes(assign ? OP_SET_UPVALUE : OP_GET_UPVALUE, arg);
+        return;
+    }
+
+    emit_byte(assign ? OP_SET_GLOBAL : OP_GET_GLOBAL);
+    emit_short(identifier_constant(name));
+}
+
+ObjFunction* Compiler::compile(const std::vector<Stmt*>& statements)
+{
+    FunctionState script;
+    begin_function(script, TYPE_SCRIPT, nullptr);
+
+    for (Stmt* statement : statements)
+        compile(statement);
+
+    ObjFunction* function = end_function();
+    return m_had_error ? nullptr : function;
+}
+
+Value Compiler::visit_assign(Assign* expr)
+{
+    compile(expr->m_value);
+    named_variable(expr->m_name, true);
+    return Value{};
+}
+
+Value Compiler::visit_binary(Binary* expr)
+{
+    compile(expr->m_left);
+    compile(expr->m_right);
+
+    m_line = expr->m_operator.m_line;
+    switch (expr->m_operator.m_type)
+    {
+        case BANG_EQUAL:    emit_bytes(OP_EQUAL, OP_NOT); break;
+        case EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
+        case GREATER:       emit_byte(OP_GREATER); break;
+        case GREATER_EQUAL: emit_byte(OP_GREATER_EQUAL); break;
+        case LESS:          emit_byte(OP_LESS); break;
+        case LESS_EQUAL:    emit_byte(OP_LESS_EQUAL); break;
+        case PLUS:          emit_byte(OP_ADD); break;
+        case MINUS:         emit_byte(OP_SUBTRACT); break;
+        case STAR:          emit_byte(OP_MULTIPLY); break;
+        case SLASH:         emit_byte(OP_DIVIDE); break;
+        default:            break;
+    }
+
+    return Value{};
+}
+
+Value Compiler::visit_call(Call* expr)
+{
+    compile(expr->m_calee);
+    for (Expr* argument : expr->m_arguments)
+        compile(argument);
+
+    m_line = expr->m_paren.m_line;
+    emit_bytes(OP_CALL, expr->m_arguments.size());
+    return Value{};
+}
+
+Value Compiler::visit_get(Get* expr)
+{
+    error(expr->m_name, "Classes are not supported by the bytecode engine.");
+    return Value{};
+}
+
+Value Compiler::visit_grouping(Grouping* expr)
+{
+    compile(expr->m_expression);
+    return Value{};
+}
+
+Value Compiler::visit_literal(Literal* expr)
+{
+    Value value = expr->m_value;
+
+    if (value.is_bool())
+        emit_byte(value.as_bool() ? OP_TRUE : OP_FALSE);
+    else if (value.is_nil())
+        emit_byte(OP_NIL);
+    else
+        emit_constant(value);
+
+    return Value{};
+}
+
+Value Compiler::visit_logical(Logical* expr)
+{
+    compile(expr->m_left);
+
+    if (expr->m_operator.m_type == TokenType::OR)
+    {
+        int else_jump = emit_jump(OP_JUMP_IF_FALSE);
+        int end_jump = emit_jump(OP_JUMP);
+
+        patch_jump(else_jump);
+        emit_byte(OP_POP);
+        compile(expr->m_right);
+        patch_jump(end_jump);
+    }
+    else
+    {
+        int end_jump = emit_jump(OP_JUMP_IF_FALSE);
+
+        emit_byte(OP_POP);
+        compile(expr->m_right);
+        patch_jump(end_jump);
+    }
+
+    return Value{};
+}
+
+Value Compiler::visit_set(Set* expr)
+{
+    error(expr->m_name, "Classes are not supported by the bytecode engine.");
+    return Value{};
+}
+
+Value Compiler::visit_super(Super* expr)
+{
+    error(expr->m_keyword, "Classes are not supported by the bytecode engine.");
+    return Value{};
+}
+
+Value Compiler::visit_this(This* expr)
+{
+    error(expr->m_keyword, "Classes are not supported by the bytecode engine.");
+    return Value{};
+}
+
+Value Compiler::visit_unary(Unary* expr)
+{
+    compile(expr->m_right);
+
+    m_line = expr->m_operator.m_line;
+    switch (expr->m_operator.m_type)
+    {
+        case BANG:  emit_byte(OP_NOT); break;
+        case MINUS: emit_byte(OP_NEGATE); break;
+        default:    break;
+    }
+
+    return Value{};
+}
+
+Value Compiler::visit_variable(Variable* expr)
+{
+    named_variable(expr->m_name, false);
+    return Value{};
+}
+
+void Compiler::visit_block(Block* stmt)
+{
+    begin_scope();
+    for (Stmt* statement : stmt->m_statements)
+        compile(statement);
+    end_scope();
+}
+
+void Compiler::visit_class(Class* stmt)
+{
+    error(stmt->m_name, "Classes are not supported by the bytecode engine.");
+}
+
+void Compiler::visit_expression(Expression* stmt)
+{
+    compile(stmt->m_expression);
+    emit_byte(OP_POP);
+}
+
+void Compiler::visit_function(Function* stmt)
+{
+    m_line = stmt->m_name.m_line;
+
+    // A local function is visible inside its own body so it can recurse.
+    bool global = m_current->m_scope_depth == 0;
+    if (!global)
+        add_local(stmt->m_name);
+
+    FunctionState state;
+    begin_function(state, TYPE_FUNCTION, heap().intern(stmt->m_name.m_lexeme));
+    begin_scope();
+
+    m_current->m_function->m_arity = stmt->m_params.size();
+    for (const Token& param : stmt->m_params)
+        add_local(param);
+
+    for (Stmt* statement : stmt->m_body)
+        compile(statement);
+
+    std::vector<Upvalue> upvalues = state.m_upvalues;
+    ObjFunction* function = end_function();
+
+    m_line = stmt->m_name.m_line;
+    emit_byte(OP_CLOSURE);
+    emit_short(make_constant(function));
+    for (const Upvalue& upvalue : upvalues)
+        emit_bytes(upvalue.m_is_local ? 1 : 0, upvalue.m_index);
+
+    if (global)
+    {
+        emit_byte(OP_DEFINE_GLOBAL);
+        emit_short(identifier_constant(stmt->m_name));
+    }
+}
+
+void Compiler::visit_if(If* stmt)
+{
+    compile(stmt->m_condition);
+
+    int then_jump = emit_jump(OP_JUMP_IF_FALSE);
+    emit_byte(OP_POP);
+    compile(stmt->m_thenBranch);
+
+    int else_jump = emit_jump(OP_JUMP);
+    patch_jump(then_jump);
+    emit_byte(OP_POP);
+
+    if (stmt->m_elseBranch != nullptr)
+        compile(stmt->m_elseBranch);
+
+    patch_jump(else_jump);
+}
+
+void Compiler::visit_print(Print* stmt)
+{
+    compile(stmt->m_expression);
+    emit_byte(OP_PRINT);
+}
+
+void Compiler::visit_return(Return* stmt)
+{
+    m_line = stmt->m_name.m_line;
+    if (m_current->m_type == TYPE_SCRIPT)
+        error(stmt->m_name, "Can't return from top-level code.");
+
+    if (stmt->m_value != nullptr)
+        compile(stmt->m_value);
+    else
+        emit_byte(OP_NIL);
+
+    emit_byte(OP_RETURN);
+}
+
+void Compiler::visit_var(Var* stmt)
+{
+    if (stmt->m_initializer != nullptr)
+        compile(stmt->m_initializer);
+    else
+        emit_byte(OP_NIL);
+
+    m_line = stmt->m_name.m_line;
+    if (m_current->m_scope_depth > 0)
+    {
+        add_local(stmt->m_name);
+        return;
+    }
+
+    emit_byte(OP_DEFINE_GLOBAL);
+    emit_short(identifier_constant(stmt->m_name));
+}
+
+void Compiler::visit_while(While* stmt)
+{
+    int loop_start = current_chunk().m_code.size();
+    compile(stmt->m_condition);
+
+    int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
+    emit_byte(OP_POP);
+    compile(stmt->m_body);
+    emit_loop(loop_start);
+
+    patch_jump(exit_jump);
+    emit_byte(OP_POP);
+}
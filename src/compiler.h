@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.h"
+#include "expr.h"
+#include "stmt.h"
+#include "object.h"
+
+// Lowers the parsed Stmt/Expr tree into bytecode for the VM. Locals live in
+// stack slots and captured variables become upvalues, so the VM never looks a
+// local variable up by name.
+class Compiler : public VisitorExpr, public VisitorStmt
+{
+public:
+    Compiler() = default;
+    ~Compiler() = default;
+
+    ObjFunction* compile(const std::vector<Stmt*>& statements);
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    struct Local
+    {
+        std::string_view m_name;
+        int m_depth;
+        bool m_captured;
+    };
+
+    struct Upvalue
+    {
+        uint8_t m_index;
+        bool m_is_local;
+    };
+
+    enum FunctionType { TYPE_FUNCTION, TYPE_SCRIPT };
+
+    struct FunctionState
+    {
+        FunctionState* m_enclosing;
+        ObjFunction* m_function;
+        FunctionType m_type;
+        std::vector<Local> m_locals;
+        std::vector<Upvalue> m_upvalues;
+        int m_scope_depth = 0;
+    };
+
+    FunctionState* m_current = nullptr;
+    int m_line = 1;
+    bool m_had_error = false;
+
+    Chunk& current_chunk() { return m_current->m_function->m_chunk; }
+
+    void compile(Expr* expr) { expr->accept(*this); }
+    void compile(Stmt* stmt) { stmt->accept(*this); }
+    void error(const Token& token, const std::string& message);
+
+    void emit_byte(uint8_t byte);
+    void emit_bytes(uint8_t byte1, uint8_t byte2);
+    void emit_short(uint16_t operand);
+    void emit_constant(Value value);
+    int  emit_jump(uint8_t instruction);
+    void patch_jump(int offset);
+    void emit_loop(int loop_start);
+    uint16_t make_constant(Value value);
+    uint16_t identifier_constant(const Token& name);
+
+    void begin_function(FunctionState& state, FunctionType type, ObjString* name);
+    ObjFunction* end_function();
+    void begin_scope();
+    void end_scope();
+
+    void add_local(const Token& name);
+    int  resolve_local(FunctionState* state, const Token& name);
+    int  add_upvalue(FunctionState* state, uint8_t index, bool is_local);
+    int  resolve_upvalue(FunctionState* state, const Token& name);
+    void named_variable(const Token& name, bool assign);
+};
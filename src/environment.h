@@ -1,56 +1,148 @@
 #pragma once
 
-#include <map>
-#include <any>
 #include <string>
-#include <utility>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "lex.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
 #include "runtime_error.h"
 
-class Environment
+// Locals live in m_slots at the indexes Resolver assigned them. Only the
+// global environment looks names up in m_values.
+//
+// Environments are heap objects: closures keep their defining environment
+// alive, and the collector frees the cycles that creates. The exception is
+// a call frame of a function that creates no closures. Nothing can refer
+// to its environment once the call returns, so the interpreter takes one
+// from a preallocated pool and points its slots into the value stack,
+// where the arguments already are.
+class Environment : public Obj
 {
+    friend class Snapshot;
+
 private:
-    std::map<std::string, std::any> m_values;
+    struct Global
+    {
+        ObjString* m_name;
+        Value m_value;
+    };
+
+    // Keys view the interned names stored alongside each value.
+    std::unordered_map<std::string_view, Global> m_values;
+    std::vector<Value> m_storage;
+    Value* m_slots = nullptr;
+    int m_slot_count = 0;
 
 public:
-    std::shared_ptr<Environment> m_enclosing;
+    Environment* m_enclosing;
 
     Environment()
-        : m_enclosing(nullptr) { };
-    Environment(std::shared_ptr<Environment> enclosing)
-        : m_enclosing(std::move(enclosing)) { };
+        : Obj{OBJ_ENVIRONMENT}, m_enclosing(nullptr) { };
+    Environment(Environment* enclosing, int slot_count)
+        : Obj{OBJ_ENVIRONMENT}, m_storage(slot_count), m_slots(m_storage.data()),
+          m_slot_count(slot_count), m_enclosing(enclosing) { };
     ~Environment() = default;
 
-    void define(std::string name, std::any value)
+    // Reuses a pooled environment as a call frame over slots it doesn't own.
+    void bind_frame(Environment* enclosing, Value* slots, int slot_count)
     {
-        m_values[name] = value;
+        m_enclosing = enclosing;
+        m_slots = slots;
+        m_slot_count = slot_count;
     }
 
-    std::any get(Token name)
+    // Follows a frame's slots when the stack holding them is reallocated.
+    void move_frame(const Value* from, Value* to)
     {
-        if(m_values.count(name.m_lexeme))
-            return m_values[name.m_lexeme];
-
-        if(m_enclosing != nullptr) return m_enclosing->get(name);
-
-        throw RuntimeError(name, "Undefined variable '" + name.m_lexeme + "'.");
+        m_slots = to + (m_slots - from);
     }
 
-    void assign(Token name, std::any value)
+    void trace(Heap& heap) override
     {
-        if(m_values.count(name.m_lexeme))
+        for (auto& global : m_values)
         {
-            m_values[name.m_lexeme] = value;
-            return;
+            heap.mark(global.second.m_name);
+            heap.mark(global.second.m_value);
         }
 
-        if(m_enclosing != nullptr)
+        for (int i = 0; i < m_slot_count; ++i)
+            heap.mark(m_slots[i]);
+
+        heap.mark(m_enclosing);
+    }
+
+    size_t owned_bytes() const override { return m_storage.capacity() * sizeof(Value); }
+
+    void define(std::string_view name, Value value)
+    {
+        ObjString* interned = heap().intern(name);
+        m_values[interned->m_chars] = Global{interned, value};
+        heap().write_barrier(this);
+    }
+
+    void define(int slot, Value value)
+    {
+        m_slots[slot] = value;
+        heap().write_barrier(this);
+    }
+
+    Value get(const Token& name)
+    {
+        auto global = m_values.find(name.m_lexeme);
+        if(global != m_values.end())
+            return global->second.m_value;
+
+        throw RuntimeError(name, "Undefined variable '" + std::string{name.m_lexeme} + "'.");
+    }
+
+    // Where the global's value lives, which stays put for the life of the
+    // environment, or null if it isn't defined.
+    Value* find(std::string_view name)
+    {
+        auto global = m_values.find(name);
+        return global != m_values.end() ? &global->second.m_value : nullptr;
+    }
+
+    void assign(const Token& name, Value value)
+    {
+        auto global = m_values.find(name.m_lexeme);
+        if(global != m_values.end())
         {
-            m_enclosing->assign(name, value);
+            global->second.m_value = value;
+            heap().write_barrier(this);
             return;
         }
-            
-        throw RuntimeError(name, "Undefined variable '" + name.m_lexeme + "'.");
+
+        throw RuntimeError(name, "Undefined variable '" + std::string{name.m_lexeme} + "'.");
+    }
+
+    Environment* ancestor(int depth)
+    {
+        Environment* environment = this;
+        for(int i = 0; i < depth; ++i)
+            environment = environment->m_enclosing;
+
+        return environment;
+    }
+
+    Value get_at(int depth, int slot)
+    {
+        return ancestor(depth)->m_slots[slot];
+    }
+
+    Value* address_at(int depth, int slot)
+    {
+        return &ancestor(depth)->m_slots[slot];
+    }
+
+    void assign_at(int depth, int slot, Value value)
+    {
+        Environment* environment = ancestor(depth);
+        environment->m_slots[slot] = value;
+        heap().write_barrier(environment);
     }
 };
@@ -1,10 +1,12 @@
 #pragma once
 
-#include <any>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <utility>
 #include "lex.h"
+#include "shape.h"
+#include "value.h"
 
 class Assign;
 class Binary;
@@ -19,179 +21,241 @@ class This;
 class Unary;
 class Variable;
 
+// What a node has specialized to, from the operands the interpreter saw
+// the first time it ran. A specialized operation guards on the operand
+// types it expects, and when the guard fails the node falls back to the
+// generic operation for good. Equality and '!' work on any value, so they
+// specialize without a guard.
+enum BinaryKind : uint8_t
+{
+    BINARY_UNSPECIALIZED,
+    BINARY_GENERIC,
+    BINARY_ADD_NUMBERS,
+    BINARY_SUBTRACT_NUMBERS,
+    BINARY_MULTIPLY_NUMBERS,
+    BINARY_DIVIDE_NUMBERS,
+    BINARY_GREATER_NUMBERS,
+    BINARY_GREATER_EQUAL_NUMBERS,
+    BINARY_LESS_NUMBERS,
+    BINARY_LESS_EQUAL_NUMBERS,
+    BINARY_CONCATENATE_STRINGS,
+    BINARY_EQUAL,
+    BINARY_NOT_EQUAL,
+};
+
+enum UnaryKind : uint8_t
+{
+    UNARY_UNSPECIALIZED,
+    UNARY_GENERIC,
+    UNARY_NEGATE_NUMBER,
+    UNARY_NOT,
+};
+
+// Logical nodes specialize on a boolean left operand, which decides the
+// short circuit without a truthiness test.
+enum LogicalKind : uint8_t
+{
+    LOGICAL_UNSPECIALIZED,
+    LOGICAL_GENERIC,
+    LOGICAL_AND_BOOLEAN,
+    LOGICAL_OR_BOOLEAN,
+};
+
 class VisitorExpr {
 public:
-    virtual std::any visit_assign(std::shared_ptr<Assign> expr) = 0;
-    virtual std::any visit_binary(std::shared_ptr<Binary> expr) = 0;
-    virtual std::any visit_call(std::shared_ptr<Call> expr) = 0;
-    virtual std::any visit_get(std::shared_ptr<Get> expr) = 0;
-    virtual std::any visit_grouping(std::shared_ptr<Grouping> expr) = 0;
-    virtual std::any visit_literal(std::shared_ptr<Literal> expr) = 0;
-    virtual std::any visit_logical(std::shared_ptr<Logical> expr) = 0;
-    virtual std::any visit_set(std::shared_ptr<Set> expr) = 0;
-    virtual std::any visit_super(std::shared_ptr<Super> expr) = 0;
-    virtual std::any visit_this(std::shared_ptr<This> expr) = 0;
-    virtual std::any visit_unary(std::shared_ptr<Unary> expr) = 0;
-    virtual std::any visit_variable(std::shared_ptr<Variable> expr) = 0;
+    virtual Value visit_assign(Assign* expr) = 0;
+    virtual Value visit_binary(Binary* expr) = 0;
+    virtual Value visit_call(Call* expr) = 0;
+    virtual Value visit_get(Get* expr) = 0;
+    virtual Value visit_grouping(Grouping* expr) = 0;
+    virtual Value visit_literal(Literal* expr) = 0;
+    virtual Value visit_logical(Logical* expr) = 0;
+    virtual Value visit_set(Set* expr) = 0;
+    virtual Value visit_super(Super* expr) = 0;
+    virtual Value visit_this(This* expr) = 0;
+    virtual Value visit_unary(Unary* expr) = 0;
+    virtual Value visit_variable(Variable* expr) = 0;
 };
 
 class Expr {
 public:
-    virtual std::any accept(VisitorExpr& visitor) = 0;
+    virtual Value accept(VisitorExpr& visitor) = 0;
 };
 
-class Assign : public Expr, public std::enable_shared_from_this<Assign> {
+class Assign : public Expr {
 public:
     const Token m_name;
-    std::shared_ptr<Expr> m_value;
+    Expr* m_value;
+    // Set by Resolver. A depth of -1 means the name is a global.
+    int m_depth = -1;
+    int m_slot = -1;
 
-    Assign(Token name, std::shared_ptr<Expr> value) 
+    Assign(Token name, Expr* value) 
         : m_name(std::move(name)), m_value(std::move(value)) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_assign(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_assign(this);
     }
 };
 
-class Binary : public Expr, public std::enable_shared_from_this<Binary> {
+class Binary : public Expr {
 public:
-    std::shared_ptr<Expr> m_left;
-    std::shared_ptr<Expr> m_right;
+    Expr* m_left;
+    Expr* m_right;
     const Token m_operator;
+    BinaryKind m_kind = BINARY_UNSPECIALIZED;
 
-    Binary(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right) 
+    Binary(Expr* left, Token op, Expr* right) 
         : m_operator(op), m_left(std::move(left)), m_right(std::move(right)) {}
     
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_binary(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_binary(this);
     }
 };
 
-class Call : public Expr, public std::enable_shared_from_this<Call> {
+class Call : public Expr {
 public:
     const Token m_paren;
-    std::shared_ptr<Expr> m_calee;
-    const std::vector<std::shared_ptr<Expr>> m_arguments;
+    Expr* m_calee;
+    std::vector<Expr*> m_arguments;
 
-    Call(std::shared_ptr<Expr> calee, Token paren, const std::vector<std::shared_ptr<Expr>>& arguments) 
+    Call(Expr* calee, Token paren, const std::vector<Expr*>& arguments) 
         : m_calee(std::move(calee)), m_paren(std::move(paren)), m_arguments(std::move(arguments)) {}
     
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_call(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_call(this);
     }
 };
 
-class Get : public Expr, public std::enable_shared_from_this<Get> {
+class Get : public Expr {
 public:
     const Token m_name;
-    std::shared_ptr<Expr> m_object;
+    Expr* m_object;
+    // Interned property name, kept alive by the Program.
+    ObjString* const m_key;
+    PropertyCache m_cache;
 
-    Get(Token name, std::shared_ptr<Expr> object) 
-        : m_name(std::move(name)), m_object(std::move(object)) {}
+    Get(Token name, Expr* object, ObjString* key) 
+        : m_name(std::move(name)), m_object(std::move(object)), m_key(key) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_get(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_get(this);
     }
 };
 
-class Grouping : public Expr, public std::enable_shared_from_this<Grouping> {
+class Grouping : public Expr {
 public:
-    std::shared_ptr<Expr> m_expression;
+    Expr* m_expression;
 
-    Grouping(std::shared_ptr<Expr> expression) 
+    Grouping(Expr* expression) 
         : m_expression(std::move(expression)) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_grouping(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_grouping(this);
     }
 };
 
-class Literal : public Expr, public std::enable_shared_from_this<Literal> {
+class Literal : public Expr {
 public:
-    const std::any m_value;
+    const Value m_value;
 
-    Literal(std::any value) 
+    Literal(Value value) 
         : m_value(std::move(value)) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_literal(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_literal(this);
     }
 };
 
-class Logical : public Expr, public std::enable_shared_from_this<Logical> {
+class Logical : public Expr {
 public:
-    std::shared_ptr<Expr> m_left;
-    std::shared_ptr<Expr> m_right;
+    Expr* m_left;
+    Expr* m_right;
     const Token m_operator;
+    LogicalKind m_kind = LOGICAL_UNSPECIALIZED;
 
-    Logical(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right) 
+    Logical(Expr* left, Token op, Expr* right) 
         : m_left(std::move(left)), m_operator(std::move(op)), m_right(std::move(right)) {}
     
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_logical(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_logical(this);
     }
 };
 
-class Set : public Expr, public std::enable_shared_from_this<Set> {
+class Set : public Expr {
 public:
     const Token m_name;
-    std::shared_ptr<Expr> m_object;
-    std::shared_ptr<Expr> m_value;
+    Expr* m_object;
+    Expr* m_value;
+    // Interned property name, kept alive by the Program.
+    ObjString* const m_key;
+    PropertyCache m_cache;
 
-    Set(Token name, std::shared_ptr<Expr> value,std::shared_ptr<Expr> object) 
-        : m_name(std::move(name)), m_value(std::move(value)), m_object(std::move(object)) {}
+    Set(Token name, Expr* value,Expr* object, ObjString* key) 
+        : m_name(std::move(name)), m_value(std::move(value)), m_object(std::move(object)), m_key(key) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_set(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_set(this);
     }
 };
 
-class Super : public Expr, public std::enable_shared_from_this<Super> {
+class Super : public Expr {
 public:
     const Token m_keyword;
     const Token m_method;
+    // Interned method name, kept alive by the Program.
+    ObjString* const m_key;
+    // Set by Resolver. 'super' lives in slot 0 m_depth scopes out, and
+    // 'this' in slot 0 of the scope just inside it.
+    int m_depth = -1;
 
-    Super(Token keyword, Token method) 
-        : m_keyword(std::move(keyword)), m_method(std::move(method)) {}
+    Super(Token keyword, Token method, ObjString* key) 
+        : m_keyword(std::move(keyword)), m_method(std::move(method)), m_key(key) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_super(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_super(this);
     }
 };
 
-class This : public Expr, public std::enable_shared_from_this<This> {
+class This : public Expr {
 public:
     const Token m_keyword;
+    // Set by Resolver. 'this' is always slot 0 of its scope.
+    int m_depth = -1;
 
     This(Token keyword) 
         : m_keyword(std::move(keyword)) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_this(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_this(this);
     }
 };
 
-class Unary : public Expr, public std::enable_shared_from_this<Unary> {
+class Unary : public Expr {
 public:
     const Token m_operator;
-    std::shared_ptr<Expr> m_right;
+    Expr* m_right;
+    UnaryKind m_kind = UNARY_UNSPECIALIZED;
 
-    Unary(Token op, std::shared_ptr<Expr> right) 
+    Unary(Token op, Expr* right) 
         : m_operator(std::move(op)), m_right(std::move(right)) {}
     
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_unary(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_unary(this);
     }
 };
 
-class Variable : public Expr, public std::enable_shared_from_this<Variable> {
+class Variable : public Expr {
 public:
     const Token m_name;
+    // Set by Resolver. A depth of -1 means the name is a global.
+    int m_depth = -1;
+    int m_slot = -1;
 
     Variable(Token name) 
         : m_name(std::move(name)) {}
 
-    virtual std::any accept(VisitorExpr& visitor) override {
-        return visitor.visit_variable(shared_from_this());
+    virtual Value accept(VisitorExpr& visitor) override {
+        return visitor.visit_variable(this);
     }
 };
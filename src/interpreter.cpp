@@ -1,4 +1,3 @@
-#include <any>
 #include <algorithm>
 
 #include "interpreter.h"
@@ -7,104 +6,89 @@
 #include "lox_callable.h"
 #include "lox_function.h"
 #include "lox_return.h"
+#include "memory.h"
 
 void runtime_error(RuntimeError error);
 
-bool Interpreter::is_truthy(std::any object)
+void Interpreter::mark_roots(Heap& heap)
 {
-    if (object.type() == typeid(nullptr)) return false;
-    if (object.type() == typeid(bool)) {
-      return std::any_cast<bool>(object);
-    }
-    return true;
+    heap.mark(m_globals);
+    heap.mark(m_environment);
+    heap.mark(m_return.value);
+
+    for (Value* slot = m_stack.get(); slot < m_stack_top; ++slot)
+        heap.mark(*slot);
+
+    // A frame's own mark can be stale, since frames are rebound without a
+    // write barrier. Its slots are on the stack, so only its enclosing
+    // environment needs marking here.
+    for (int i = 0; i < m_frame_count; ++i)
+        heap.mark(m_frames[i].m_enclosing);
 }
 
-bool Interpreter::is_equal(std::any a, std::any b)
+Environment* Interpreter::push_frame(Environment* enclosing, Value* arguments, int slot_count)
 {
-    if(!a.has_value() && !b.has_value()) return true;
-    if(a.has_value() != b.has_value()) return false;
+    Value* end = arguments + slot_count;
+    if (end > m_stack.get() + STACK_MAX) return nullptr;
 
-    if (a.type() != b.type()) return false;
-    if (a.type() == typeid(double))
-        return std::any_cast<double>(a) == std::any_cast<double>(b);
-    else if (a.type() == typeid(std::string)) 
-        return std::any_cast<std::string>(a) == std::any_cast<std::string>(b);
+    for (Value* slot = m_stack_top; slot < end; ++slot)
+        *slot = nullptr;
+    m_stack_top = end;
 
-    return false;
+    Environment* frame = &m_frames[m_frame_count++];
+    frame->bind_frame(enclosing, arguments, slot_count);
+    return frame;
 }
 
-void Interpreter::check_number_operand(Token op, std::any operand)
+void Interpreter::check_number_operand(const Token& op, Value operand)
 {
-    if(operand.type() == typeid(double)) return;
+    if(operand.is_number()) return;
 
     throw RuntimeError(op, "Operand must be a number.");
 }
 
-void Interpreter::check_number_operands(Token op, std::any left, std::any right)
+void Interpreter::check_number_operands(const Token& op, Value left, Value right)
 {
-    if((left.type() == typeid(double)) && (right.type() == typeid(double))) return;
+    if(left.is_number() && right.is_number()) return;
 
     throw RuntimeError(op, "Operands must be numbers.");
 }
 
-std::string Interpreter::stringify(std::any object)
+Value Interpreter::visit_logical(Logical* expr)
 {
-    if(!object.has_value()) return "nil";
+    Value left = evaluate(expr->m_left);
+    if(short_circuits(expr, left)) return left;
 
-    std::string text;
-    if (object.type() == typeid(double))
-    {
-        text = std::to_string(std::any_cast<double>(object));
-        size_t dotPos = text.find('.');
-        if (dotPos != std::string::npos) 
-        {
-            size_t lastNonZeroPos = text.size() - 1;
-            while (text[lastNonZeroPos] == '0' && lastNonZeroPos > dotPos)
-                lastNonZeroPos--;
-
-            if (text[lastNonZeroPos] == '.') 
-                text.erase(lastNonZeroPos, std::string::npos);
-            else
-                text.erase(lastNonZeroPos + 1, std::string::npos);
-        }
+    return evaluate(expr->m_right);
+}
 
-        return text;
-    } else if (object.type() == typeid(std::string))
-    {
-        text = std::any_cast<std::string>(object);
-    }
-    else if (object.type() == typeid(bool)) 
-    {
-      return std::any_cast<bool>(object) ? "true" : "false";
-    }
-    else if (object.type() == typeid(std::shared_ptr<LoxFunction>)) 
-    {
-      return std::any_cast<
-          std::shared_ptr<LoxFunction>>(object)->to_string();
-    }
+bool Interpreter::generic_short_circuits(Logical* expr, Value left)
+{
+    bool is_or = expr->m_operator.m_type == TokenType::OR;
+    if (expr->m_kind == LOGICAL_UNSPECIALIZED && left.is_bool())
+        expr->m_kind = is_or ? LOGICAL_OR_BOOLEAN : LOGICAL_AND_BOOLEAN;
+    else
+        expr->m_kind = LOGICAL_GENERIC;
 
-    return text;
+    return is_or ? is_truthy(left) : !is_truthy(left);
 }
 
-std::any Interpreter::visit_logical(std::shared_ptr<Logical> expr)
+Value Interpreter::visit_unary(Unary* expr)
 {
-    std::any left = evaluate(expr->m_left);
+    return unary(expr, evaluate(expr->m_right));
+}
 
-    if(expr->m_operator.m_type == TokenType::OR)
-    {
-        if(is_truthy(left)) return left;
-    }
-    else
-    {
-        if(!is_truthy(left)) return left;
-    }
+static UnaryKind specialize(Unary* expr, Value right)
+{
+    if (expr->m_operator.m_type == BANG) return UNARY_NOT;
 
-    return evaluate(expr->m_right);
+    return right.is_number() ? UNARY_NEGATE_NUMBER : UNARY_GENERIC;
 }
 
-std::any Interpreter::visit_unary(std::shared_ptr<Unary> expr)
+Value Interpreter::generic_unary(Unary* expr, Value right)
 {
-    std::any right = evaluate(expr->m_right);
+    // A node that was already specialized has just failed its guard.
+    expr->m_kind = expr->m_kind == UNARY_UNSPECIALIZED ? specialize(expr, right) : UNARY_GENERIC;
 
     switch(expr->m_operator.m_type)
     {
@@ -112,193 +96,418 @@ std::any Interpreter::visit_unary(std::shared_ptr<Unary> expr)
             return !is_truthy(right);
         case MINUS:
             check_number_operand(expr->m_operator, right);
-            return -(std::any_cast<double>(right));
+            return -right.as_number();
+        default:
+            break;
     }
 
-    return std::any();
+    return Value{};
 }
 
-std::any Interpreter::visit_variable(std::shared_ptr<Variable> expr)
+Value Interpreter::visit_variable(Variable* expr)
 {
-    return m_environment->get(expr->m_name);
+    if(expr->m_depth < 0)
+        return m_globals->get(expr->m_name);
+
+    return m_environment->get_at(expr->m_depth, expr->m_slot);
 }
 
-std::any Interpreter::visit_binary(std::shared_ptr<Binary> expr)
+Value Interpreter::visit_binary(Binary* expr)
 {
-    std::any right = evaluate(expr->m_right);
-    std::any left = evaluate(expr->m_left);
+    Value left = evaluate(expr->m_left);
+    push(left);
+    Value right = evaluate(expr->m_right);
+    pop();
+
+    return binary(expr, left, right);
+}
+
+static BinaryKind specialize(Binary* expr, Value left, Value right)
+{
+    TokenType op = expr->m_operator.m_type;
+    if (op == EQUAL_EQUAL) return BINARY_EQUAL;
+    if (op == BANG_EQUAL) return BINARY_NOT_EQUAL;
+
+    if (op == PLUS && is_obj_type(left, OBJ_STRING) && is_obj_type(right, OBJ_STRING))
+        return BINARY_CONCATENATE_STRINGS;
+
+    if (!left.is_number() || !right.is_number()) return BINARY_GENERIC;
+
+    switch (op)
+    {
+        case PLUS:          return BINARY_ADD_NUMBERS;
+        case MINUS:         return BINARY_SUBTRACT_NUMBERS;
+        case STAR:          return BINARY_MULTIPLY_NUMBERS;
+        case SLASH:         return BINARY_DIVIDE_NUMBERS;
+        case GREATER:       return BINARY_GREATER_NUMBERS;
+        case GREATER_EQUAL: return BINARY_GREATER_EQUAL_NUMBERS;
+        case LESS:          return BINARY_LESS_NUMBERS;
+        case LESS_EQUAL:    return BINARY_LESS_EQUAL_NUMBERS;
+        default:            return BINARY_GENERIC;
+    }
+}
+
+Value Interpreter::generic_binary(Binary* expr, Value left, Value right)
+{
+    // A node that was already specialized has just failed its guard.
+    expr->m_kind = expr->m_kind == BINARY_UNSPECIALIZED ? specialize(expr, left, right) : BINARY_GENERIC;
 
     switch(expr->m_operator.m_type)
     {
         case GREATER:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) > std::any_cast<double>(right);
+            return left.as_number() > right.as_number();
         case GREATER_EQUAL:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) >= std::any_cast<double>(right);
+            return left.as_number() >= right.as_number();
         case LESS:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) < std::any_cast<double>(right);
+            return left.as_number() < right.as_number();
         case LESS_EQUAL:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) <= std::any_cast<double>(right);
+            return left.as_number() <= right.as_number();
         case BANG_EQUAL: 
-            check_number_operands(expr->m_operator, left, right);
             return !is_equal(left, right);
         case EQUAL_EQUAL: 
-            check_number_operands(expr->m_operator, left, right);
             return is_equal(left, right);
         case MINUS:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) - std::any_cast<double>(right);
+            return left.as_number() - right.as_number();
         case PLUS:
-            if(left.type() == typeid(double) && left.type() == typeid(double))
-                return std::any_cast<double>(left) + std::any_cast<double>(right);
+            if(left.is_number() && right.is_number())
+                return left.as_number() + right.as_number();
 
-            if(left.type() == typeid(std::string) && left.type() == typeid(std::string))
-                return std::any_cast<std::string>(left) + std::any_cast<std::string>(right);
+            if(is_obj_type(left, OBJ_STRING) && is_obj_type(right, OBJ_STRING))
+                return heap().intern(as_string(left)->m_chars + as_string(right)->m_chars);
 
             throw RuntimeError(expr->m_operator, "Operands must be two number or two strings");
 
         case SLASH:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) / std::any_cast<double>(right);
+            return left.as_number() / right.as_number();
         case STAR:
             check_number_operands(expr->m_operator, left, right);
-            return std::any_cast<double>(left) * std::any_cast<double>(right);
+            return left.as_number() * right.as_number();
+        default:
+            break;
     }
 
-    return std::any();
+    return Value{};
 }
 
-std::any Interpreter::visit_call(std::shared_ptr<Call> expr)
+Value Interpreter::visit_call(Call* expr)
 {
-    std::any callee = evaluate(expr->m_calee);
+    Value* base = m_stack_top;
+    LoxCallable* function = push_call(expr);
+    return finish_call(expr, function, base);
+}
 
-    std::vector<std::any> arguments;
-    for (const std::shared_ptr<Expr>& argument : expr->m_arguments) 
-    {
-      arguments.push_back(evaluate(argument));
-    }
+// Evaluates the callee and arguments onto the stack and checks that they
+// make a valid call.
+LoxCallable* Interpreter::push_call(Call* expr)
+{
+    Value* base = m_stack_top;
+    Value callee = evaluate(expr->m_calee);
+    push(callee);
 
-    std::shared_ptr<LoxCallable> function;
+    for (Expr* argument : expr->m_arguments) 
+      push(evaluate(argument));
+
+    return check_call(expr, callee, m_stack_top - base - 1);
+}
 
-    if (callee.type() == typeid(std::shared_ptr<LoxFunction>)) 
-      function = std::any_cast<std::shared_ptr<LoxFunction>>(callee);
+LoxCallable* Interpreter::check_call(Call* expr, Value callee, int arg_count)
+{
+    LoxCallable* function;
+
+    if (is_obj_type(callee, OBJ_CALLABLE)) 
+      function = static_cast<LoxCallable*>(callee.as_obj());
     else 
       throw RuntimeError{expr->m_paren, "Can only call functions and classes."};
 
-    if (arguments.size() != function->arity()) 
+    if (arg_count != function->arity()) 
     {
       throw RuntimeError{expr->m_paren, "Expected " +
           std::to_string(function->arity()) + " arguments but got " +
-          std::to_string(arguments.size()) + "."};
+          std::to_string(arg_count) + "."};
     }
 
-    return function->call(*this, std::move(arguments));
+    return function;
 }
 
-std::any Interpreter::visit_expression(std::shared_ptr<Expression> stmt)
+Value Interpreter::finish_call(Call* expr, LoxCallable* function, Value* base)
 {
-    evaluate(stmt->m_expression);
+    if (m_call_depth >= m_max_depth)
+      throw RuntimeError{expr->m_paren, "Stack overflow."};
+
+    m_call_depth++;
+    Value result = function->call(*this, base + 1);
+    m_call_depth--;
+
+    m_stack_top = base;
+    return result;
+}
+
+Value Interpreter::visit_get(Get* expr)
+{
+    return get_property(expr, evaluate(expr->m_object));
+}
+
+Value Interpreter::get_property(Get* expr, Value object)
+{
+    if (!is_obj_type(object, OBJ_INSTANCE))
+        throw RuntimeError(expr->m_name, "Only instances have properties.");
+
+    LoxInstance* instance = static_cast<LoxInstance*>(object.as_obj());
+    int slot = expr->m_cache.load(instance->shape, expr->m_key);
+    if (slot >= 0)
+        return instance->fields[slot];
+
+    LoxFunction* method = instance->klass->find_method(expr->m_key);
+    if (method != nullptr)
+        return method->bind(instance);
+
+    throw RuntimeError(expr->m_name, "Undefined property '" + std::string{expr->m_name.m_lexeme} + "'.");
+}
+
+Value Interpreter::visit_set(Set* expr)
+{
+    Value object = evaluate(expr->m_object);
+    if (!is_obj_type(object, OBJ_INSTANCE))
+        throw RuntimeError(expr->m_name, "Only instances have fields.");
+
+    push(object);
+    Value value = evaluate(expr->m_value);
+    pop();
 
-    return std::any();
+    return set_property(expr, object, value);
 }
 
-std::any Interpreter::visit_function(std::shared_ptr<Function> stmt)
+// The caller has checked that object is an instance.
+Value Interpreter::set_property(Set* expr, Value object, Value value)
 {
-    auto function = std::make_shared<LoxFunction>(stmt, m_environment);
-    m_environment->define(stmt->m_name.m_lexeme, function);
+    LoxInstance* instance = static_cast<LoxInstance*>(object.as_obj());
+    PropertyCache::Entry entry = expr->m_cache.store(instance->shape, expr->m_key);
+    if (entry.m_transition != nullptr)
+    {
+        instance->shape = entry.m_transition;
+        instance->fields.push_back(value);
+    }
+    else
+        instance->fields[entry.m_slot] = value;
+
+    heap().write_barrier(instance);
+    return value;
+}
+
+Value Interpreter::visit_super(Super* expr)
+{
+    LoxClass* superclass = static_cast<LoxClass*>(m_environment->get_at(expr->m_depth, 0).as_obj());
+    LoxInstance* object = static_cast<LoxInstance*>(m_environment->get_at(expr->m_depth - 1, 0).as_obj());
 
-    return std::any();
+    LoxFunction* method = superclass->find_method(expr->m_key);
+    if (method == nullptr)
+        throw RuntimeError(expr->m_method, "Undefined property '" + std::string{expr->m_method.m_lexeme} + "'.");
+
+    return method->bind(object);
+}
+
+Value Interpreter::visit_this(This* expr)
+{
+    return m_environment->get_at(expr->m_depth, 0);
+}
+
+void Interpreter::visit_class(Class* stmt)
+{
+    LoxClass* superclass = nullptr;
+    if (stmt->m_superclass != nullptr)
+    {
+        Value value = evaluate(stmt->m_superclass);
+        if (value.is_obj())
+            superclass = dynamic_cast<LoxClass*>(value.as_obj());
+
+        if (superclass == nullptr)
+            throw RuntimeError(stmt->m_superclass->m_name, "Superclass must be a class.");
+    }
+
+    // Methods of a subclass close over an extra scope that binds 'super'.
+    Environment* environment = m_environment;
+    if (superclass != nullptr)
+    {
+        environment = heap().allocate<Environment>(m_environment, 1);
+        environment->define(0, superclass);
+    }
+
+    std::unordered_map<ObjString*, LoxFunction*> methods;
+    for (Function* method : stmt->m_methods)
+    {
+        bool is_initializer = method->m_name.m_lexeme == "init";
+        methods[heap().intern(method->m_name.m_lexeme)] =
+            heap().allocate<LoxFunction>(method, environment, is_initializer);
+    }
+
+    auto klass = heap().allocate<LoxClass>(std::string{stmt->m_name.m_lexeme}, superclass, std::move(methods));
+
+    if(stmt->m_slot < 0)
+        m_globals->define(stmt->m_name.m_lexeme, klass);
+    else
+        m_environment->define(stmt->m_slot, klass);
+}
+
+void Interpreter::visit_expression(Expression* stmt)
+{
+    evaluate(stmt->m_expression);
 }
 
-std::any Interpreter::visit_if(std::shared_ptr<If> stmt)
+void Interpreter::visit_function(Function* stmt)
+{
+    auto function = heap().allocate<LoxFunction>(stmt, m_environment);
+
+    if(stmt->m_slot < 0)
+        m_globals->define(stmt->m_name.m_lexeme, function);
+    else
+        m_environment->define(stmt->m_slot, function);
+}
+
+void Interpreter::visit_if(If* stmt)
 {
     if(is_truthy(evaluate(stmt->m_condition)))
         execute(stmt->m_thenBranch);
     else if(stmt->m_elseBranch != nullptr)
         execute(stmt->m_elseBranch);
-
-    return std::any();
 }
 
-std::any Interpreter::visit_print(std::shared_ptr<Print> stmt)
+void Interpreter::visit_print(Print* stmt)
 {
-    std::any value = evaluate(stmt->m_expression);
+    Value value = evaluate(stmt->m_expression);
     std::cout << stringify(value) << "\n";
-    
-    return std::any();
 }
 
-std::any Interpreter::visit_return(std::shared_ptr<Return> stmt) 
+void Interpreter::visit_return(Return* stmt) 
 {
-    std::any value = nullptr;
-    if (stmt->m_value != nullptr) 
+    Value value = nullptr;
+    if (stmt->m_tail_call)
+    {
+        // A Lox function is left on the stack with its arguments, for the
+        // returning function's LoxFunction::call to run in its place.
+        Call* call = static_cast<Call*>(stmt->m_value);
+        Value* base = m_stack_top;
+        LoxCallable* function = push_call(call);
+        if (auto target = dynamic_cast<LoxFunction*>(function))
+        {
+            m_return.active = true;
+            m_return.tail_call = target;
+            m_return.tail_callee = base;
+            return;
+        }
+
+        value = finish_call(call, function, base);
+    }
+    else if (stmt->m_value != nullptr) 
         value = evaluate(stmt->m_value);
 
-    throw LoxReturn{value};
+    m_return.active = true;
+    m_return.value = value;
 }
 
-std::any Interpreter::visit_var(std::shared_ptr<Var> stmt)
+void Interpreter::visit_var(Var* stmt)
 {
-    std::any value;
+    Value value;
     if(stmt->m_initializer != nullptr)
         value = evaluate(stmt->m_initializer);
 
-    m_environment->define(stmt->m_name.m_lexeme, std::move(value));
-    return std::any();
+    if(stmt->m_slot < 0)
+        m_globals->define(stmt->m_name.m_lexeme, value);
+    else
+        m_environment->define(stmt->m_slot, value);
 }
 
-std::any Interpreter::visit_while(std::shared_ptr<While> stmt)
+void Interpreter::visit_while(While* stmt)
 {
-    while(is_truthy(evaluate(stmt->m_condition)))
-        execute(stmt->m_body);
+    for (;;)
+    {
+        // Native code runs the rest of the loop, unless it bails.
+        Value value;
+        Tiering::LoopResult tier = m_tiering.loop(stmt, m_environment, m_max_depth - m_call_depth, value);
+        if (tier == Tiering::LOOP_DONE) return;
+        if (tier == Tiering::LOOP_RETURNED)
+        {
+            m_return.active = true;
+            m_return.value = value;
+            return;
+        }
+
+        if (!is_truthy(evaluate(stmt->m_condition))) return;
 
-    return std::any();
+        execute(stmt->m_body);
+        if(m_return.active) return;
+    }
 }
 
-std::any Interpreter::visit_assign(std::shared_ptr<Assign> expr)
+Value Interpreter::visit_assign(Assign* expr)
 {
-    std::any value = evaluate(expr->m_value);
-    m_environment->assign(expr->m_name, value);
+    Value value = evaluate(expr->m_value);
+
+    if(expr->m_depth < 0)
+        m_globals->assign(expr->m_name, value);
+    else
+        m_environment->assign_at(expr->m_depth, expr->m_slot, value);
+
     return value;
 }
 
-std::any Interpreter::visit_block(std::shared_ptr<Block> stmt)
+void Interpreter::visit_block(Block* stmt)
 {
-    execute_block(stmt->m_statements, std::make_shared<Environment>(m_environment));
-    return std::any();
+    if (stmt->m_flattened)
+    {
+        for (Stmt* statement : stmt->m_statements)
+        {
+            execute(statement);
+            if (m_return.active) return;
+        }
+        return;
+    }
+
+    execute_block(stmt->m_statements, heap().allocate<Environment>(m_environment, stmt->m_slot_count));
 }
 
-void Interpreter::execute_block(const std::vector<std::shared_ptr<Stmt>>& statements, std::shared_ptr<Environment> environment)
+void Interpreter::execute_block(const std::vector<Stmt*>& statements, Environment* environment)
 {
-    std::shared_ptr<Environment> previous = m_environment;
+    Environment* previous = m_environment;
+    push(previous);
     try
     {
         m_environment = environment;
 
-        for(const std::shared_ptr<Stmt>& statement : statements)
+        for(Stmt* statement : statements)
+        {
             execute(statement);
+            if(m_return.active) break;
+        }
     }
     catch(...)
     {
         m_environment = previous;
+        pop();
         throw;
     }
 
     m_environment = previous;
+    pop();
 }
 
-void Interpreter::interpret(const std::vector<std::shared_ptr<Stmt>>& statements)
+void Interpreter::interpret(const std::vector<Stmt*>& statements)
 {
     try
     {
-        for(const std::shared_ptr<Stmt>& statement : statements)
+        for(Stmt* statement : statements)
             execute(statement);
     }
-    catch(RuntimeError error)
+    catch(const RuntimeError& error)
     {
         runtime_error(error);
+        m_stack_top = m_stack.get();
+        m_frame_count = 0;
+        m_call_depth = 0;
     }
 }
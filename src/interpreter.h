@@ -1,6 +1,5 @@
 #pragma once
 
-#include <any>
 #include <chrono>
 #include <iostream>
 #include <memory>
@@ -13,79 +12,215 @@
 #include "stmt.h"
 #include "environment.h"
 #include "lox_callable.h"
+#include "lox_class.h"
 #include "lox_function.h"
+#include "lox_instance.h"
 #include "lox_return.h"
+#include "memo_table.h"
+#include "memory.h"
+#include "tiering.h"
+#include "value.h"
 
 class NativeClock: public LoxCallable {
 public:
   int arity() override { return 0; }
 
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override {
+  Value call(Interpreter&, Value*) override {
     auto ticks = std::chrono::system_clock::now().time_since_epoch();
-    return std::chrono::duration<double>{ticks}.count() / 1000.0;
+    return std::chrono::duration<double>{ticks}.count();
   }
 
   std::string to_string() override { return "<native fn>"; }
 };
 
-class Interpreter : public VisitorExpr, public VisitorStmt
+class Interpreter : public VisitorExpr, public VisitorStmt, public RootSet
 {
 friend class LoxFunction;
+friend class LoxClass;
 
 public:
     Interpreter() 
     {
-        m_globals->define("clock", std::shared_ptr<NativeClock>{});
+        heap().add_roots(this);
+        m_globals->define("clock", heap().allocate<NativeClock>());
     };
 
-    ~Interpreter() = default;
+    ~Interpreter() { heap().remove_roots(this); };
 
-    std::any visit_literal(std::shared_ptr<Literal> expr) override
+    void mark_roots(Heap& heap) override;
+
+    Value visit_literal(Literal* expr) override
     { return expr->m_value; };
 
-    std::any visit_grouping(std::shared_ptr<Grouping> expr) override
+    Value visit_grouping(Grouping* expr) override
     { return evaluate(expr->m_expression); };
 
-    std::any visit_unary(std::shared_ptr<Unary> expr) override;
-    std::any visit_binary(std::shared_ptr<Binary> expr) override;
-    std::any visit_assign(std::shared_ptr<Assign> expr) override;
-    std::any visit_call(std::shared_ptr<Call> expr) override;
-    std::any visit_get(std::shared_ptr<Get> expr) override {};
-    std::any visit_logical(std::shared_ptr<Logical> expr) override;
-    std::any visit_set(std::shared_ptr<Set> expr) override {};
-    std::any visit_super(std::shared_ptr<Super> expr) override {};
-    std::any visit_this(std::shared_ptr<This> expr) override {};
-    std::any visit_variable(std::shared_ptr<Variable> expr) override;
-
-    std::any visit_block(std::shared_ptr<Block> stmt) override;
-    std::any visit_class(std::shared_ptr<Class> stmt) override {};
-    std::any visit_expression(std::shared_ptr<Expression> stmt) override;
-    std::any visit_function(std::shared_ptr<Function> stmt) override;
-    std::any visit_if(std::shared_ptr<If> stmt) override;
-    std::any visit_print(std::shared_ptr<Print> stmt) override;
-    std::any visit_return(std::shared_ptr<Return> stmt) override;
-    std::any visit_var(std::shared_ptr<Var> stmt) override;
-    std::any visit_while(std::shared_ptr<While> stmt) override;
-
-    void interpret(const std::vector<std::shared_ptr<Stmt>>& statements);
-
-    std::shared_ptr<Environment> m_globals{new Environment};
-
-private:
-    std::shared_ptr<Environment> m_environment = m_globals;
-
-    std::any evaluate(std::shared_ptr<Expr> expr)
+    Value visit_unary(Unary* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_assign(Assign* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+    void interpret(const std::vector<Stmt*>& statements);
+
+    static constexpr int FRAMES_MAX = 4096;
+    static constexpr int STACK_MAX = FRAMES_MAX * 64;
+
+    Environment* const m_globals = heap().allocate<Environment>();
+    Tiering m_tiering{m_globals};
+
+    // Caches the results of functions Resolver proved pure.
+    bool m_memoize = false;
+    MemoStats m_memo_stats;
+    // Calls nested deeper than this report a stack overflow. The tree
+    // walker recurses natively, so it can't go past FRAMES_MAX.
+    int m_max_depth = FRAMES_MAX;
+
+protected:
+    // Temporaries live past STACK_MAX in the last frame's expressions.
+    static constexpr int STACK_SLACK = 256;
+
+    Environment* m_environment = m_globals;
+    LoxReturn m_return;
+    int m_call_depth = 0;
+
+    // Holds the slots of pooled call frames, and the values the C++ stack
+    // holds while evaluating code that may reach a safepoint: binary
+    // operands, callees and arguments, and the environments that
+    // execute_block() will restore.
+    std::unique_ptr<Value[]> m_stack{new Value[STACK_MAX + STACK_SLACK]};
+    Value* m_stack_top = m_stack.get();
+    std::unique_ptr<Environment[]> m_frames{new Environment[FRAMES_MAX]};
+    int m_frame_count = 0;
+
+    void push(Value value) { *m_stack_top++ = value; }
+    Value pop() { return *--m_stack_top; }
+
+    // Makes the arguments on top of the stack the first slots of a pooled
+    // environment, or returns null if its slots would overflow the stack.
+    // The caller of the function pops the slots along with the arguments.
+    Environment* push_frame(Environment* enclosing, Value* arguments, int slot_count);
+    void pop_frame() { m_frame_count--; }
+
+    LoxCallable* push_call(Call* expr);
+    LoxCallable* check_call(Call* expr, Value callee, int arg_count);
+    Value finish_call(Call* expr, LoxCallable* function, Value* base);
+
+    // Run a node's specialized operation if its guard holds, and the
+    // generic one otherwise. See BinaryKind.
+    Value unary(Unary* expr, Value right)
+    {
+        switch (expr->m_kind)
+        {
+            case UNARY_NEGATE_NUMBER:
+                if (right.is_number()) return -right.as_number();
+                break;
+            case UNARY_NOT:
+                return right.is_falsey();
+            default:
+                break;
+        }
+
+        return generic_unary(expr, right);
+    }
+
+    Value binary(Binary* expr, Value left, Value right)
+    {
+        bool numbers = left.is_number() && right.is_number();
+        switch (expr->m_kind)
+        {
+            case BINARY_ADD_NUMBERS:
+                if (numbers) return left.as_number() + right.as_number();
+                break;
+            case BINARY_SUBTRACT_NUMBERS:
+                if (numbers) return left.as_number() - right.as_number();
+                break;
+            case BINARY_MULTIPLY_NUMBERS:
+                if (numbers) return left.as_number() * right.as_number();
+                break;
+            case BINARY_DIVIDE_NUMBERS:
+                if (numbers) return left.as_number() / right.as_number();
+                break;
+            case BINARY_GREATER_NUMBERS:
+                if (numbers) return left.as_number() > right.as_number();
+                break;
+            case BINARY_GREATER_EQUAL_NUMBERS:
+                if (numbers) return left.as_number() >= right.as_number();
+                break;
+            case BINARY_LESS_NUMBERS:
+                if (numbers) return left.as_number() < right.as_number();
+                break;
+            case BINARY_LESS_EQUAL_NUMBERS:
+                if (numbers) return left.as_number() <= right.as_number();
+                break;
+            case BINARY_CONCATENATE_STRINGS:
+                if (is_obj_type(left, OBJ_STRING) && is_obj_type(right, OBJ_STRING))
+                    return heap().intern(as_string(left)->m_chars + as_string(right)->m_chars);
+                break;
+            case BINARY_EQUAL:
+                return left == right;
+            case BINARY_NOT_EQUAL:
+                return left != right;
+            default:
+                break;
+        }
+
+        return generic_binary(expr, left, right);
+    }
+
+    // True if the left operand is the value of the whole expression.
+    bool short_circuits(Logical* expr, Value left)
+    {
+        switch (expr->m_kind)
+        {
+            case LOGICAL_AND_BOOLEAN:
+                if (left.is_bool()) return !left.as_bool();
+                break;
+            case LOGICAL_OR_BOOLEAN:
+                if (left.is_bool()) return left.as_bool();
+                break;
+            default:
+                break;
+        }
+
+        return generic_short_circuits(expr, left);
+    }
+
+    Value generic_unary(Unary* expr, Value right);
+    Value generic_binary(Binary* expr, Value left, Value right);
+    bool generic_short_circuits(Logical* expr, Value left);
+    Value get_property(Get* expr, Value object);
+    Value set_property(Set* expr, Value object, Value value);
+
+    Value evaluate(Expr* expr)
     { return expr->accept(*this); };
 
-    void execute(std::shared_ptr<Stmt> stmt)
-    { stmt->accept(*this); };
+    void execute(Stmt* stmt)
+    {
+        heap().safepoint();
+        stmt->accept(*this);
+    };
 
-    bool is_truthy(std::any object);
-    bool is_equal(std::any a, std::any b);
-    void check_number_operand(Token op, std::any operand);
-    void check_number_operands(Token op, std::any left, std::any right);
-    std::string stringify(std::any object);
+    bool is_truthy(Value object) { return !object.is_falsey(); };
+    bool is_equal(Value a, Value b) { return a == b; };
+    void check_number_operand(const Token& op, Value operand);
+    void check_number_operands(const Token& op, Value left, Value right);
+    std::string stringify(Value object) { return to_string(object); };
 
-    void execute_block(const std::vector<std::shared_ptr<Stmt>>& statements, std::shared_ptr<Environment> environment);
+    void execute_block(const std::vector<Stmt*>& statements, Environment* environment);
 };
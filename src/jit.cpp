@@ -0,0 +1,945 @@
+#include "jit.h"
+
+#include <cstring>
+#include <initializer_list>
+#include <string_view>
+
+#include "environment.h"
+#include "expr.h"
+#include "lox_function.h"
+#include "object.h"
+#include "stmt.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LOX_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Jit::~Jit()
+{
+#ifdef LOX_JIT_SUPPORTED
+    for (const Region& region : m_regions)
+        munmap(region.m_address, region.m_size);
+#endif
+}
+
+#ifdef LOX_JIT_SUPPORTED
+
+void* Jit::install(const std::vector<uint8_t>& code)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (code.size() + page - 1) / page * page;
+
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+        return nullptr;
+
+    std::memcpy(address, code.data(), code.size());
+    if (mprotect(address, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(address, size);
+        return nullptr;
+    }
+
+    m_regions.push_back(Region{address, size});
+    return address;
+}
+
+namespace {
+
+// Thrown when the code uses something compiled code can't do.
+struct Unsupported
+{
+    const char* m_reason;
+};
+
+enum Type { TYPE_NUMBER, TYPE_BOOL };
+
+// The low nibble of the Jcc and SETcc opcodes.
+enum Condition : uint8_t
+{
+    CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8, CC_P = 0xA, CC_NP = 0xB,
+};
+
+enum Xmm : uint8_t { XMM0, XMM1 };
+
+// Just the instructions the templates use, named as in assembly. Frame
+// slots are addressed off rbp, spills off rsp.
+class Assembler
+{
+public:
+    std::vector<uint8_t> m_code;
+
+    size_t here() const { return m_code.size(); }
+
+    void emit(std::initializer_list<uint8_t> bytes) { m_code.insert(m_code.end(), bytes); }
+    void imm32(int32_t value) { append(&value, sizeof(value)); }
+    void imm64(uint64_t value) { append(&value, sizeof(value)); }
+
+    // Jumps return where their displacement is, for patch() to fill in.
+    size_t jmp() { emit({0xE9}); return displacement(); }
+    size_t jcc(Condition cc) { emit({0x0F, uint8_t(0x80 | cc)}); return displacement(); }
+
+    void patch(size_t jump, size_t target)
+    {
+        int32_t offset = static_cast<int32_t>(target - (jump + 4));
+        std::memcpy(&m_code[jump], &offset, sizeof(offset));
+    }
+
+    void mov_rax(uint64_t imm) { emit({0x48, 0xB8}); imm64(imm); }
+    void mov_rdx(uint64_t imm) { emit({0x48, 0xBA}); imm64(imm); }
+    void mov_eax(int32_t imm) { emit({0xB8}); imm32(imm); }
+
+    void mov_rax_slot(int32_t disp) { emit({0x48, 0x8B, 0x85}); imm32(disp); }
+    void mov_slot_rax(int32_t disp) { emit({0x48, 0x89, 0x85}); imm32(disp); }
+    void movsd_slot(Xmm xmm, int32_t disp) { emit({0xF2, 0x0F, 0x10, uint8_t(0x85 | xmm << 3)}); imm32(disp); }
+    void movsd_slot_xmm0(int32_t disp) { emit({0xF2, 0x0F, 0x11, 0x85}); imm32(disp); }
+    void mov_rax_argument(int32_t disp) { emit({0x48, 0x8B, 0x87}); imm32(disp); }
+    void mov_rax_spill(int32_t disp) { emit({0x48, 0x8B, 0x84, 0x24}); imm32(disp); }
+    void movsd_spill_xmm0(int32_t disp) { emit({0xF2, 0x0F, 0x11, 0x84, 0x24}); imm32(disp); }
+    // The outer locals' addresses are an array at r12.
+    void mov_rax_outer(int32_t disp) { emit({0x49, 0x8B, 0x84, 0x24}); imm32(disp); }
+    void mov_rcx_outer(int32_t disp) { emit({0x49, 0x8B, 0x8C, 0x24}); imm32(disp); }
+    void mov_rax_at_rax() { emit({0x48, 0x8B, 0x00}); }
+    void mov_at_rcx_rax() { emit({0x48, 0x89, 0x01}); }
+
+    void movq_xmm_rax(Xmm xmm) { emit({0x66, 0x48, 0x0F, 0x6E, uint8_t(0xC0 | xmm << 3)}); }
+    void movq_rax_xmm0() { emit({0x66, 0x48, 0x0F, 0x7E, 0xC0}); }
+    void movapd_xmm1_xmm0() { emit({0x66, 0x0F, 0x28, 0xC8}); }
+    // addsd, subsd, mulsd or divsd xmm0, xmm1.
+    void arithmetic(uint8_t opcode) { emit({0xF2, 0x0F, opcode, 0xC1}); }
+    void xorpd_xmm0_xmm1() { emit({0x66, 0x0F, 0x57, 0xC1}); }
+    void ucomisd(Xmm left, Xmm right) { emit({0x66, 0x0F, 0x2E, uint8_t(0xC0 | left << 3 | right)}); }
+
+    void setcc_al(Condition cc) { emit({0x0F, uint8_t(0x90 | cc), 0xC0}); }
+    void setcc_cl(Condition cc) { emit({0x0F, uint8_t(0x90 | cc), 0xC1}); }
+    void and_al_cl() { emit({0x20, 0xC8}); }
+    void or_al_cl() { emit({0x08, 0xC8}); }
+    void movzx_eax_al() { emit({0x0F, 0xB6, 0xC0}); }
+    void xor_eax_1() { emit({0x83, 0xF0, 0x01}); }
+    void test_eax_eax() { emit({0x85, 0xC0}); }
+    void cmp_ecx_eax() { emit({0x39, 0xC1}); }
+    void cmp_rax_rdx() { emit({0x48, 0x39, 0xD0}); }
+    void cmovne_rax_rdx() { emit({0x48, 0x0F, 0x45, 0xC2}); }
+
+    void push_rax() { emit({0x50}); }
+    void pop_rcx() { emit({0x59}); }
+    void sub_rsp(int32_t imm) { emit({0x48, 0x81, 0xEC}); imm32(imm); }
+    void add_rsp(int32_t imm) { emit({0x48, 0x81, 0xC4}); imm32(imm); }
+    void spill_xmm0() { sub_rsp(8); emit({0xF2, 0x0F, 0x11, 0x04, 0x24}); }
+    void unspill_xmm0() { emit({0xF2, 0x0F, 0x10, 0x04, 0x24}); add_rsp(8); }
+
+    // Jumps to bail if rax doesn't hold a number. Clobbers rcx and rdx.
+    size_t guard_number()
+    {
+        mov_rdx(Value::NAN_MASK);
+        emit({0x48, 0x89, 0xC1});   // mov rcx, rax
+        emit({0x48, 0x21, 0xD1});   // and rcx, rdx
+        emit({0x48, 0x39, 0xD1});   // cmp rcx, rdx
+        return jcc(CC_E);
+    }
+
+private:
+    void append(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+        m_code.insert(m_code.end(), bytes, bytes + size);
+    }
+
+    size_t displacement()
+    {
+        imm32(0);
+        return here() - 4;
+    }
+};
+
+// Frame layout below rbp: the caller's rbx and r12, then one slot per
+// local.
+int32_t slot_offset(int slot) { return -24 - 8 * slot; }
+
+}
+
+// Emits a function or a loop: numbers are evaluated into xmm0, booleans
+// into eax as 0 or 1, and operands wait on the native stack while the
+// other side is evaluated. Locals keep a frame slot each, found by name as
+// the VM's compiler does, and hold raw doubles or 0/1 according to their
+// type. rbx holds the JitState throughout.
+//
+// A loop also uses locals the interpreter declared before it. Their types
+// are whatever they hold when the loop is compiled, which the loop checks
+// again on every entry.
+class JitCompiler : public VisitorExpr, public VisitorStmt
+{
+public:
+    JitCompiler(Jit& jit, Function* function) : m_jit{jit}, m_function{function} { }
+
+    JitCompiler(Jit& jit, While* loop, Environment* environment, JitLoop& compiled)
+        : m_jit{jit}, m_loop{loop}, m_environment{environment}, m_compiled_loop{&compiled} { }
+
+    std::vector<uint8_t> compile();
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get*) override { throw Unsupported{"uses properties"}; }
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set*) override { throw Unsupported{"uses properties"}; }
+    Value visit_super(Super*) override { throw Unsupported{"uses super"}; }
+    Value visit_this(This*) override { throw Unsupported{"uses this"}; }
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class*) override { throw Unsupported{"declares a class"}; }
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function*) override { throw Unsupported{"declares a function"}; }
+    void visit_if(If* stmt) override;
+    void visit_print(Print*) override { throw Unsupported{"prints"}; }
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    struct Local
+    {
+        std::string_view m_name;
+        int m_depth;
+        int m_slot;
+        Type m_type;
+    };
+
+    Jit& m_jit;
+    // What's being compiled: one or the other.
+    Function* m_function = nullptr;
+    While* m_loop = nullptr;
+    Environment* m_environment = nullptr;
+    JitLoop* m_compiled_loop = nullptr;
+
+    Assembler m_asm;
+    std::vector<Local> m_locals;
+    // A loop's variables from outside it, in the order of
+    // m_compiled_loop's m_outer, and whether the loop assigns them.
+    std::vector<Local> m_outer;
+    std::vector<bool> m_written;
+    int m_scope_depth = 0;
+    // Blocks inside a loop that the interpreter gives an environment.
+    int m_environments = 0;
+    int m_slot_count = 0;
+    // The type of the expression just compiled.
+    Type m_type = TYPE_NUMBER;
+    size_t m_body_start = 0;
+    // Where a loop that returns keeps the value while it stores its locals.
+    int m_return_slot = -1;
+    std::vector<size_t> m_bail_jumps;
+    std::vector<size_t> m_exit_jumps;
+
+    Type compile(Expr* expr)
+    {
+        expr->accept(*this);
+        return m_type;
+    }
+
+    void compile(Stmt* stmt) { stmt->accept(*this); }
+
+    void compile_number(Expr* expr)
+    {
+        if (compile(expr) != TYPE_NUMBER) throw Unsupported{"uses a number as something else"};
+    }
+
+    void compile_bool(Expr* expr)
+    {
+        if (compile(expr) != TYPE_BOOL) throw Unsupported{"uses a non-boolean as a boolean"};
+    }
+
+    void compile_function();
+    void compile_loop();
+    void prologue();
+    size_t epilogue();
+    void load_outer();
+    void store_outer();
+
+    void number_operands(Binary* expr);
+    bool load_leaf(Expr* expr, Xmm xmm);
+    // Leaves the condition in the flags, zero when false.
+    void condition(Expr* expr);
+    void value_to_rax();
+    LoxFunction* callee(Call* expr);
+
+    Local* resolve(std::string_view name)
+    {
+        for (auto local = m_locals.rbegin(); local != m_locals.rend(); ++local)
+            if (local->m_name == name) return &*local;
+
+        return nullptr;
+    }
+
+    Local lookup(const Token& name, int depth, int slot, bool write);
+
+    void declare(std::string_view name, Type type)
+    {
+        m_locals.push_back(Local{name, m_scope_depth, m_slot_count++, type});
+    }
+
+    void bail_if(size_t jump) { m_bail_jumps.push_back(jump); }
+};
+
+std::vector<uint8_t> JitCompiler::compile()
+{
+    if (m_function != nullptr)
+        compile_function();
+    else
+        compile_loop();
+
+    return std::move(m_asm.m_code);
+}
+
+void JitCompiler::prologue()
+{
+    m_asm.emit({0x55});                 // push rbp
+    m_asm.emit({0x48, 0x89, 0xE5});     // mov rbp, rsp
+    m_asm.emit({0x53});                 // push rbx
+    m_asm.emit({0x41, 0x54});           // push r12
+    m_asm.emit({0x48, 0x89, 0xF3});     // mov rbx, rsi
+    m_asm.emit({0x49, 0x89, 0xFC});     // mov r12, rdi
+    m_asm.sub_rsp(0);
+}
+
+// Emits the return and bailout paths, and fills in everything that jumps
+// to them. Returns where the return path starts.
+size_t JitCompiler::epilogue()
+{
+    size_t exit = m_asm.here();
+    if (m_function != nullptr)
+        m_asm.emit({0xFF, 0x03});       // inc dword [rbx + m_frames_left]
+    m_asm.emit({0x48, 0x8B, 0x5D, 0xF8}); // mov rbx, [rbp - 8]
+    m_asm.emit({0x4C, 0x8B, 0x65, 0xF0}); // mov r12, [rbp - 16]
+    m_asm.emit({0xC9});                 // leave
+    m_asm.emit({0xC3});                 // ret
+
+    size_t bail = m_asm.here();
+    m_asm.emit({0xC7, 0x43, 0x04});     // mov dword [rbx + m_bailed], 1
+    m_asm.imm32(1);
+    m_asm.mov_rax(Value{}.bits());
+    m_asm.patch(m_asm.jmp(), exit);
+
+    for (size_t jump : m_bail_jumps)
+        m_asm.patch(jump, bail);
+
+    // The prologue's sub rsp is the frame's first immediate.
+    int32_t size = 8 * m_slot_count;
+    std::memcpy(&m_asm.m_code[16], &size, sizeof(size));
+    return exit;
+}
+
+void JitCompiler::compile_function()
+{
+    prologue();
+
+    // Every entry takes a frame, and the exit gives it back, bailing or not.
+    m_asm.emit({0xFF, 0x0B});           // dec dword [rbx + m_frames_left]
+    bail_if(m_asm.jcc(CC_S));
+
+    for (size_t i = 0; i < m_function->m_params.size(); ++i)
+    {
+        m_asm.mov_rax_argument(8 * i);
+        bail_if(m_asm.guard_number());
+        declare(m_function->m_params[i].m_lexeme, TYPE_NUMBER);
+        m_asm.mov_slot_rax(slot_offset(i));
+    }
+
+    m_body_start = m_asm.here();
+    m_scope_depth++;
+    for (Stmt* statement : m_function->body())
+        compile(statement);
+
+    m_asm.mov_rax(Value{}.bits());
+
+    size_t exit = epilogue();
+    for (size_t jump : m_exit_jumps)
+        m_asm.patch(jump, exit);
+}
+
+// The loop is entered at the top of an iteration, loads the outer locals
+// from their environments, and stores the ones it assigns back after each
+// iteration, when it leaves, and before it returns. Bailing out skips the
+// store, which leaves the interpreter at the start of the iteration that
+// bailed.
+void JitCompiler::compile_loop()
+{
+    prologue();
+    m_return_slot = m_slot_count++;
+    size_t entry = m_asm.jmp();
+
+    size_t head = m_asm.here();
+    condition(m_loop->m_condition);
+    size_t done = m_asm.jcc(CC_E);
+    compile(m_loop->m_body);
+    size_t next = m_asm.jmp();
+
+    m_asm.patch(entry, m_asm.here());
+    load_outer();
+    m_asm.patch(m_asm.jmp(), head);
+
+    m_asm.patch(next, m_asm.here());
+    store_outer();
+    m_asm.patch(m_asm.jmp(), head);
+
+    m_asm.patch(done, m_asm.here());
+    for (size_t jump : m_exit_jumps)
+        m_asm.patch(jump, m_asm.here());
+    store_outer();
+    m_asm.mov_rax_slot(slot_offset(m_return_slot));
+    size_t leave = m_asm.jmp();
+
+    m_asm.patch(leave, epilogue());
+}
+
+// Guards each outer local's type as it loads it.
+void JitCompiler::load_outer()
+{
+    for (size_t i = 0; i < m_outer.size(); ++i)
+    {
+        m_asm.mov_rax_outer(8 * i);
+        m_asm.mov_rax_at_rax();
+
+        if (m_outer[i].m_type == TYPE_NUMBER)
+            bail_if(m_asm.guard_number());
+        else
+        {
+            // Only false and true are false or true once bit 0 is set.
+            m_asm.emit({0x48, 0x89, 0xC1});     // mov rcx, rax
+            m_asm.emit({0x48, 0x83, 0xC9, 0x01}); // or rcx, 1
+            m_asm.mov_rdx(Value{false}.bits());
+            m_asm.emit({0x48, 0x39, 0xD1});     // cmp rcx, rdx
+            bail_if(m_asm.jcc(CC_NE));
+
+            m_asm.mov_rdx(Value{true}.bits());
+            m_asm.cmp_rax_rdx();
+            m_asm.setcc_al(CC_E);
+            m_asm.movzx_eax_al();
+        }
+
+        m_asm.mov_slot_rax(slot_offset(m_outer[i].m_slot));
+    }
+}
+
+void JitCompiler::store_outer()
+{
+    for (size_t i = 0; i < m_outer.size(); ++i)
+    {
+        if (!m_written[i]) continue;
+
+        m_asm.mov_rax_slot(slot_offset(m_outer[i].m_slot));
+        m_type = m_outer[i].m_type;
+        if (m_type == TYPE_BOOL)
+            value_to_rax();
+
+        m_asm.mov_rcx_outer(8 * i);
+        m_asm.mov_at_rcx_rax();
+    }
+}
+
+// The local a name refers to: one the compiled code declared, or in a
+// loop a global or a local declared outside it, which becomes an outer
+// variable.
+JitCompiler::Local JitCompiler::lookup(const Token& name, int depth, int slot, bool write)
+{
+    if (Local* local = resolve(name.m_lexeme))
+        return *local;
+
+    if (m_loop == nullptr)
+        throw Unsupported{"uses a global or captured variable"};
+
+    JitLoop::Outer outer{nullptr, depth - m_environments, slot};
+    if (depth == -1)
+    {
+        outer = JitLoop::Outer{m_jit.m_globals->find(name.m_lexeme), -1, -1};
+        if (outer.m_global == nullptr)
+            throw Unsupported{"uses an undefined global"};
+    }
+
+    for (size_t i = 0; i < m_outer.size(); ++i)
+    {
+        const JitLoop::Outer& known = m_compiled_loop->m_outer[i];
+        if (known.m_global != outer.m_global || known.m_depth != outer.m_depth || known.m_slot != outer.m_slot)
+            continue;
+
+        m_written[i] = m_written[i] || write;
+        return m_outer[i];
+    }
+
+    Value value = outer.m_global != nullptr ? *outer.m_global : m_environment->get_at(outer.m_depth, slot);
+    if (!value.is_number() && !value.is_bool())
+        throw Unsupported{"uses a value other than a number or boolean"};
+
+    m_outer.push_back(Local{name.m_lexeme, 0, m_slot_count++, value.is_number() ? TYPE_NUMBER : TYPE_BOOL});
+    m_written.push_back(write);
+    m_compiled_loop->m_outer.push_back(outer);
+    return m_outer.back();
+}
+
+Value JitCompiler::visit_assign(Assign* expr)
+{
+    Local local = lookup(expr->m_name, expr->m_depth, expr->m_slot, true);
+    if (compile(expr->m_value) != local.m_type)
+        throw Unsupported{"changes the type of a variable"};
+
+    if (m_type == TYPE_NUMBER)
+        m_asm.movsd_slot_xmm0(slot_offset(local.m_slot));
+    else
+        m_asm.mov_slot_rax(slot_offset(local.m_slot));
+
+    return Value{};
+}
+
+// Leaves the left operand in xmm0 and the right one in xmm1.
+void JitCompiler::number_operands(Binary* expr)
+{
+    compile_number(expr->m_left);
+    if (load_leaf(expr->m_right, XMM1)) return;
+
+    m_asm.spill_xmm0();
+    compile_number(expr->m_right);
+    m_asm.movapd_xmm1_xmm0();
+    m_asm.unspill_xmm0();
+}
+
+// Loads a number literal or local straight into xmm, which needs no spill.
+bool JitCompiler::load_leaf(Expr* expr, Xmm xmm)
+{
+    if (auto literal = dynamic_cast<Literal*>(expr))
+    {
+        if (!literal->m_value.is_number()) return false;
+
+        m_asm.mov_rax(literal->m_value.bits());
+        m_asm.movq_xmm_rax(xmm);
+        return true;
+    }
+
+    if (auto variable = dynamic_cast<Variable*>(expr))
+    {
+        Local local = lookup(variable->m_name, variable->m_depth, variable->m_slot, false);
+        if (local.m_type != TYPE_NUMBER) return false;
+
+        m_asm.movsd_slot(xmm, slot_offset(local.m_slot));
+        return true;
+    }
+
+    return false;
+}
+
+Value JitCompiler::visit_binary(Binary* expr)
+{
+    TokenType op = expr->m_operator.m_type;
+    if (op == EQUAL_EQUAL || op == BANG_EQUAL)
+    {
+        if (compile(expr->m_left) == TYPE_BOOL)
+        {
+            m_asm.push_rax();
+            compile_bool(expr->m_right);
+            m_asm.pop_rcx();
+            m_asm.cmp_ecx_eax();
+            m_asm.setcc_al(op == EQUAL_EQUAL ? CC_E : CC_NE);
+        }
+        else
+        {
+            if (!load_leaf(expr->m_right, XMM1))
+            {
+                m_asm.spill_xmm0();
+                compile_number(expr->m_right);
+                m_asm.movapd_xmm1_xmm0();
+                m_asm.unspill_xmm0();
+            }
+
+            // Unordered operands, where one is NaN, are never equal.
+            m_asm.ucomisd(XMM0, XMM1);
+            if (op == EQUAL_EQUAL)
+            {
+                m_asm.setcc_al(CC_E);
+                m_asm.setcc_cl(CC_NP);
+                m_asm.and_al_cl();
+            }
+            else
+            {
+                m_asm.setcc_al(CC_NE);
+                m_asm.setcc_cl(CC_P);
+                m_asm.or_al_cl();
+            }
+        }
+
+        m_asm.movzx_eax_al();
+        m_type = TYPE_BOOL;
+        return Value{};
+    }
+
+    number_operands(expr);
+    switch (op)
+    {
+        case PLUS:  m_asm.arithmetic(0x58); break;
+        case MINUS: m_asm.arithmetic(0x5C); break;
+        case STAR:  m_asm.arithmetic(0x59); break;
+        case SLASH: m_asm.arithmetic(0x5E); break;
+        default:
+        {
+            // seta and setae are false on unordered operands, so swapping
+            // them turns > into < without letting NaN compare true.
+            bool less = op == LESS || op == LESS_EQUAL;
+            m_asm.ucomisd(less ? XMM1 : XMM0, less ? XMM0 : XMM1);
+            m_asm.setcc_al(op == GREATER || op == LESS ? CC_A : CC_AE);
+            m_asm.movzx_eax_al();
+            m_type = TYPE_BOOL;
+            return Value{};
+        }
+    }
+
+    m_type = TYPE_NUMBER;
+    return Value{};
+}
+
+// The function a call always reaches: a global declared once with fun and
+// never assigned, as long as it's defined by the time the caller is hot.
+LoxFunction* JitCompiler::callee(Call* expr)
+{
+    const char* unstable = "calls something other than a global function";
+    auto variable = dynamic_cast<Variable*>(expr->m_calee);
+    if (variable == nullptr || variable->m_depth != -1 || resolve(variable->m_name.m_lexeme) != nullptr)
+        throw Unsupported{unstable};
+
+    const Value* value = m_jit.m_globals->find(variable->m_name.m_lexeme);
+    if (value == nullptr || !is_obj_type(*value, OBJ_CALLABLE))
+        throw Unsupported{unstable};
+
+    auto function = dynamic_cast<LoxFunction*>(static_cast<LoxCallable*>(value->as_obj()));
+    if (function == nullptr || !function->declaration->m_stable)
+        throw Unsupported{unstable};
+
+    if (function->arity() != static_cast<int>(expr->m_arguments.size()))
+        throw Unsupported{"calls a function with the wrong number of arguments"};
+
+    return function;
+}
+
+Value JitCompiler::visit_call(Call* expr)
+{
+    JitFunction* target = m_jit.compile(callee(expr)->declaration);
+    if (target->m_code != nullptr && !target->m_enabled)
+        throw Unsupported{"calls a function that can't be compiled"};
+
+    int32_t size = 8 * expr->m_arguments.size();
+    m_asm.sub_rsp(size);
+    for (size_t i = 0; i < expr->m_arguments.size(); ++i)
+    {
+        compile_number(expr->m_arguments[i]);
+        m_asm.movsd_spill_xmm0(8 * i);
+    }
+
+    // The target may still be being compiled, so call through its entry.
+    m_asm.emit({0x48, 0x89, 0xE7});     // mov rdi, rsp
+    m_asm.emit({0x48, 0x89, 0xDE});     // mov rsi, rbx
+    m_asm.mov_rax(reinterpret_cast<uintptr_t>(&target->m_code));
+    m_asm.emit({0xFF, 0x10});           // call [rax]
+    m_asm.add_rsp(size);
+
+    // A callee that bailed returns nil, which fails this guard too.
+    bail_if(m_asm.guard_number());
+    m_asm.movq_xmm_rax(XMM0);
+    m_type = TYPE_NUMBER;
+    return Value{};
+}
+
+Value JitCompiler::visit_grouping(Grouping* expr)
+{
+    compile(expr->m_expression);
+    return Value{};
+}
+
+Value JitCompiler::visit_literal(Literal* expr)
+{
+    if (expr->m_value.is_number())
+    {
+        m_asm.mov_rax(expr->m_value.bits());
+        m_asm.movq_xmm_rax(XMM0);
+        m_type = TYPE_NUMBER;
+    }
+    else if (expr->m_value.is_bool())
+    {
+        m_asm.mov_eax(expr->m_value.as_bool());
+        m_type = TYPE_BOOL;
+    }
+    else
+        throw Unsupported{"uses a value other than a number or boolean"};
+
+    return Value{};
+}
+
+Value JitCompiler::visit_logical(Logical* expr)
+{
+    compile_bool(expr->m_left);
+    m_asm.test_eax_eax();
+    size_t end = m_asm.jcc(expr->m_operator.m_type == OR ? CC_NE : CC_E);
+    compile_bool(expr->m_right);
+    m_asm.patch(end, m_asm.here());
+    return Value{};
+}
+
+Value JitCompiler::visit_unary(Unary* expr)
+{
+    if (expr->m_operator.m_type == BANG)
+    {
+        compile_bool(expr->m_right);
+        m_asm.xor_eax_1();
+        return Value{};
+    }
+
+    compile_number(expr->m_right);
+    m_asm.mov_rax(0x8000000000000000);
+    m_asm.movq_xmm_rax(XMM1);
+    m_asm.xorpd_xmm0_xmm1();
+    return Value{};
+}
+
+Value JitCompiler::visit_variable(Variable* expr)
+{
+    Local local = lookup(expr->m_name, expr->m_depth, expr->m_slot, false);
+    if (local.m_type == TYPE_NUMBER)
+        m_asm.movsd_slot(XMM0, slot_offset(local.m_slot));
+    else
+        m_asm.mov_rax_slot(slot_offset(local.m_slot));
+
+    m_type = local.m_type;
+    return Value{};
+}
+
+void JitCompiler::visit_block(Block* stmt)
+{
+    // Compiled code keeps its locals in its own frame, but a loop finds
+    // outer ones relative to the environment it was entered in.
+    m_environments += !stmt->m_flattened;
+    m_scope_depth++;
+    for (Stmt* statement : stmt->m_statements)
+        compile(statement);
+
+    m_scope_depth--;
+    m_environments -= !stmt->m_flattened;
+    while (!m_locals.empty() && m_locals.back().m_depth > m_scope_depth)
+        m_locals.pop_back();
+}
+
+void JitCompiler::visit_expression(Expression* stmt)
+{
+    compile(stmt->m_expression);
+}
+
+// Numbers are always truthy, so only a boolean can be false.
+void JitCompiler::condition(Expr* expr)
+{
+    if (compile(expr) == TYPE_NUMBER)
+        m_asm.mov_eax(1);
+
+    m_asm.test_eax_eax();
+}
+
+void JitCompiler::visit_if(If* stmt)
+{
+    condition(stmt->m_condition);
+    size_t else_jump = m_asm.jcc(CC_E);
+    compile(stmt->m_thenBranch);
+
+    if (stmt->m_elseBranch != nullptr)
+    {
+        size_t end_jump = m_asm.jmp();
+        m_asm.patch(else_jump, m_asm.here());
+        compile(stmt->m_elseBranch);
+        m_asm.patch(end_jump, m_asm.here());
+    }
+    else
+        m_asm.patch(else_jump, m_asm.here());
+}
+
+// Moves the value just compiled into rax as a Value's bits.
+void JitCompiler::value_to_rax()
+{
+    if (m_type == TYPE_NUMBER)
+    {
+        m_asm.movq_rax_xmm0();
+        return;
+    }
+
+    m_asm.test_eax_eax();
+    m_asm.mov_rdx(Value{true}.bits());
+    m_asm.mov_rax(Value{false}.bits());
+    m_asm.cmovne_rax_rdx();
+}
+
+void JitCompiler::visit_return(Return* stmt)
+{
+    // A call of the function itself in tail position reuses the frame:
+    // the arguments become the parameters, and the body starts over.
+    auto call = dynamic_cast<Call*>(stmt->m_value);
+    if (m_function != nullptr && call != nullptr && callee(call)->declaration == m_function)
+    {
+        int32_t size = 8 * call->m_arguments.size();
+        m_asm.sub_rsp(size);
+        for (size_t i = 0; i < call->m_arguments.size(); ++i)
+        {
+            compile_number(call->m_arguments[i]);
+            m_asm.movsd_spill_xmm0(8 * i);
+        }
+
+        for (size_t i = 0; i < call->m_arguments.size(); ++i)
+        {
+            m_asm.mov_rax_spill(8 * i);
+            m_asm.mov_slot_rax(slot_offset(i));
+        }
+
+        m_asm.add_rsp(size);
+        m_asm.patch(m_asm.jmp(), m_body_start);
+        return;
+    }
+
+    if (stmt->m_value == nullptr)
+        m_asm.mov_rax(Value{}.bits());
+    else
+    {
+        compile(stmt->m_value);
+        value_to_rax();
+    }
+
+    if (m_loop != nullptr)
+    {
+        m_asm.mov_slot_rax(slot_offset(m_return_slot));
+        m_asm.emit({0xC7, 0x43, 0x08}); // mov dword [rbx + m_returned], 1
+        m_asm.imm32(1);
+    }
+
+    m_exit_jumps.push_back(m_asm.jmp());
+}
+
+void JitCompiler::visit_var(Var* stmt)
+{
+    if (stmt->m_initializer == nullptr)
+        throw Unsupported{"declares a variable without a value"};
+
+    Type type = compile(stmt->m_initializer);
+    declare(stmt->m_name.m_lexeme, type);
+
+    int32_t offset = slot_offset(m_locals.back().m_slot);
+    if (type == TYPE_NUMBER)
+        m_asm.movsd_slot_xmm0(offset);
+    else
+        m_asm.mov_slot_rax(offset);
+}
+
+void JitCompiler::visit_while(While* stmt)
+{
+    size_t start = m_asm.here();
+    condition(stmt->m_condition);
+    size_t exit_jump = m_asm.jcc(CC_E);
+    compile(stmt->m_body);
+    m_asm.patch(m_asm.jmp(), start);
+    m_asm.patch(exit_jump, m_asm.here());
+}
+
+void* Jit::bail_stub()
+{
+    if (m_bail_stub == nullptr)
+    {
+        Assembler stub;
+        stub.emit({0xC7, 0x46, 0x04});  // mov dword [rsi + m_bailed], 1
+        stub.imm32(1);
+        stub.mov_rax(Value{}.bits());
+        stub.emit({0xC3});              // ret
+        m_bail_stub = install(stub.m_code);
+    }
+
+    return m_bail_stub;
+}
+
+static const char* const NO_MEMORY = "can't get executable memory";
+
+JitFunction* Jit::compile(Function* declaration)
+{
+    auto found = m_functions.find(declaration);
+    if (found != m_functions.end())
+        return &found->second;
+
+    JitFunction& function = m_functions[declaration];
+    void* stub = bail_stub();
+    if (stub == nullptr)
+    {
+        function.m_unsupported = NO_MEMORY;
+        return &function;
+    }
+
+    void* code = nullptr;
+    try
+    {
+        code = install(JitCompiler{*this, declaration}.compile());
+        if (code == nullptr)
+            function.m_unsupported = NO_MEMORY;
+    }
+    catch (const Unsupported& unsupported)
+    {
+        function.m_unsupported = unsupported.m_reason;
+    }
+
+    function.m_enabled = code != nullptr;
+    function.m_code = reinterpret_cast<decltype(function.m_code)>(code != nullptr ? code : stub);
+    if (code != nullptr)
+        m_installed.push_back(declaration);
+
+    return &function;
+}
+
+JitLoop* Jit::compile(While* loop, Environment* environment)
+{
+    auto found = m_loops.find(loop);
+    if (found != m_loops.end())
+        return &found->second;
+
+    JitLoop& compiled = m_loops[loop];
+    if (bail_stub() == nullptr)
+    {
+        compiled.m_unsupported = NO_MEMORY;
+        return &compiled;
+    }
+
+    try
+    {
+        void* code = install(JitCompiler{*this, loop, environment, compiled}.compile());
+        if (code == nullptr)
+            compiled.m_unsupported = NO_MEMORY;
+
+        compiled.m_enabled = code != nullptr;
+        compiled.m_code = reinterpret_cast<decltype(compiled.m_code)>(code);
+    }
+    catch (const Unsupported& unsupported)
+    {
+        compiled.m_unsupported = unsupported.m_reason;
+    }
+
+    return &compiled;
+}
+
+#else
+
+static const char* const UNSUPPORTED_PLATFORM = "needs x86-64 Linux";
+
+JitFunction* Jit::compile(Function* declaration)
+{
+    JitFunction& function = m_functions[declaration];
+    function.m_unsupported = UNSUPPORTED_PLATFORM;
+    return &function;
+}
+
+JitLoop* Jit::compile(While* loop, Environment* environment)
+{
+    JitLoop& compiled = m_loops[loop];
+    compiled.m_unsupported = UNSUPPORTED_PLATFORM;
+    return &compiled;
+}
+
+#endif
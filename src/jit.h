@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "value.h"
+
+class Environment;
+class Function;
+class While;
+
+// Shared by the compiled code run on behalf of one interpreter call or
+// loop.
+struct JitState
+{
+    // Calls that may still nest before the interpreter would report a stack
+    // overflow, or before the native stack runs short.
+    int32_t m_frames_left;
+    // Set by the compiled code that gave up, and left set as the calls
+    // above it give up in turn.
+    int32_t m_bailed = 0;
+    // Set by a loop that ran into a return, whose value it then returns.
+    int32_t m_returned = 0;
+};
+
+// What the JIT made of one function declaration.
+struct JitFunction
+{
+    // Machine code entry: takes the arguments and the JitState, and returns
+    // the result's bits. Set once compilation finishes, and from then on
+    // always callable: a declaration that couldn't be compiled gets a stub
+    // that bails out, so code compiled against it stays valid.
+    uint64_t (*m_code)(const Value* arguments, JitState* state) = nullptr;
+    // Cleared when compilation fails, or once the code has bailed out too
+    // often to be worth entering.
+    bool m_enabled = false;
+    int m_bailouts = 0;
+    // Why compilation failed.
+    const char* m_unsupported = nullptr;
+};
+
+// What the JIT made of one loop, entered at the top of an iteration with
+// the interpreter's variables still in their environments.
+struct JitLoop
+{
+    // A variable declared outside the loop that it uses: a global, whose
+    // value never moves, or a local at a depth and slot relative to the
+    // environment the loop runs in.
+    struct Outer
+    {
+        Value* m_global;
+        int m_depth;
+        int m_slot;
+    };
+
+    // Takes the addresses of m_outer's variables, in that order. Runs
+    // until the condition is false or the body returns, and stores the
+    // variables back after every iteration, so a bailout leaves them as the
+    // last complete iteration did.
+    uint64_t (*m_code)(Value* const* outer, JitState* state) = nullptr;
+    std::vector<Outer> m_outer;
+    bool m_enabled = false;
+    int m_bailouts = 0;
+    const char* m_unsupported = nullptr;
+};
+
+// A baseline compiler from the AST straight to x86-64, one template per
+// node, for the numeric kernels where the interpreter spends its time.
+// Tiering decides what to compile and when.
+//
+// Only code that compiled code can run without the interpreter compiles:
+// numbers and booleans in locals, arithmetic, comparisons, control flow,
+// and calls to global functions that are never reassigned, themselves
+// compiled. None of that has effects outside the locals, so compiled code
+// that meets something it can't handle (an argument or result that isn't
+// a number, a call nested too deep) simply bails out. A function then
+// runs again from the start in the interpreter, and a loop carries on
+// from its last complete iteration.
+//
+// Only x86-64 Linux is supported. Elsewhere nothing compiles.
+class Jit
+{
+public:
+    // Compiled frames are small, but they share the native stack with the
+    // interpreter that entered them.
+    static constexpr int MAX_FRAMES = 10000;
+
+    explicit Jit(Environment* globals) : m_globals{globals} { }
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Compiles declaration and the functions it calls, or returns what an
+    // earlier attempt made of it. An entry with no code yet is one still
+    // being compiled further up a chain of calls.
+    JitFunction* compile(Function* declaration);
+    // Compiles a loop about to run in environment, whose locals' current
+    // types the code then expects.
+    JitLoop* compile(While* loop, Environment* environment);
+
+    // The functions compiled since the last call, callees included.
+    std::vector<Function*> take_installed() { return std::move(m_installed); }
+
+private:
+    struct Region
+    {
+        void* m_address;
+        size_t m_size;
+    };
+
+    Environment* m_globals;
+    // Node-based, so entries never move while code points at them.
+    std::unordered_map<Function*, JitFunction> m_functions;
+    std::unordered_map<While*, JitLoop> m_loops;
+    std::vector<Function*> m_installed;
+    std::vector<Region> m_regions;
+    void* m_bail_stub = nullptr;
+
+    friend class JitCompiler;
+
+    // Copies code into a fresh executable page, or returns null.
+    void* install(const std::vector<uint8_t>& code);
+    void* bail_stub();
+};
@@ -1,9 +1,20 @@
 #include "lex.h"
-#include <cctype>
+#include "memory.h"
+#include <array>
+#include <charconv>
 
 void error(Token token, std::string message);
 
-std::map<std::string, TokenType> Lexer::keywords =
+// Keywords are looked up in a perfect hash built at compile time. The hash
+// mixes the first and last characters with the length, which happens to
+// give every keyword its own slot in a 32-entry table.
+struct Keyword
+{
+    std::string_view m_text;
+    TokenType m_type;
+};
+
+static constexpr Keyword KEYWORD_LIST[] =
 {
     {"and",     AND},
     {"class",   CLASS},
@@ -23,15 +34,93 @@ std::map<std::string, TokenType> Lexer::keywords =
     {"while",   WHILE},
 };
 
-const std::vector<Token>& Lexer::scan_tokens()
+static constexpr size_t KEYWORD_TABLE_SIZE = 32;
+static constexpr size_t KEYWORD_MAX_LENGTH = 6;
+
+static constexpr size_t keyword_hash(std::string_view text)
+{
+    return (static_cast<unsigned char>(text.front()) +
+            static_cast<unsigned char>(text.back()) * 5 + text.size()) % KEYWORD_TABLE_SIZE;
+}
+
+static constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> make_keyword_table()
+{
+    std::array<Keyword, KEYWORD_TABLE_SIZE> table{};
+    for (const Keyword& keyword : KEYWORD_LIST)
+        table[keyword_hash(keyword.m_text)] = keyword;
+
+    return table;
+}
+
+static constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> KEYWORDS = make_keyword_table();
+
+static constexpr bool keywords_are_perfect()
+{
+    for (const Keyword& keyword : KEYWORD_LIST)
+        if (KEYWORDS[keyword_hash(keyword.m_text)].m_text != keyword.m_text ||
+            keyword.m_text.size() > KEYWORD_MAX_LENGTH)
+            return false;
+
+    return true;
+}
+
+static_assert(keywords_are_perfect(), "keyword_hash must give every keyword its own slot");
+
+static TokenType keyword_type(std::string_view text)
+{
+    if (text.size() > KEYWORD_MAX_LENGTH)
+        return IDENTIFIER;
+
+    const Keyword& keyword = KEYWORDS[keyword_hash(text)];
+    return keyword.m_text == text ? keyword.m_type : IDENTIFIER;
+}
+
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+Value Token::literal() const
+{
+    switch (m_type)
+    {
+        case NUMBER:
+        {
+            double number = 0;
+            std::from_chars(m_lexeme.data(), m_lexeme.data() + m_lexeme.size(), number);
+            return number;
+        }
+        case STRING:
+            return heap().intern(m_lexeme.substr(1, m_lexeme.size() - 2));
+        case TRUE:
+            return true;
+        case FALSE:
+            return false;
+        default:
+            return nullptr;
+    }
+}
+
+Token Lexer::next_token()
 {
     while (!is_at_end()) {
       this->m_start = this->m_current;
+      this->m_has_token = false;
       scan_token();
+
+      if (this->m_has_token)
+        return this->m_token;
     }
 
-    this->m_tokens.emplace_back(END, "", "", this->m_line);
-    return this->m_tokens;
+    return Token{END, "", this->m_line};
+}
+
+std::vector<Token> Lexer::scan_tokens()
+{
+    std::vector<Token> tokens;
+    do
+      tokens.push_back(next_token());
+    while (tokens.back().m_type != END);
+
+    return tokens;
 }
 
 void Lexer::scan_token()
@@ -62,55 +151,52 @@ void Lexer::scan_token()
           break;  
         case '/':
             if (this->match('/'))
-              while (this->peek() != '\n' && !this->is_at_end()) 
-                  this->advance();
+              this->seek(this->m_kernels.find_newline(this->cursor(), this->source_end()));
             else
               this->add_token(SLASH);
           break;
         case ' ':
         case '\r':
         case '\t':
-          break;
         case '\n':
-          this->m_line++;
+          this->seek(this->m_kernels.skip_whitespace(this->cursor() - 1, this->source_end(), &this->m_line));
           break;
         case '"': this->string(); break;
-        case 'o':
-            if (match('r'))
-              add_token(OR);
-  break;
         default:
-            if (isdigit(c))
+            if (is_digit(c))
                 number();
-            else if (isalpha(c))
+            else if (is_alpha(c))
                 identifier();
             else
-                error(this->m_tokens[m_current], "Unexpected character.");
+                this->error("Unexpected character.");
         break;
     }
 }
 
 char Lexer::advance()
 { 
-    return this->m_source.at(this->m_current++);
+    return this->m_source[this->m_current++];
 }
 
 void Lexer::add_token(TokenType type) 
 { 
-    this->add_token(type, ""); 
+    std::string_view text = this->m_source.substr(this->m_start, this->m_current - this->m_start);
+
+    this->m_token = Token{type, text, this->m_line};
+    this->m_has_token = true;
 }
 
-void Lexer::add_token(TokenType type, std::any literal)
+void Lexer::error(const std::string& message)
 {
-    std::string text = this->m_source.substr(this->m_start, this->m_current - this->m_start);
+    std::string_view text = this->m_source.substr(this->m_start, this->m_current - this->m_start);
 
-    this->m_tokens.emplace_back(type, text, literal, this->m_line);
+    ::error(Token{ERROR, text, this->m_line}, message);
 }
 
 bool Lexer::match(char expected)
 {
     if (is_at_end()) return false;
-    if (this->m_source.at(this->m_current) != expected) return false;
+    if (this->m_source[this->m_current] != expected) return false;
 
     this->m_current++;
     return true;
@@ -119,64 +205,49 @@ bool Lexer::match(char expected)
 char Lexer::peek() 
 {
     if (this->is_at_end()) return '\0';
-    return this->m_source.at(this->m_current);
+    return this->m_source[this->m_current];
 }
 
 void Lexer::string()
 {
-    while (this->peek() != '"' && !this->is_at_end()) {
-      if (this->peek() == '\n') 
-        this->m_line++;
-      
-      this->advance();
-    }
+    this->seek(this->m_kernels.find_quote(this->cursor(), this->source_end(), &this->m_line));
 
     if (this->is_at_end()) {
-      error(this->m_tokens[m_current], "unterminated string.");
+      this->error("unterminated string.");
       return;
     }
 
     this->advance();
 
-    std::string value = this->m_source.substr(this->m_start + 1, this->m_current - this->m_start -2);
-    this->add_token(STRING, value);
+    this->add_token(STRING);
 }
 
 void Lexer::number() 
 {
-    while (isdigit(this->peek())) 
-        this->advance();
+    this->seek(this->m_kernels.skip_digits(this->cursor(), this->source_end()));
 
-    if (this->peek() == '.' && isdigit(this->peek_next())) {
+    if (this->peek() == '.' && is_digit(this->peek_next())) {
       this->advance();
 
-      while(isdigit(peek())) 
-        this->advance();
+      this->seek(this->m_kernels.skip_digits(this->cursor(), this->source_end()));
     }
 
-    add_token(NUMBER, stod(m_source.substr(this->m_start, this->m_current - this->m_start)));
+    add_token(NUMBER);
 }
 
 char Lexer::peek_next()
 {
-    if (this->m_current + 1 >= this->m_source.length()) 
+    if (this->cursor() + 1 >= this->source_end()) 
         return '\0';
 
-    return this->m_source.at(this->m_current + 1);
+    return this->m_source[this->m_current + 1];
 } 
 
 void Lexer::identifier()
 {
-    while (isalnum(this->peek())) 
-        this->advance();
-
-    std::string text = this->m_source.substr(this->m_start, this->m_current - this->m_start);
+    this->seek(this->m_kernels.skip_alnum(this->cursor(), this->source_end()));
 
-    TokenType type;
-    if(Lexer::keywords.find(text) == Lexer::keywords.end())
-        type = IDENTIFIER;
-    else
-        type = Lexer::keywords[text];
+    std::string_view text = this->m_source.substr(this->m_start, this->m_current - this->m_start);
 
-    add_token(type);
+    add_token(keyword_type(text));
 }
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
-#include <any>
-#include <map>
+
+#include "value.h"
+#include "scan_kernels.h"
 
 enum TokenType {
   // Single-character tokens.
@@ -24,25 +26,34 @@ enum TokenType {
   AND, CLASS, ELSE, FALSE, FUN, FOR, IF, NIL, OR,
   PRINT, RETURN, SUPER, THIS, TRUE, VAR, WHILE,
 
+  // Lexical errors.
+  ERROR,
+
   END
 };
 
+// Tokens are views into the source text, so scanning never copies a
+// lexeme. NUMBER and STRING literals are decoded only when the parser asks.
 class Token
 {
 public:
     TokenType m_type;
-    std::string m_lexeme;
-    std::any m_literal;
+    std::string_view m_lexeme;
     int m_line;
     
-    Token(TokenType type, std::string lexeme, std::any literal, int line)
-        : m_type{type}, m_lexeme{lexeme}, m_literal{literal}, m_line{line}
+    Token()
+        : m_type{END}, m_line{0}
+    {}
+    Token(TokenType type, std::string_view lexeme, int line)
+        : m_type{type}, m_lexeme{lexeme}, m_line{line}
     {}
 
     ~Token() = default;
 
     int get_type(){ return m_type; };
-    std::string get_lexeme(){ return m_lexeme; };
+    std::string get_lexeme(){ return std::string{m_lexeme}; };
+
+    Value literal() const;
 
     std::string toString() const {
     std::string literal_text;
@@ -52,10 +63,10 @@ public:
         literal_text = m_lexeme;
         break;
       case (STRING):
-        literal_text = std::any_cast<std::string>(m_literal);
+        literal_text = ::to_string(literal());
         break;
       case (NUMBER):
-        literal_text = std::to_string(std::any_cast<double>(m_literal));
+        literal_text = std::to_string(literal().as_number());
         break;
       case (TRUE):
         literal_text = "true";
@@ -67,39 +78,47 @@ public:
         literal_text = "nil";
     }
 
-    return std::to_string(m_type) + " " + m_lexeme + " " + literal_text;
+    return std::to_string(m_type) + " " + std::string{m_lexeme} + " " + literal_text;
   }
 };
 
+// Produces tokens one at a time as the parser asks for them. Only the token
+// being scanned is held here, so lexing takes the same memory however long
+// the script is.
 class Lexer
 {
 private:
-    std::string m_source;
-    std::vector<Token> m_tokens;
+    std::string_view m_source;
+    Token m_token;
+    bool m_has_token = false;
     int m_start = 0;
     int m_current = 0;
     int m_line = 1;
+    const ScanKernels& m_kernels = scan_kernels();
 
-    bool is_at_end() { return m_current >= m_source.length(); };
+    bool is_at_end() { return cursor() >= source_end(); };
+    const char* cursor() { return m_source.data() + m_current; };
+    const char* source_end() { return m_source.data() + m_source.length(); };
+    void seek(const char* position) { m_current = position - m_source.data(); };
     char advance();
     void add_token(TokenType type);
-    void add_token(TokenType type, std::any literal);
     void scan_token();
     bool match(char expected);
     char peek();
     char peek_next();
+    void error(const std::string& message);
 
     void string();
     void number();
     void identifier();
 
-    static std::map<std::string, TokenType> keywords;
-
 public:
-    Lexer(std::string source)
+    Lexer(std::string_view source)
         : m_source{source}
     { }
     ~Lexer() = default;
 
-    const std::vector<Token>& scan_tokens();
+    // Returns END once the source is exhausted, and keeps returning it.
+    Token next_token();
+    std::vector<Token> scan_tokens();
 };
\ No newline at end of file
@@ -1,16 +1,21 @@
 #pragma once
 
-#include <any>
 #include <string>
 #include <vector>
 
+#include "object.h"
+#include "value.h"
+
 class Interpreter;
 
-class LoxCallable {
+class LoxCallable : public Obj {
 public:
+  LoxCallable() : Obj{OBJ_CALLABLE} {}
+
   virtual int arity() = 0;
-  virtual std::any call(Interpreter& interpreter,
-                        std::vector<std::any> arguments) = 0;
+  // The caller has checked there are exactly arity() arguments. They sit
+  // on top of the interpreter's value stack.
+  virtual Value call(Interpreter& interpreter, Value* arguments) = 0;
   virtual std::string to_string() = 0;
   virtual ~LoxCallable() = default;
 };
\ No newline at end of file
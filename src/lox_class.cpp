@@ -0,0 +1,50 @@
+#include "lox_class.h"
+#include "lox_instance.h"
+#include "interpreter.h"
+#include "memory.h"
+
+LoxClass::LoxClass(std::string_view name, LoxClass* superclass,
+                   std::unordered_map<ObjString*, LoxFunction*> methods)
+  : name{name}, superclass{superclass}, methods{std::move(methods)}
+{}
+
+LoxFunction* LoxClass::find_method(ObjString* name) {
+  for (LoxClass* klass = this; klass != nullptr; klass = klass->superclass) {
+    auto method = klass->methods.find(name);
+    if (method != klass->methods.end())
+      return method->second;
+  }
+
+  return nullptr;
+}
+
+void LoxClass::trace(Heap& heap) {
+  heap.mark(superclass);
+  for (auto& method : methods) {
+    heap.mark(method.first);
+    heap.mark(method.second);
+  }
+}
+
+std::string LoxClass::to_string() {
+  return std::string{name};
+}
+
+int LoxClass::arity() {
+  LoxFunction* initializer = find_method(heap().intern("init"));
+  if (initializer == nullptr)
+    return 0;
+
+  return initializer->arity();
+}
+
+Value LoxClass::call(Interpreter& interpreter, Value* arguments) {
+  auto instance = heap().allocate<LoxInstance>(this);
+
+  // While init runs, the environment binding 'this' keeps the instance alive.
+  LoxFunction* initializer = find_method(heap().intern("init"));
+  if (initializer != nullptr)
+    initializer->bind(instance)->call(interpreter, arguments);
+
+  return instance;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "lox_callable.h"
+#include "lox_function.h"
+
+class LoxClass : public LoxCallable
+{
+public:
+  const std::string name;
+  LoxClass* const superclass;
+  // Keyed by interned method name.
+  const std::unordered_map<ObjString*, LoxFunction*> methods;
+
+  LoxClass(std::string_view name, LoxClass* superclass,
+           std::unordered_map<ObjString*, LoxFunction*> methods);
+
+  LoxFunction* find_method(ObjString* name);
+
+  void trace(Heap& heap) override;
+  std::string to_string() override;
+  int arity() override;
+  Value call(Interpreter& interpreter, Value* arguments) override;
+};
@@ -1,37 +1,120 @@
 #include "lox_function.h"
+#include <algorithm>
 #include <utility>        
 #include "environment.h"
 #include "interpreter.h"
+#include "lox_instance.h"
 #include "stmt.h"
-#include "lox_return.h"
 
-LoxFunction::LoxFunction(std::shared_ptr<Function> declaration,
-                         std::shared_ptr<Environment> closure)
-  : closure{std::move(closure)}, declaration{std::move(declaration)}
+LoxFunction::LoxFunction(Function* declaration,
+                         Environment* closure, bool is_initializer)
+  : closure{closure}, declaration{declaration}, is_initializer{is_initializer}
 {}
 
+void LoxFunction::trace(Heap& heap) {
+  heap.mark(closure);
+  if (memo != nullptr)
+    memo->mark(heap);
+}
+
 std::string LoxFunction::to_string() {
-  return "<fn " + declaration->m_name.m_lexeme + ">";
+  return "<fn " + std::string{declaration->m_name.m_lexeme} + ">";
+}
+
+LoxFunction* LoxFunction::bind(LoxInstance* instance) {
+  auto environment = heap().allocate<Environment>(closure, 1);
+  environment->define(0, instance);
+  return heap().allocate<LoxFunction>(declaration, environment, is_initializer);
 }
 
 int LoxFunction::arity() {
   return declaration->m_params.size();
 }
 
-std::any LoxFunction::call(Interpreter& interpreter,
-                           std::vector<std::any> arguments) 
+Value LoxFunction::call(Interpreter& interpreter, Value* arguments) 
 {
-  auto environment = std::make_shared<Environment>(closure);
-  for (int i = 0; i < declaration->m_params.size(); ++i) {
-    environment->define(declaration->m_params[i].m_lexeme,
-        arguments[i]);
+  // Only plain functions are ever pure, and their caller roots them.
+  bool memoized = declaration->m_pure && interpreter.m_memoize;
+  MemoTable::Key key;
+  if (memoized) {
+    if (memo == nullptr)
+      memo = std::make_unique<MemoTable>();
+
+    key.assign(arguments, arguments + declaration->m_params.size());
+    if (const Value* cached = memo->find(key)) {
+      interpreter.m_memo_stats.m_hits++;
+      return *cached;
+    }
+
+    interpreter.m_memo_stats.m_misses++;
+  }
+
+  // Tail calls loop here instead of nesting. Each one's callee and
+  // arguments move down over the frame that just returned, so a chain of
+  // them runs in constant native and Lox stack space. Only the call made
+  // by the caller is memoized; later calls in the chain neither look up
+  // nor store results.
+  //
+  // A bound initializer isn't rooted by anyone while it runs, and neither
+  // is a function once a tail call has replaced it. So nothing below may
+  // touch a function object once its body has started.
+  LoxFunction* function = this;
+  Value* slots = arguments;
+  Value value;
+  for (;;) {
+    Function* declaration = function->declaration;
+    bool is_initializer = function->is_initializer;
+
+    // The depth already counts this call, so nested calls may add up to the
+    // difference before one would overflow.
+    int frames_left = interpreter.m_max_depth - interpreter.m_call_depth + 1;
+    if (interpreter.m_tiering.call(function, slots, frames_left, value))
+      break;
+
+    Environment* environment;
+    if (declaration->m_captures) {
+      environment = heap().allocate<Environment>(function->closure, declaration->m_slot_count);
+      for (size_t i = 0; i < declaration->m_params.size(); ++i) {
+        environment->define(i, slots[i]);
+      }
+    } else {
+      environment = interpreter.push_frame(function->closure, slots, declaration->m_slot_count);
+      if (environment == nullptr)
+        throw RuntimeError(declaration->m_name, "Stack overflow.");
+    }
+
+    interpreter.execute_block(declaration->body(), environment);
+
+    LoxReturn& result = interpreter.m_return;
+    value = result.active ? result.value : nullptr;
+    result.active = false;
+
+    if (is_initializer)
+      value = environment->get_at(1, 0);
+
+    if (!declaration->m_captures)
+      interpreter.pop_frame();
+
+    if (result.tail_call == nullptr)
+      break;
+
+    // The caller's callee stays at arguments[-1], which keeps this rooted
+    // for the memo table. The new callee takes arguments[0].
+    function = result.tail_call;
+    result.tail_call = nullptr;
+
+    Value* callee = result.tail_callee;
+    int count = function->arity();
+    std::copy(callee, callee + 1 + count, arguments);
+    slots = arguments + 1;
+    interpreter.m_stack_top = slots + count;
   }
 
-  try {
-    interpreter.execute_block(declaration->m_body, environment);
-  } catch (LoxReturn returnValue) {
-    return returnValue.value;
+  if (memoized) {
+    if (memo->insert(std::move(key), value))
+      interpreter.m_memo_stats.m_evictions++;
+    heap().write_barrier(this);
   }
 
-  return nullptr;
+  return value;
 }
\ No newline at end of file
@@ -1,24 +1,35 @@
 #pragma once
 
-#include <any>
 #include <memory>
 #include <string>
 #include <vector>
 #include "lox_callable.h"
+#include "memo_table.h"
 
 class Environment;
 class Function;
+class LoxInstance;
 
 class LoxFunction: public LoxCallable 
 {
-  std::shared_ptr<Function> declaration;
-  std::shared_ptr<Environment> closure;
+  friend class StacklessInterpreter;
+  friend class JitCompiler;
+  friend class Tiering;
+  friend class Snapshot;
+
+  Function* declaration;
+  Environment* closure;
+  bool is_initializer;
+  // Created on the first call when memoization is on and Resolver proved
+  // the declaration pure.
+  std::unique_ptr<MemoTable> memo;
 
 public:
-  LoxFunction(std::shared_ptr<Function> declaration,
-              std::shared_ptr<Environment> closure);
+  LoxFunction(Function* declaration,
+              Environment* closure, bool is_initializer = false);
+  void trace(Heap& heap) override;
+  LoxFunction* bind(LoxInstance* instance);
   std::string to_string() override;
   int arity() override;
-  std::any call(Interpreter& interpreter,
-                std::vector<std::any> arguments) override;
+  Value call(Interpreter& interpreter, Value* arguments) override;
 };
\ No newline at end of file
@@ -0,0 +1,13 @@
+#include "lox_instance.h"
+#include "lox_class.h"
+#include "memory.h"
+
+void LoxInstance::trace(Heap& heap) {
+  heap.mark(klass);
+  for (Value field : fields)
+    heap.mark(field);
+}
+
+std::string LoxInstance::to_string() {
+  return std::string{klass->name} + " instance";
+}
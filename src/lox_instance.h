@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "object.h"
+#include "shape.h"
+#include "value.h"
+
+class LoxClass;
+
+// Fields live in a dense array. shape says which name is at which index,
+// so a Get or Set that has seen this shape before indexes straight in.
+class LoxInstance : public Obj
+{
+public:
+  LoxClass* const klass;
+  Shape* shape = Shape::root();
+  std::vector<Value> fields;
+
+  LoxInstance(LoxClass* klass) : Obj{OBJ_INSTANCE}, klass{klass} {}
+
+  void trace(Heap& heap) override;
+  size_t owned_bytes() const override { return fields.capacity() * sizeof(Value); }
+  std::string to_string();
+};
@@ -1,7 +1,20 @@
 #pragma once
 
-#include <any>
+#include "value.h"
 
+class LoxFunction;
+
+// Pending result of a `return` statement. Interpreter::visit_return fills it
+// in and every statement loop stops as soon as it is active, so a return
+// unwinds through ordinary C++ returns instead of an exception.
+//
+// A return whose value is a call to a Lox function instead leaves that
+// function in tail_call, with the callee and its arguments at tail_callee
+// on the interpreter's stack. Nothing runs between the return and
+// LoxFunction::call picking them up, so they need no further rooting.
 struct LoxReturn {
-  const std::any value;
+  bool active = false;
+  Value value;
+  LoxFunction* tail_call = nullptr;
+  Value* tail_callee = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,945 @@
+#pragma once
+
+// The runtime library of programs generated by loxc. It's a single header
+// with no dependencies on the rest of the interpreter, so a generated
+// program builds with nothing else:
+//
+//     c++ -std=c++17 -O2 -I path/to/src program.cpp -o program
+//
+// Values behave as in Interpreter, printing the same way, and runtime
+// errors carry the same messages and lines. Objects are reference counted,
+// which frees most of them as soon as they're dropped. Closures and
+// instances can form cycles, which a backup collector frees by trial
+// deletion, as CPython does: a container whose references all come from
+// other containers, and which no container with an outside reference can
+// reach, is garbage.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace lox {
+
+// As Interpreter::FRAMES_MAX, which is where the tree walker reports a
+// stack overflow.
+constexpr int MAX_DEPTH = 4096;
+
+enum ObjType : uint8_t
+{
+    OBJ_STRING,
+    OBJ_NATIVE,
+    // Containers, which can hold references to other objects.
+    OBJ_ENV,
+    OBJ_CLOSURE,
+    OBJ_CLASS,
+    OBJ_INSTANCE,
+};
+
+class Obj;
+
+class Tracer
+{
+public:
+    virtual void visit(Obj* obj) = 0;
+};
+
+class Obj
+{
+public:
+    const ObjType m_type;
+    size_t m_refs = 0;
+    // The collector's list of containers, and its scratch count.
+    Obj* m_prev = nullptr;
+    Obj* m_next = nullptr;
+    intptr_t m_gc_refs = 0;
+
+    explicit Obj(ObjType type) : m_type{type} { }
+    Obj(const Obj&) = delete;
+    Obj& operator=(const Obj&) = delete;
+    virtual ~Obj() = default;
+
+    bool is_container() const { return m_type >= OBJ_ENV; }
+
+    // Containers visit the objects they refer to, and clear() drops those
+    // references, which breaks the cycles of garbage.
+    virtual void trace(Tracer&) { }
+    virtual void clear() { }
+};
+
+inline void retain(Obj* obj) { obj->m_refs++; }
+void release(Obj* obj);
+
+struct RuntimeError
+{
+    std::string m_message;
+    int m_line;
+};
+
+class Value
+{
+public:
+    enum Tag : uint8_t { TAG_NIL, TAG_BOOL, TAG_NUMBER, TAG_OBJ, TAG_TAIL_CALL };
+
+    Value() : m_tag{TAG_NIL}, m_raw{0} { }
+    Value(std::nullptr_t) : Value{} { }
+    Value(bool boolean) : m_tag{TAG_BOOL}, m_bool{boolean} { }
+    Value(double number) : m_tag{TAG_NUMBER}, m_number{number} { }
+    Value(Obj* obj) : m_tag{TAG_OBJ}, m_obj{obj} { retain(obj); }
+
+    // Catches string literals that would otherwise silently become bools.
+    Value(const char*) = delete;
+
+    Value(const Value& other) : m_tag{other.m_tag}, m_raw{other.m_raw}
+    {
+        if (is_obj()) retain(m_obj);
+    }
+
+    Value(Value&& other) noexcept : m_tag{other.m_tag}, m_raw{other.m_raw}
+    {
+        other.m_tag = TAG_NIL;
+    }
+
+    Value& operator=(Value other) noexcept
+    {
+        std::swap(m_tag, other.m_tag);
+        std::swap(m_raw, other.m_raw);
+        return *this;
+    }
+
+    ~Value()
+    {
+        if (is_obj()) release(m_obj);
+    }
+
+    // What a function returns when it ends in a tail call, which the
+    // caller's run() then makes in its place.
+    static Value tail_call()
+    {
+        Value value;
+        value.m_tag = TAG_TAIL_CALL;
+        return value;
+    }
+
+    bool is_nil() const { return m_tag == TAG_NIL; }
+    bool is_bool() const { return m_tag == TAG_BOOL; }
+    bool is_number() const { return m_tag == TAG_NUMBER; }
+    bool is_obj() const { return m_tag == TAG_OBJ; }
+    bool is_tail_call() const { return m_tag == TAG_TAIL_CALL; }
+    bool is_obj_type(ObjType type) const { return is_obj() && m_obj->m_type == type; }
+
+    bool as_bool() const { return m_bool; }
+    double as_number() const { return m_number; }
+    Obj* as_obj() const { return m_obj; }
+
+    bool is_falsey() const { return m_tag == TAG_NIL || (m_tag == TAG_BOOL && !m_bool); }
+
+private:
+    Tag m_tag;
+    union
+    {
+        bool m_bool;
+        double m_number;
+        Obj* m_obj;
+        // Copies whichever of the others is in use.
+        uint64_t m_raw;
+    };
+};
+
+// An owning pointer to an object of a known type.
+template <class T>
+class Ref
+{
+public:
+    Ref() = default;
+    Ref(std::nullptr_t) { }
+    Ref(T* obj) : m_obj{obj} { if (m_obj != nullptr) retain(m_obj); }
+    Ref(const Ref& other) : Ref{other.m_obj} { }
+    Ref(Ref&& other) noexcept : m_obj{other.m_obj} { other.m_obj = nullptr; }
+
+    Ref& operator=(Ref other) noexcept
+    {
+        std::swap(m_obj, other.m_obj);
+        return *this;
+    }
+
+    ~Ref()
+    {
+        if (m_obj != nullptr) release(m_obj);
+    }
+
+    T* get() const { return m_obj; }
+    T* operator->() const { return m_obj; }
+    explicit operator bool() const { return m_obj != nullptr; }
+
+private:
+    T* m_obj = nullptr;
+};
+
+// Tracks the containers, and frees what the reference counts and the
+// cycle collector find dead. Never destroyed, so objects outliving main()
+// in statics can still be released safely.
+class Collector
+{
+public:
+    static constexpr size_t MIN_THRESHOLD = 10000;
+
+    static Collector& get()
+    {
+        static Collector* collector = new Collector{};
+        return *collector;
+    }
+
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    {
+        if (m_allocated >= m_threshold)
+            collect();
+
+        T* obj = new T(std::forward<Args>(args)...);
+        if (obj->is_container())
+            track(obj);
+
+        return obj;
+    }
+
+    void release(Obj* obj)
+    {
+        if (--obj->m_refs != 0) return;
+
+        // Freeing one object can free the objects it held, so they wait
+        // in a queue rather than recursing down a long list.
+        m_dead.push_back(obj);
+        if (m_freeing) return;
+
+        m_freeing = true;
+        while (!m_dead.empty())
+        {
+            Obj* dead = m_dead.back();
+            m_dead.pop_back();
+            if (dead->is_container())
+                untrack(dead);
+
+            delete dead;
+        }
+        m_freeing = false;
+    }
+
+    void collect();
+
+private:
+    Obj* m_containers = nullptr;
+    size_t m_count = 0;
+    size_t m_allocated = 0;
+    size_t m_threshold = MIN_THRESHOLD;
+    std::vector<Obj*> m_dead;
+    bool m_freeing = false;
+
+    void track(Obj* obj)
+    {
+        obj->m_next = m_containers;
+        if (m_containers != nullptr)
+            m_containers->m_prev = obj;
+
+        m_containers = obj;
+        m_count++;
+        m_allocated++;
+    }
+
+    void untrack(Obj* obj)
+    {
+        if (obj->m_prev != nullptr)
+            obj->m_prev->m_next = obj->m_next;
+        else
+            m_containers = obj->m_next;
+
+        if (obj->m_next != nullptr)
+            obj->m_next->m_prev = obj->m_prev;
+
+        m_count--;
+    }
+};
+
+inline void release(Obj* obj) { Collector::get().release(obj); }
+
+template <class T, class... Args>
+T* make(Args&&... args)
+{
+    return Collector::get().make<T>(std::forward<Args>(args)...);
+}
+
+inline void Collector::collect()
+{
+    constexpr intptr_t REACHABLE = -1;
+
+    // Subtract the references containers hold on each other. Whatever is
+    // left over comes from outside: statics, locals and temporaries.
+    for (Obj* obj = m_containers; obj != nullptr; obj = obj->m_next)
+        obj->m_gc_refs = static_cast<intptr_t>(obj->m_refs);
+
+    struct Subtract : Tracer
+    {
+        void visit(Obj* obj) override
+        {
+            if (obj->is_container()) obj->m_gc_refs--;
+        }
+    } subtract;
+
+    for (Obj* obj = m_containers; obj != nullptr; obj = obj->m_next)
+        obj->trace(subtract);
+
+    struct Mark : Tracer
+    {
+        std::vector<Obj*> m_gray;
+
+        void visit(Obj* obj) override
+        {
+            if (!obj->is_container() || obj->m_gc_refs == REACHABLE) return;
+
+            obj->m_gc_refs = REACHABLE;
+            m_gray.push_back(obj);
+        }
+    } mark;
+
+    for (Obj* obj = m_containers; obj != nullptr; obj = obj->m_next)
+    {
+        if (obj->m_gc_refs > 0)
+            mark.visit(obj);
+    }
+
+    while (!mark.m_gray.empty())
+    {
+        Obj* obj = mark.m_gray.back();
+        mark.m_gray.pop_back();
+        obj->trace(mark);
+    }
+
+    std::vector<Obj*> garbage;
+    for (Obj* obj = m_containers; obj != nullptr; obj = obj->m_next)
+    {
+        if (obj->m_gc_refs != REACHABLE)
+            garbage.push_back(obj);
+    }
+
+    // Holding a reference keeps each one alive until all have let go of
+    // each other.
+    for (Obj* obj : garbage)
+        retain(obj);
+
+    for (Obj* obj : garbage)
+        obj->clear();
+
+    for (Obj* obj : garbage)
+        release(obj);
+
+    m_allocated = 0;
+    m_threshold = std::max(MIN_THRESHOLD, m_count);
+}
+
+class String : public Obj
+{
+public:
+    const std::string m_chars;
+
+    explicit String(std::string chars) : Obj{OBJ_STRING}, m_chars{std::move(chars)} { }
+};
+
+inline Value string(std::string chars)
+{
+    return make<String>(std::move(chars));
+}
+
+class Native : public Obj
+{
+public:
+    const int m_arity;
+    Value (*const m_function)(const Value* arguments);
+
+    Native(int arity, Value (*function)(const Value*)) : Obj{OBJ_NATIVE}, m_arity{arity}, m_function{function} { }
+};
+
+class Env : public Obj
+{
+public:
+    Ref<Env> m_enclosing;
+    std::vector<Value> m_slots;
+
+    Env(Env* enclosing, int slot_count) : Obj{OBJ_ENV}, m_enclosing{enclosing}, m_slots(slot_count) { }
+
+    Env* ancestor(int depth)
+    {
+        Env* environment = this;
+        for (int i = 0; i < depth; ++i)
+            environment = environment->m_enclosing.get();
+
+        return environment;
+    }
+
+    void trace(Tracer& tracer) override
+    {
+        if (m_enclosing) tracer.visit(m_enclosing.get());
+        for (const Value& slot : m_slots)
+            if (slot.is_obj()) tracer.visit(slot.as_obj());
+    }
+
+    void clear() override
+    {
+        m_enclosing = nullptr;
+        m_slots.clear();
+    }
+};
+
+inline Ref<Env> env(Env* enclosing, int slot_count)
+{
+    return make<Env>(enclosing, slot_count);
+}
+
+class Closure;
+
+// A compiled function declaration. The code takes the closure it was
+// called through, and the arguments.
+struct Function
+{
+    const char* m_name;
+    int m_arity;
+    Value (*m_code)(Closure* self, const Value* arguments);
+};
+
+class Closure : public Obj
+{
+public:
+    const Function* const m_function;
+    Ref<Env> m_env;
+    const bool m_is_initializer;
+
+    Closure(const Function* function, Env* env, bool is_initializer)
+        : Obj{OBJ_CLOSURE}, m_function{function}, m_env{env}, m_is_initializer{is_initializer} { }
+
+    void trace(Tracer& tracer) override
+    {
+        if (m_env) tracer.visit(m_env.get());
+    }
+
+    void clear() override { m_env = nullptr; }
+};
+
+inline Value closure(const Function* function, Env* env, bool is_initializer = false)
+{
+    return make<Closure>(function, env, is_initializer);
+}
+
+inline Ref<Closure> method(const Function* function, Env* env, bool is_initializer)
+{
+    return make<Closure>(function, env, is_initializer);
+}
+
+// Property and method names are interned once, at startup, so they
+// compare by address.
+using Name = const std::string*;
+
+inline Name name(const char* text)
+{
+    static auto names = new std::unordered_set<std::string>{};
+    return &*names->insert(text).first;
+}
+
+class Class : public Obj
+{
+public:
+    const std::string m_name;
+    Ref<Class> m_superclass;
+    std::vector<std::pair<Name, Ref<Closure>>> m_methods;
+
+    Class(std::string name, Class* superclass, std::vector<std::pair<Name, Ref<Closure>>> methods)
+        : Obj{OBJ_CLASS}, m_name{std::move(name)}, m_superclass{superclass}, m_methods{std::move(methods)} { }
+
+    Closure* find_method(Name name)
+    {
+        for (Class* klass = this; klass != nullptr; klass = klass->m_superclass.get())
+            for (auto& method : klass->m_methods)
+                if (method.first == name) return method.second.get();
+
+        return nullptr;
+    }
+
+    void trace(Tracer& tracer) override
+    {
+        if (m_superclass) tracer.visit(m_superclass.get());
+        for (auto& method : m_methods)
+            tracer.visit(method.second.get());
+    }
+
+    void clear() override
+    {
+        m_superclass = nullptr;
+        m_methods.clear();
+    }
+};
+
+class Instance : public Obj
+{
+public:
+    Ref<Class> m_class;
+    std::vector<std::pair<Name, Value>> m_fields;
+
+    explicit Instance(Class* klass) : Obj{OBJ_INSTANCE}, m_class{klass} { }
+
+    Value* find_field(Name name)
+    {
+        for (auto& field : m_fields)
+            if (field.first == name) return &field.second;
+
+        return nullptr;
+    }
+
+    void trace(Tracer& tracer) override
+    {
+        if (m_class) tracer.visit(m_class.get());
+        for (auto& field : m_fields)
+            if (field.second.is_obj()) tracer.visit(field.second.as_obj());
+    }
+
+    void clear() override
+    {
+        m_class = nullptr;
+        m_fields.clear();
+    }
+};
+
+// A global variable. Each one the program names gets a static.
+class Global
+{
+public:
+    explicit Global(const char* name) : m_name{name} { }
+    Global(const char* name, Value value) : m_name{name}, m_value{std::move(value)}, m_defined{true} { }
+
+    const Value& get(int line) const
+    {
+        if (!m_defined) undefined(line);
+        return m_value;
+    }
+
+    Value assign(Value value, int line)
+    {
+        if (!m_defined) undefined(line);
+        m_value = value;
+        return value;
+    }
+
+    void define(Value value)
+    {
+        m_value = std::move(value);
+        m_defined = true;
+    }
+
+private:
+    const char* const m_name;
+    Value m_value;
+    bool m_defined = false;
+
+    [[noreturn]] void undefined(int line) const
+    {
+        throw RuntimeError{"Undefined variable '" + std::string{m_name} + "'.", line};
+    }
+};
+
+// A number literal C++ can't spell, such as infinity from constant folding.
+inline Value number_bits(uint64_t bits)
+{
+    double number;
+    std::memcpy(&number, &bits, sizeof number);
+    return number;
+}
+
+inline std::string format_number(double number)
+{
+    std::string text = std::to_string(number);
+    size_t dotPos = text.find('.');
+    if (dotPos != std::string::npos)
+    {
+        size_t lastNonZeroPos = text.size() - 1;
+        while (text[lastNonZeroPos] == '0' && lastNonZeroPos > dotPos)
+            lastNonZeroPos--;
+
+        if (text[lastNonZeroPos] == '.')
+            text.erase(lastNonZeroPos, std::string::npos);
+        else
+            text.erase(lastNonZeroPos + 1, std::string::npos);
+    }
+
+    return text;
+}
+
+inline std::string to_string(const Value& value)
+{
+    if (value.is_nil()) return "nil";
+    if (value.is_bool()) return value.as_bool() ? "true" : "false";
+    if (value.is_number()) return format_number(value.as_number());
+
+    Obj* obj = value.as_obj();
+    switch (obj->m_type)
+    {
+        case OBJ_STRING:
+            return static_cast<String*>(obj)->m_chars;
+        case OBJ_NATIVE:
+            return "<native fn>";
+        case OBJ_CLOSURE:
+            return "<fn " + std::string{static_cast<Closure*>(obj)->m_function->m_name} + ">";
+        case OBJ_CLASS:
+            return static_cast<Class*>(obj)->m_name;
+        case OBJ_INSTANCE:
+            return static_cast<Instance*>(obj)->m_class->m_name + " instance";
+        case OBJ_ENV:
+            return "environment";
+    }
+
+    return "";
+}
+
+inline void print(const Value& value)
+{
+    std::cout << to_string(value) << "\n";
+}
+
+inline bool truthy(const Value& value) { return !value.is_falsey(); }
+
+// Both operands of a binary operator. Braced initialization evaluates them
+// left to right, as the interpreter does, where function arguments would
+// leave the order to the compiler.
+struct Operands
+{
+    Value m_left;
+    Value m_right;
+
+    bool numbers() const { return m_left.is_number() && m_right.is_number(); }
+    double left() const { return m_left.as_number(); }
+    double right() const { return m_right.as_number(); }
+
+    void check_numbers(int line) const
+    {
+        if (!numbers()) throw RuntimeError{"Operands must be numbers.", line};
+    }
+};
+
+inline bool equal(const Value& a, const Value& b)
+{
+    if (a.is_number() && b.is_number()) return a.as_number() == b.as_number();
+    if (a.is_nil() || b.is_nil()) return a.is_nil() && b.is_nil();
+    if (a.is_bool() && b.is_bool()) return a.as_bool() == b.as_bool();
+    if (!a.is_obj() || !b.is_obj()) return false;
+
+    // The interpreter interns strings, so equal strings are the same one.
+    if (a.is_obj_type(OBJ_STRING) && b.is_obj_type(OBJ_STRING))
+        return static_cast<String*>(a.as_obj())->m_chars == static_cast<String*>(b.as_obj())->m_chars;
+
+    return a.as_obj() == b.as_obj();
+}
+
+inline Value equal(const Operands& operands) { return equal(operands.m_left, operands.m_right); }
+inline Value not_equal(const Operands& operands) { return !equal(operands.m_left, operands.m_right); }
+
+inline Value add(const Operands& operands, int line)
+{
+    if (operands.numbers()) return operands.left() + operands.right();
+
+    if (operands.m_left.is_obj_type(OBJ_STRING) && operands.m_right.is_obj_type(OBJ_STRING))
+        return string(static_cast<String*>(operands.m_left.as_obj())->m_chars
+                      + static_cast<String*>(operands.m_right.as_obj())->m_chars);
+
+    throw RuntimeError{"Operands must be two number or two strings", line};
+}
+
+inline Value subtract(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() - operands.right();
+}
+
+inline Value multiply(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() * operands.right();
+}
+
+inline Value divide(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() / operands.right();
+}
+
+inline Value greater(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() > operands.right();
+}
+
+inline Value greater_equal(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() >= operands.right();
+}
+
+inline Value less(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() < operands.right();
+}
+
+inline Value less_equal(const Operands& operands, int line)
+{
+    operands.check_numbers(line);
+    return operands.left() <= operands.right();
+}
+
+inline Value negate(const Value& right, int line)
+{
+    if (!right.is_number()) throw RuntimeError{"Operand must be a number.", line};
+    return -right.as_number();
+}
+
+inline Value logical_not(const Value& right) { return right.is_falsey(); }
+
+// The right operand comes as a lambda, so it only runs if needed.
+template <class Right>
+Value logical_and(Value left, Right right)
+{
+    if (left.is_falsey()) return left;
+    return right();
+}
+
+template <class Right>
+Value logical_or(Value left, Right right)
+{
+    if (!left.is_falsey()) return left;
+    return right();
+}
+
+inline int g_depth = 0;
+
+struct PendingTailCall
+{
+    Value m_callee;
+    std::vector<Value> m_arguments;
+};
+
+inline PendingTailCall g_tail_call;
+
+inline Closure* bind(Closure* method, const Value& instance)
+{
+    Ref<Env> environment = env(method->m_env.get(), 1);
+    environment->m_slots[0] = instance;
+    return make<Closure>(method->m_function, environment.get(), method->m_is_initializer);
+}
+
+inline Name init_name()
+{
+    static Name init = name("init");
+    return init;
+}
+
+// Runs a closure and the chain of tail calls it ends in, which take its
+// place instead of nesting, as in LoxFunction::call.
+inline Value run(Closure* function, const Value* arguments)
+{
+    Ref<Closure> current{function};
+    std::vector<Value> held;
+    for (;;)
+    {
+        Value value = current->m_function->m_code(current.get(), arguments);
+        if (value.is_tail_call())
+        {
+            current = static_cast<Closure*>(g_tail_call.m_callee.as_obj());
+            g_tail_call.m_callee = nullptr;
+            held = std::move(g_tail_call.m_arguments);
+            g_tail_call.m_arguments.clear();
+            arguments = held.data();
+            continue;
+        }
+
+        if (current->m_is_initializer)
+            return current->m_env->m_slots[0];
+
+        return value;
+    }
+}
+
+inline int arity(Obj* callable)
+{
+    switch (callable->m_type)
+    {
+        case OBJ_CLOSURE:
+            return static_cast<Closure*>(callable)->m_function->m_arity;
+        case OBJ_NATIVE:
+            return static_cast<Native*>(callable)->m_arity;
+        case OBJ_CLASS:
+        {
+            Closure* initializer = static_cast<Class*>(callable)->find_method(init_name());
+            return initializer != nullptr ? initializer->m_function->m_arity : 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+// Checks that values holds a callee and the right number of arguments for
+// it, as Interpreter::check_call does.
+inline Obj* check_call(std::initializer_list<Value> values, int line)
+{
+    const Value& callee = *values.begin();
+    int count = static_cast<int>(values.size()) - 1;
+    if (!callee.is_obj() || arity(callee.as_obj()) < 0)
+        throw RuntimeError{"Can only call functions and classes.", line};
+
+    int expected = arity(callee.as_obj());
+    if (count != expected)
+    {
+        throw RuntimeError{"Expected " + std::to_string(expected) + " arguments but got "
+                           + std::to_string(count) + ".", line};
+    }
+
+    return callee.as_obj();
+}
+
+inline Value finish_call(Obj* callable, const Value* arguments, int line)
+{
+    if (g_depth >= MAX_DEPTH)
+        throw RuntimeError{"Stack overflow.", line};
+
+    g_depth++;
+    Value result;
+    switch (callable->m_type)
+    {
+        case OBJ_CLOSURE:
+            result = run(static_cast<Closure*>(callable), arguments);
+            break;
+        case OBJ_NATIVE:
+            result = static_cast<Native*>(callable)->m_function(arguments);
+            break;
+        default:
+        {
+            auto klass = static_cast<Class*>(callable);
+            Value instance = make<Instance>(klass);
+            if (Closure* initializer = klass->find_method(init_name()))
+                run(Ref<Closure>{bind(initializer, instance)}.get(), arguments);
+
+            result = instance;
+            break;
+        }
+    }
+    g_depth--;
+    return result;
+}
+
+// Calls the first of values with the rest as arguments.
+inline Value call(int line, std::initializer_list<Value> values)
+{
+    Obj* callable = check_call(values, line);
+    return finish_call(callable, values.begin() + 1, line);
+}
+
+// A call whose result the calling function returns as is. A closure runs
+// in place of the caller, so chains of them take constant stack space.
+inline Value tail_call(int line, std::initializer_list<Value> values)
+{
+    Obj* callable = check_call(values, line);
+    if (callable->m_type != OBJ_CLOSURE)
+        return finish_call(callable, values.begin() + 1, line);
+
+    g_tail_call.m_callee = *values.begin();
+    g_tail_call.m_arguments.assign(values.begin() + 1, values.end());
+    return Value::tail_call();
+}
+
+inline Value get(const Value& object, Name name, int line)
+{
+    if (!object.is_obj_type(OBJ_INSTANCE))
+        throw RuntimeError{"Only instances have properties.", line};
+
+    auto instance = static_cast<Instance*>(object.as_obj());
+    if (Value* field = instance->find_field(name))
+        return *field;
+
+    if (Closure* method = instance->m_class->find_method(name))
+        return bind(method, object);
+
+    throw RuntimeError{"Undefined property '" + *name + "'.", line};
+}
+
+// The object of a Set, checked before the value is evaluated.
+inline const Value& fields(const Value& object, int line)
+{
+    if (!object.is_obj_type(OBJ_INSTANCE))
+        throw RuntimeError{"Only instances have fields.", line};
+
+    return object;
+}
+
+inline Value set(const Operands& operands, Name name)
+{
+    auto instance = static_cast<Instance*>(operands.m_left.as_obj());
+    if (Value* field = instance->find_field(name))
+        *field = operands.m_right;
+    else
+        instance->m_fields.emplace_back(name, operands.m_right);
+
+    return operands.m_right;
+}
+
+inline Value super_method(const Value& superclass, const Value& object, Name name, int line)
+{
+    Closure* method = static_cast<Class*>(superclass.as_obj())->find_method(name);
+    if (method == nullptr)
+        throw RuntimeError{"Undefined property '" + *name + "'.", line};
+
+    return bind(method, object);
+}
+
+inline Ref<Class> superclass(const Value& value, int line)
+{
+    if (!value.is_obj_type(OBJ_CLASS))
+        throw RuntimeError{"Superclass must be a class.", line};
+
+    return static_cast<Class*>(value.as_obj());
+}
+
+inline Value make_class(const char* name, Class* superclass, std::vector<std::pair<Name, Ref<Closure>>> methods)
+{
+    return make<Class>(name, superclass, std::move(methods));
+}
+
+inline Value clock()
+{
+    return make<Native>(0, [](const Value*) -> Value {
+        auto ticks = std::chrono::system_clock::now().time_since_epoch();
+        return std::chrono::duration<double>{ticks}.count();
+    });
+}
+
+// Runs the program's top level and reports a runtime error as lox does,
+// then exits without tearing down the heap.
+inline int run(void (*script)())
+{
+    int status = 0;
+    try
+    {
+        script();
+    }
+    catch (const RuntimeError& error)
+    {
+        std::cout << error.m_message << "\n[line " << error.m_line << "]";
+        status = 1;
+    }
+
+    std::cout << "\n";
+    std::cout.flush();
+    std::_Exit(status);
+}
+
+}
@@ -0,0 +1,126 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lex.h"
+#include "parser.h"
+#include "runtime_error.h"
+#include "resolver.h"
+#include "optimizer.h"
+#include "source_file.h"
+#include "transpiler.h"
+
+// Compiles a script ahead of time to a C++ program, which builds against
+// lox_runtime.h alone:
+//
+//     loxc --output=fib.cpp fib
+//     c++ -std=c++17 -O2 -I src fib.cpp -o fib
+//
+// The front end is lox's, optimizer included, so the program prints and
+// fails just as `lox` would running the same script.
+
+static bool optimize = true;
+static int inline_threshold = Optimizer::DEFAULT_INLINE_THRESHOLD;
+static std::string output;
+
+bool had_error = false;
+
+static void report(int line, std::string where, std::string message)
+{
+    std::cerr << "[line " + std::to_string(line) + "] Error" + where + ": " + message << "\n";
+    had_error = true;
+}
+
+extern void error(Token token, std::string message)
+{
+    if(token.m_type == TokenType::END)
+        report(token.m_line, " at end", message);
+    else
+        report(token.m_line, " at '" + std::string{token.m_lexeme} + "'", message);
+}
+
+// The interpreters come along with the front end, but loxc never runs them.
+extern void runtime_error(RuntimeError error)
+{
+    std::cerr << error.what() << "\n[line " << error.m_token.m_line << "]\n";
+}
+
+static void compile_file(std::string filename)
+{
+    SourceFile file{"../../example/" + filename};
+    if (!file.is_open())
+    {
+        std::cerr << "Could not open file \"" << filename << "\".\n";
+        exit(74);
+    }
+
+    Lexer lexer{file.text()};
+    Parser parser{lexer};
+    std::unique_ptr<Program> program = parser.parse();
+    std::vector<Stmt*>& statements = program->m_statements;
+    if (had_error) exit(65);
+
+    Resolver{}.resolve(statements);
+    if (had_error) exit(65);
+
+    if (optimize)
+        Optimizer{*program, inline_threshold}.optimize(statements);
+
+    std::string code = Transpiler{filename}.transpile(statements);
+    if (output.empty())
+    {
+        std::cout << code;
+        return;
+    }
+
+    std::ofstream out{output, std::ios::binary};
+    out << code;
+    if (!out)
+    {
+        std::cerr << "Could not write file \"" << output << "\".\n";
+        exit(73);
+    }
+}
+
+static void usage()
+{
+    std::cout << "Usage: loxc [--no-optimize] [--inline-threshold=nodes] [--output=file] script\n";
+    exit(64);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filename;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--no-optimize")
+            optimize = false;
+        else if (arg.rfind("--inline-threshold=", 0) == 0)
+        {
+            std::string threshold = arg.substr(19);
+            if (threshold.empty() || threshold.size() > 9 || threshold.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            inline_threshold = std::stoi(threshold);
+        }
+        else if (arg.rfind("--output=", 0) == 0)
+        {
+            output = arg.substr(9);
+            if (output.empty())
+                usage();
+        }
+        else if (arg.rfind("--", 0) == 0 || !filename.empty())
+            usage();
+        else
+            filename = arg;
+    }
+
+    if (filename.empty())
+        usage();
+
+    compile_file(filename);
+    return 0;
+}
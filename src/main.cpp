@@ -1,6 +1,6 @@
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <string_view>
 #include <vector>
 
 #include "lex.h"
@@ -9,30 +9,107 @@
 #include "ast_printer.h"
 #include "parser.h"
 #include "runtime_error.h"
+#include "source_file.h"
 #include "interpreter.h"
+#include "stackless_interpreter.h"
+#include "resolver.h"
+#include "script_cache.h"
+#include "snapshot.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "vm.h"
+
+enum Engine { ENGINE_TREE, ENGINE_STACKLESS, ENGINE_VM };
 
 static Interpreter interpreter{};
+static StacklessInterpreter stackless{};
+static VM vm{};
+static Engine engine = ENGINE_TREE;
+static bool gc_stats = false;
+static bool memo_stats = false;
+static bool optimize = true;
+static bool dump_ast = false;
+// Caching writes <script>.loxc beside the script, so it's only done when
+// asked for, and --no-cache overrides the request.
+static bool use_cache = false;
+static bool no_cache = false;
+static int inline_threshold = Optimizer::DEFAULT_INLINE_THRESHOLD;
+static std::string snapshot_path;
+static std::string save_snapshot_path;
+// Holds the restored functions' code for the rest of the run.
+static std::unique_ptr<Snapshot> snapshot;
 
 bool had_error = false;
 bool had_runtime_error = false;
 
-static void run(std::string source)
+static Environment* globals()
 {
-    Lexer lexer{source};
-    auto tokens = lexer.scan_tokens();
-    Parser parser{tokens};
-    std::vector<std::shared_ptr<Stmt>> statements = parser.parse();
-    if (had_error) return;
+    return engine == ENGINE_STACKLESS ? stackless.m_globals : interpreter.m_globals;
+}
+
+// Runs source, taking its tree from cache when it has one, and otherwise
+// leaving it there for the next run.
+static void run(std::string_view source, ScriptCache* cache)
+{
+    std::unique_ptr<Program> program = cache != nullptr ? cache->load() : nullptr;
+    if (program == nullptr)
+    {
+        Lexer lexer{source};
+        Parser parser{lexer};
+        program = parser.parse();
+        if (had_error) return;
+
+        Resolver resolver;
+        if (snapshot != nullptr)
+            for (std::string_view name : snapshot->assigned_globals())
+                resolver.assume_assigned(name);
+
+        resolver.resolve(program->m_statements);
+        if (had_error) return;
+
+        if (snapshot != nullptr)
+        {
+            auto binds = [&](std::string_view name) { return resolver.binds_global(name); };
+            const std::vector<std::string_view>& defined = snapshot->defined_globals();
+            if (std::any_of(defined.begin(), defined.end(), binds))
+                snapshot->rebound();
+        }
+
+        if (optimize)
+            Optimizer{*program, inline_threshold}.optimize(program->m_statements);
+
+        if (cache != nullptr)
+            cache->store(*program);
+    }
+
+    std::vector<Stmt*>& statements = program->m_statements;
+
+    if (dump_ast)
+    {
+        std::cout << AstPrinter{}.print(statements);
+        return;
+    }
 
     /*std::cout << "\ntokens:\n";
-    for (auto& token : tokens)
+    for (auto& token : Lexer{source}.scan_tokens())
         std::cout << "[" << token.get_type() << "]" << " token: " << token.get_lexeme() << "\n";*/
 
-    /*std::cout << "\nparse:\n";
-    std::cout << AstPrinter{}.print(expression) << "\n";*/
+    if (engine == ENGINE_VM)
+    {
+        ObjFunction* script = Compiler{}.compile(statements);
+        if (script == nullptr) return;
+
+        vm.interpret(script);
+    }
+    else if (engine == ENGINE_STACKLESS)
+        stackless.interpret(statements);
+    else
+        interpreter.interpret(statements);
 
-    interpreter.interpret(statements);
     std::cout << "\n";
+
+    if (!save_snapshot_path.empty() && !had_runtime_error && !Snapshot::save(save_snapshot_path, globals()))
+        exit(73);
 }
 
 static void report(int line, std::string where, std::string message)
@@ -46,7 +123,7 @@ extern void error(Token token, std::string message)
     if(token.m_type == TokenType::END)
         report(token.m_line, " at end", message);
     else
-        report(token.m_line, " at '" + token.m_lexeme + "'", message);
+        report(token.m_line, " at '" + std::string{token.m_lexeme} + "'", message);
 }
 
 extern void runtime_error(RuntimeError error)
@@ -55,22 +132,173 @@ extern void runtime_error(RuntimeError error)
     had_runtime_error = true;
 }
 
+static void print_gc_stats()
+{
+    const HeapStats& stats = heap().stats();
+    std::cerr << "[gc] collections: " << stats.m_collections
+              << ", steps: " << stats.m_steps
+              << ", max pause: " << stats.m_max_pause_ms << " ms\n"
+              << "[gc] heap: " << stats.m_bytes_allocated << " bytes in " << stats.m_objects << " objects"
+              << ", peak: " << stats.m_peak_bytes << " bytes"
+              << ", freed: " << stats.m_objects_freed << " objects\n";
+}
+
+static void print_memo_stats()
+{
+    const MemoStats& stats = engine == ENGINE_STACKLESS ? stackless.m_memo_stats : interpreter.m_memo_stats;
+    std::cerr << "[memo] hits: " << stats.m_hits
+              << ", misses: " << stats.m_misses
+              << ", evictions: " << stats.m_evictions << "\n";
+}
+
 static void run_file(std::string filename)
 {
-    std::ifstream file("../../example/" + filename);
-    std::stringstream strStream;
+    std::string path = "../../example/" + filename;
+    SourceFile file{path};
+    if (!file.is_open())
+    {
+        std::cout << "Could not open file \"" << filename << "\".\n";
+        exit(74);
+    }
+
+    if (!snapshot_path.empty())
+    {
+        snapshot = Snapshot::load(snapshot_path, globals());
+        if (snapshot == nullptr) exit(74);
+    }
+
+    // What Resolver makes of a script run on a snapshot depends on the
+    // snapshot too, so those scripts skip the cache.
+    if (use_cache && !no_cache && snapshot == nullptr)
+    {
+        ScriptCache cache{path + ".loxc", file.text(), optimize ? inline_threshold : -1};
+        run(file.text(), &cache);
+    }
+    else
+        run(file.text(), nullptr);
 
-    strStream << file.rdbuf();
-    run(strStream.str());
+    if (gc_stats)
+        print_gc_stats();
+
+    if (memo_stats)
+        print_memo_stats();
 
     if (had_error) exit(1);
     if (had_runtime_error) exit(1);
 }
 
+static void usage()
+{
+    std::cout << "Usage: lox [--engine=tree|stackless|vm] [--gc-budget=objects] [--gc-stats]\n"
+                 "           [--memoize] [--memo-stats] [--max-depth=calls]\n"
+                 "           [--no-optimize] [--inline-threshold=nodes] [--dump-ast]\n"
+                 "           [--no-jit] [--jit-threshold=calls] [--jit-loop-threshold=iterations]\n"
+                 "           [--tier-log] [--cache] [--no-cache] [--snapshot=file] [--save-snapshot=file]\n"
+                 "           [script]\n";
+    exit(64);
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc >= 2)
-        run_file(argv[1]);
+    std::string filename;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--engine=tree")
+            engine = ENGINE_TREE;
+        else if (arg == "--engine=stackless")
+            engine = ENGINE_STACKLESS;
+        else if (arg == "--engine=vm")
+            engine = ENGINE_VM;
+        else if (arg == "--gc-stats")
+            gc_stats = true;
+        else if (arg == "--memoize")
+            interpreter.m_memoize = stackless.m_memoize = true;
+        else if (arg == "--memo-stats")
+            memo_stats = true;
+        else if (arg == "--no-optimize")
+            optimize = false;
+        else if (arg == "--dump-ast")
+            dump_ast = true;
+        else if (arg == "--cache")
+            use_cache = true;
+        else if (arg == "--no-cache")
+            no_cache = true;
+        else if (arg == "--no-jit")
+            interpreter.m_tiering.m_enabled = stackless.m_tiering.m_enabled = false;
+        else if (arg == "--tier-log")
+            interpreter.m_tiering.m_log = stackless.m_tiering.m_log = true;
+        else if (arg.rfind("--gc-budget=", 0) == 0)
+        {
+            std::string budget = arg.substr(12);
+            if (budget.empty() || budget.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            heap().set_step_budget(std::stoul(budget));
+        }
+        else if (arg.rfind("--inline-threshold=", 0) == 0)
+        {
+            std::string threshold = arg.substr(19);
+            if (threshold.empty() || threshold.size() > 9 || threshold.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            inline_threshold = std::stoi(threshold);
+        }
+        else if (arg.rfind("--jit-threshold=", 0) == 0)
+        {
+            std::string threshold = arg.substr(16);
+            if (threshold.empty() || threshold.size() > 9 || threshold.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            interpreter.m_tiering.m_call_threshold = stackless.m_tiering.m_call_threshold = std::stoi(threshold);
+        }
+        else if (arg.rfind("--jit-loop-threshold=", 0) == 0)
+        {
+            std::string threshold = arg.substr(21);
+            if (threshold.empty() || threshold.size() > 9 || threshold.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            interpreter.m_tiering.m_loop_threshold = stackless.m_tiering.m_loop_threshold = std::stoi(threshold);
+        }
+        else if (arg.rfind("--snapshot=", 0) == 0)
+        {
+            snapshot_path = arg.substr(11);
+            if (snapshot_path.empty())
+                usage();
+        }
+        else if (arg.rfind("--save-snapshot=", 0) == 0)
+        {
+            save_snapshot_path = arg.substr(16);
+            if (save_snapshot_path.empty())
+                usage();
+        }
+        else if (arg.rfind("--max-depth=", 0) == 0)
+        {
+            std::string depth = arg.substr(12);
+            if (depth.empty() || depth.size() > 9 || depth.find_first_not_of("0123456789") != std::string::npos)
+                usage();
+
+            // The tree walker recurses natively and can only lower its limit.
+            stackless.m_max_depth = std::stoi(depth);
+            interpreter.m_max_depth = std::min(stackless.m_max_depth, Interpreter::FRAMES_MAX);
+        }
+        else if (arg.rfind("--", 0) == 0 || !filename.empty())
+            usage();
+        else
+            filename = arg;
+    }
+
+    // Snapshots hold the tree interpreters' objects, which the VM doesn't share.
+    if (engine == ENGINE_VM && (!snapshot_path.empty() || !save_snapshot_path.empty()))
+        usage();
+
+    // A call the optimizer inlined into a snapshot's code would ignore a
+    // later script's redefinition of the callee.
+    if (!save_snapshot_path.empty())
+        inline_threshold = 0;
+
+    if (!filename.empty())
+        run_file(filename);
 
     return 0;
 }
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "memory.h"
+#include "value.h"
+
+struct MemoStats
+{
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_evictions = 0;
+};
+
+// Results of one pure function, keyed by its argument tuple. Arguments
+// compare by bits rather than by Lox equality, so 0 and -0 get separate
+// entries. Strings are interned, so equal strings share bits. Once
+// CAPACITY entries are cached, inserting evicts the least recently used.
+//
+// Keys hold their argument values, so the collector keeps them alive and
+// a freed object's address can't turn into a false hit.
+class MemoTable
+{
+public:
+    static constexpr size_t CAPACITY = 4096;
+
+    using Key = std::vector<Value>;
+
+    const Value* find(const Key& key)
+    {
+        auto entry = m_index.find(key);
+        if (entry == m_index.end()) return nullptr;
+
+        m_entries.splice(m_entries.begin(), m_entries, entry->second);
+        return &entry->second->m_result;
+    }
+
+    // Returns true if an entry was evicted to make room.
+    bool insert(Key key, Value result)
+    {
+        bool evicted = false;
+        if (m_entries.size() == CAPACITY)
+        {
+            m_index.erase(m_entries.back().m_key);
+            m_entries.pop_back();
+            evicted = true;
+        }
+
+        m_entries.push_front(Entry{std::move(key), result});
+        m_index.emplace(m_entries.front().m_key, m_entries.begin());
+        return evicted;
+    }
+
+    void mark(Heap& heap) const
+    {
+        for (const Entry& entry : m_entries)
+        {
+            for (Value argument : entry.m_key)
+                heap.mark(argument);
+
+            heap.mark(entry.m_result);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Key m_key;
+        Value m_result;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            size_t hash = key.size();
+            for (Value argument : key)
+                hash = hash * 31 + std::hash<uint64_t>{}(argument.bits());
+
+            return hash;
+        }
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const Key& a, const Key& b) const
+        {
+            if (a.size() != b.size()) return false;
+
+            for (size_t i = 0; i < a.size(); ++i)
+                if (a[i].bits() != b[i].bits()) return false;
+
+            return true;
+        }
+    };
+
+    // Most recently used first.
+    std::list<Entry> m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEqual> m_index;
+};
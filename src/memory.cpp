@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+
+#include "memory.h"
+
+Heap::~Heap()
+{
+    Obj* object = m_objects;
+    while (object != nullptr)
+    {
+        Obj* next = object->m_next;
+        delete object;
+        object = next;
+    }
+}
+
+ObjString* Heap::intern(std::string_view chars)
+{
+    auto interned = m_strings.find(chars);
+    if (interned != m_strings.end())
+    {
+        // A string found dead by the last mark may be picked up again
+        // before the sweep reaches it.
+        if (m_phase == PHASE_SWEEP)
+            interned->second->m_mark = m_epoch;
+
+        return interned->second;
+    }
+
+    ObjString* string = allocate<ObjString>(std::string{chars});
+    m_strings.emplace(string->m_chars, string);
+    return string;
+}
+
+void Heap::remove_roots(RootSet* roots)
+{
+    m_roots.erase(std::remove(m_roots.begin(), m_roots.end(), roots), m_roots.end());
+}
+
+void Heap::step()
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t budget = m_step_budget == 0 ? SIZE_MAX : m_step_budget;
+
+    if (m_phase == PHASE_IDLE)
+        begin_cycle();
+
+    if (m_phase == PHASE_MARK)
+    {
+        if (trace(budget))
+            finish_mark();
+    }
+    else if (sweep(budget))
+    {
+        m_phase = PHASE_IDLE;
+        m_next_gc = std::max(m_stats.m_bytes_allocated * GROWTH_FACTOR, INITIAL_THRESHOLD);
+        m_stats.m_collections++;
+    }
+
+    std::chrono::duration<double, std::milli> pause = std::chrono::steady_clock::now() - start;
+    m_stats.m_max_pause_ms = std::max(m_stats.m_max_pause_ms, pause.count());
+    m_stats.m_steps++;
+}
+
+void Heap::begin_cycle()
+{
+    if (++m_epoch == 0)
+    {
+        // The epoch wrapped, so stale marks could look current again.
+        for (Obj* object = m_objects; object != nullptr; object = object->m_next)
+            object->m_mark = 0;
+
+        m_epoch = 1;
+    }
+
+    for (RootSet* roots : m_roots)
+        roots->mark_roots(*this);
+
+    m_phase = PHASE_MARK;
+}
+
+bool Heap::trace(size_t budget)
+{
+    while (!m_gray.empty() && budget-- > 0)
+    {
+        Obj* object = m_gray.back();
+        m_gray.pop_back();
+        object->trace(*this);
+    }
+
+    return m_gray.empty();
+}
+
+void Heap::finish_mark()
+{
+    // The engines' stacks and temporaries changed freely while marking ran
+    // in steps, so look at them once more before deciding what is garbage.
+    for (RootSet* roots : m_roots)
+        roots->mark_roots(*this);
+
+    trace(SIZE_MAX);
+
+    m_sweep = &m_objects;
+    m_phase = PHASE_SWEEP;
+}
+
+bool Heap::sweep(size_t budget)
+{
+    while (*m_sweep != nullptr && budget-- > 0)
+    {
+        Obj* object = *m_sweep;
+        if (object->m_mark == m_epoch)
+        {
+            m_sweep = &object->m_next;
+            continue;
+        }
+
+        *m_sweep = object->m_next;
+        free(object);
+    }
+
+    return *m_sweep == nullptr;
+}
+
+void Heap::free(Obj* object)
+{
+    if (object->m_type == OBJ_STRING)
+        m_strings.erase(static_cast<ObjString*>(object)->m_chars);
+
+    m_stats.m_objects--;
+    m_stats.m_objects_freed++;
+    m_stats.m_bytes_allocated -= object->m_size;
+    delete object;
+}
+
+void ObjFunction::trace(Heap& heap)
+{
+    heap.mark(m_name);
+    for (Value constant : m_chunk.m_constants)
+        heap.mark(constant);
+}
+
+void ObjUpvalue::trace(Heap& heap)
+{
+    heap.mark(m_closed);
+}
+
+void ObjClosure::trace(Heap& heap)
+{
+    heap.mark(m_function);
+    for (ObjUpvalue* upvalue : m_upvalues)
+        heap.mark(upvalue);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "object.h"
+
+class Heap;
+
+// Anything outside the heap that holds object references: the execution
+// engines and parsed programs. The collector asks each one to mark what it
+// holds when a cycle starts and again right before sweeping.
+class RootSet
+{
+public:
+    virtual void mark_roots(Heap& heap) = 0;
+
+protected:
+    ~RootSet() = default;
+};
+
+struct HeapStats
+{
+    size_t m_bytes_allocated = 0;
+    size_t m_peak_bytes = 0;
+    size_t m_objects = 0;
+    size_t m_collections = 0;
+    size_t m_objects_freed = 0;
+    size_t m_steps = 0;
+    double m_max_pause_ms = 0;
+};
+
+// Incremental mark-sweep collector. A cycle starts once the heap outgrows
+// m_next_gc and then advances a bounded amount at every safepoint, so no
+// single pause traces or sweeps more than m_step_budget objects (except the
+// final remark of the roots). Objects the mutator changes after the
+// collector has traced them must be passed to write_barrier().
+//
+// Collection only ever happens inside safepoint(). The engines call it
+// where every live value is reachable from their roots, which leaves the
+// lexer, parser and compiler free to allocate without rooting anything.
+class Heap
+{
+private:
+    enum Phase { PHASE_IDLE, PHASE_MARK, PHASE_SWEEP };
+
+    static constexpr size_t INITIAL_THRESHOLD = 1024 * 1024;
+    static constexpr size_t GROWTH_FACTOR = 2;
+    static constexpr size_t DEFAULT_STEP_BUDGET = 1000;
+
+    Obj* m_objects = nullptr;
+    // Weak: strings nothing else references are dropped from the table when swept.
+    std::unordered_map<std::string_view, ObjString*> m_strings;
+    std::vector<RootSet*> m_roots;
+
+    Phase m_phase = PHASE_IDLE;
+    // An object is marked when its m_mark equals the current epoch, so
+    // starting a cycle unmarks everything at once.
+    uint32_t m_epoch = 1;
+    std::vector<Obj*> m_gray;
+    Obj** m_sweep = nullptr;
+
+    size_t m_next_gc = INITIAL_THRESHOLD;
+    size_t m_step_budget = DEFAULT_STEP_BUDGET;
+    HeapStats m_stats;
+
+    void step();
+    void begin_cycle();
+    bool trace(size_t budget);
+    void finish_mark();
+    bool sweep(size_t budget);
+    void free(Obj* object);
+
+public:
+    Heap() = default;
+    Heap(const Heap&) = delete;
+    ~Heap();
+
+    template <class T, class... Args>
+    T* allocate(Args&&... args)
+    {
+        T* object = new T(std::forward<Args>(args)...);
+        object->m_size = sizeof(T) + object->owned_bytes();
+        // Objects born during a sweep already belong to the surviving set.
+        object->m_mark = m_phase == PHASE_SWEEP ? m_epoch : 0;
+        object->m_next = m_objects;
+        m_objects = object;
+
+        m_stats.m_objects++;
+        m_stats.m_bytes_allocated += object->m_size;
+        if (m_stats.m_bytes_allocated > m_stats.m_peak_bytes)
+            m_stats.m_peak_bytes = m_stats.m_bytes_allocated;
+
+        return object;
+    }
+
+    ObjString* intern(std::string_view chars);
+
+    void add_roots(RootSet* roots) { m_roots.push_back(roots); }
+    void remove_roots(RootSet* roots);
+
+    void mark(Obj* object)
+    {
+        if (object == nullptr || object->m_mark == m_epoch) return;
+
+        object->m_mark = m_epoch;
+        m_gray.push_back(object);
+    }
+
+    void mark(Value value)
+    {
+        if (value.is_obj()) mark(value.as_obj());
+    }
+
+    // Call after storing a reference into object. If the collector has
+    // already traced it, it goes back on the gray list to be traced again.
+    void write_barrier(Obj* object)
+    {
+        if (m_phase == PHASE_MARK && object->m_mark == m_epoch)
+            m_gray.push_back(object);
+    }
+
+    void safepoint()
+    {
+        if (m_phase != PHASE_IDLE || m_stats.m_bytes_allocated > m_next_gc)
+            step();
+    }
+
+    // Objects traced or swept per safepoint. Zero makes every cycle run to
+    // completion in one pause.
+    void set_step_budget(size_t budget) { m_step_budget = budget; }
+    const HeapStats& stats() const { return m_stats; }
+};
+
+// Every object lives in one process-wide heap so values can flow freely
+// between the lexer, the compiler and either execution engine.
+inline Heap& heap()
+{
+    static Heap instance;
+    return instance;
+}
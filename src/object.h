@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chunk.h"
+#include "value.h"
+
+enum ObjType { OBJ_STRING, OBJ_FUNCTION, OBJ_NATIVE, OBJ_CLOSURE, OBJ_UPVALUE, OBJ_CALLABLE, OBJ_ENVIRONMENT, OBJ_INSTANCE };
+
+class Heap;
+
+class Obj
+{
+public:
+    const ObjType m_type;
+    // Collector bookkeeping, owned by Heap.
+    uint32_t m_mark = 0;
+    uint32_t m_size = 0;
+    Obj* m_next = nullptr;
+
+    Obj(ObjType type) : m_type{type} { }
+    virtual ~Obj() = default;
+
+    // Marks every object this one references.
+    virtual void trace(Heap&) { }
+    // Memory held outside the object itself, counted towards the heap size.
+    virtual size_t owned_bytes() const { return 0; }
+};
+
+class ObjString : public Obj
+{
+public:
+    const std::string m_chars;
+
+    ObjString(std::string chars)
+        : Obj{OBJ_STRING}, m_chars{std::move(chars)} { }
+
+    size_t owned_bytes() const override { return m_chars.capacity(); }
+};
+
+class ObjFunction : public Obj
+{
+public:
+    int m_arity = 0;
+    int m_upvalue_count = 0;
+    Chunk m_chunk;
+    ObjString* m_name = nullptr;
+
+    ObjFunction() : Obj{OBJ_FUNCTION} { }
+
+    void trace(Heap& heap) override;
+};
+
+using NativeFn = Value (*)(int arg_count, Value* args);
+
+class ObjNative : public Obj
+{
+public:
+    const NativeFn m_function;
+    const int m_arity;
+
+    ObjNative(NativeFn function, int arity)
+        : Obj{OBJ_NATIVE}, m_function{function}, m_arity{arity} { }
+};
+
+class ObjUpvalue : public Obj
+{
+public:
+    Value* m_location;
+    Value m_closed;
+    ObjUpvalue* m_next_upvalue = nullptr;
+
+    ObjUpvalue(Value* slot)
+        : Obj{OBJ_UPVALUE}, m_location{slot} { }
+
+    void trace(Heap& heap) override;
+};
+
+class ObjClosure : public Obj
+{
+public:
+    ObjFunction* const m_function;
+    std::vector<ObjUpvalue*> m_upvalues;
+
+    ObjClosure(ObjFunction* function)
+        : Obj{OBJ_CLOSURE}, m_function{function}, m_upvalues(function->m_upvalue_count, nullptr) { }
+
+    void trace(Heap& heap) override;
+};
+
+inline bool is_obj_type(Value value, ObjType type)
+{ return value.is_obj() && value.as_obj()->m_type == type; }
+
+inline ObjString* as_string(Value value)
+{ return static_cast<ObjString*>(value.as_obj()); }
@@ -0,0 +1,965 @@
+#include <algorithm>
+#include <string>
+
+#include "optimizer.h"
+#include "object.h"
+
+static bool is_literal(Expr* expr)
+{
+    return dynamic_cast<Literal*>(expr) != nullptr;
+}
+
+static Value literal_value(Expr* expr)
+{
+    return static_cast<Literal*>(expr)->m_value;
+}
+
+// The line of the first token in expr, for nodes the optimizer creates.
+static int line_of(Expr* expr)
+{
+    if (auto binary = dynamic_cast<Binary*>(expr)) return line_of(binary->m_left);
+    if (auto logical = dynamic_cast<Logical*>(expr)) return line_of(logical->m_left);
+    if (auto unary = dynamic_cast<Unary*>(expr)) return unary->m_operator.m_line;
+    if (auto variable = dynamic_cast<Variable*>(expr)) return variable->m_name.m_line;
+    return 0;
+}
+
+// Measures a function's returned expression and checks that it can stand
+// in for a call: it may read its parameters but not assign them, and may
+// not refer to the function itself.
+class InlineAnalysis : public VisitorExpr
+{
+public:
+    int m_size = 0;
+    bool m_inlinable = true;
+    bool m_calls = false;
+    std::vector<std::string_view> m_globals;
+
+    InlineAnalysis(Function* function) : m_function{function} { }
+
+    void analyze(Expr* expr)
+    {
+        ++m_size;
+        expr->accept(*this);
+    }
+
+    Value visit_assign(Assign* expr) override
+    {
+        analyze(expr->m_value);
+        global(expr->m_name, expr->m_depth);
+        if (expr->m_depth >= 0) m_inlinable = false;
+        return Value{};
+    }
+
+    Value visit_binary(Binary* expr) override
+    {
+        analyze(expr->m_left);
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_call(Call* expr) override
+    {
+        m_calls = true;
+        analyze(expr->m_calee);
+        for (Expr* argument : expr->m_arguments)
+            analyze(argument);
+        return Value{};
+    }
+
+    Value visit_get(Get* expr) override
+    {
+        analyze(expr->m_object);
+        return Value{};
+    }
+
+    Value visit_grouping(Grouping* expr) override
+    {
+        analyze(expr->m_expression);
+        return Value{};
+    }
+
+    Value visit_literal(Literal*) override { return Value{}; }
+
+    Value visit_logical(Logical* expr) override
+    {
+        analyze(expr->m_left);
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_set(Set* expr) override
+    {
+        analyze(expr->m_object);
+        analyze(expr->m_value);
+        return Value{};
+    }
+
+    Value visit_super(Super*) override
+    {
+        m_inlinable = false;
+        return Value{};
+    }
+
+    Value visit_this(This*) override
+    {
+        m_inlinable = false;
+        return Value{};
+    }
+
+    Value visit_unary(Unary* expr) override
+    {
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_variable(Variable* expr) override
+    {
+        global(expr->m_name, expr->m_depth);
+        // A global function's only scope is its parameters'.
+        if (expr->m_depth > 0) m_inlinable = false;
+        return Value{};
+    }
+
+private:
+    Function* m_function;
+
+    void global(const Token& name, int depth)
+    {
+        if (depth >= 0) return;
+
+        if (name.m_lexeme == m_function->m_name.m_lexeme)
+            m_inlinable = false;
+
+        m_globals.push_back(name.m_lexeme);
+    }
+};
+
+// Copies an inlined body for one call site, with each parameter replaced
+// by that call's argument. Tokens are copied too, so errors still report
+// the lines of the function's source. Leaves are never mutated, so they
+// are shared rather than copied.
+class Substitution : public VisitorExpr
+{
+public:
+    Substitution(Arena& arena, const std::vector<Expr*>& arguments)
+        : m_arena{arena}, m_arguments{arguments} { }
+
+    Expr* copy(Expr* expr)
+    {
+        m_copy = expr;
+        expr->accept(*this);
+        return m_copy;
+    }
+
+    Value visit_assign(Assign* expr) override
+    {
+        Assign* assign = m_arena.make<Assign>(expr->m_name, copy(expr->m_value));
+        assign->m_depth = expr->m_depth;
+        assign->m_slot = expr->m_slot;
+        m_copy = assign;
+        return Value{};
+    }
+
+    Value visit_binary(Binary* expr) override
+    {
+        Expr* left = copy(expr->m_left);
+        m_copy = m_arena.make<Binary>(left, expr->m_operator, copy(expr->m_right));
+        return Value{};
+    }
+
+    Value visit_call(Call* expr) override
+    {
+        Expr* callee = copy(expr->m_calee);
+        std::vector<Expr*> arguments;
+        for (Expr* argument : expr->m_arguments)
+            arguments.push_back(copy(argument));
+
+        m_copy = m_arena.make<Call>(callee, expr->m_paren, arguments);
+        return Value{};
+    }
+
+    Value visit_get(Get* expr) override
+    {
+        m_copy = m_arena.make<Get>(expr->m_name, copy(expr->m_object), expr->m_key);
+        return Value{};
+    }
+
+    Value visit_grouping(Grouping* expr) override
+    {
+        m_copy = copy(expr->m_expression);
+        return Value{};
+    }
+
+    Value visit_literal(Literal*) override { return Value{}; }
+
+    Value visit_logical(Logical* expr) override
+    {
+        Expr* left = copy(expr->m_left);
+        m_copy = m_arena.make<Logical>(left, expr->m_operator, copy(expr->m_right));
+        return Value{};
+    }
+
+    Value visit_set(Set* expr) override
+    {
+        Expr* object = copy(expr->m_object);
+        m_copy = m_arena.make<Set>(expr->m_name, copy(expr->m_value), object, expr->m_key);
+        return Value{};
+    }
+
+    Value visit_super(Super*) override { return Value{}; }
+    Value visit_this(This*) override { return Value{}; }
+
+    Value visit_unary(Unary* expr) override
+    {
+        m_copy = m_arena.make<Unary>(expr->m_operator, copy(expr->m_right));
+        return Value{};
+    }
+
+    Value visit_variable(Variable* expr) override
+    {
+        if (expr->m_depth == 0)
+            m_copy = m_arguments[expr->m_slot];
+        return Value{};
+    }
+
+private:
+    Arena& m_arena;
+    const std::vector<Expr*>& m_arguments;
+    Expr* m_copy = nullptr;
+};
+
+// What a loop's condition and body may change. Only a loop with no calls
+// and no declarations of functions or classes is considered for hoisting:
+// a call could assign any global, or a local through a closure, and a
+// closure needs the block it captures to keep its own environment.
+class LoopEffects : public VisitorExpr, public VisitorStmt
+{
+public:
+    bool m_opaque = false;
+    // Names assigned or declared anywhere in the loop.
+    std::vector<std::string_view> m_written;
+
+    void analyze(Expr* expr) { expr->accept(*this); }
+    void analyze(Stmt* stmt) { stmt->accept(*this); }
+
+    bool writes(std::string_view name) const
+    {
+        return std::find(m_written.begin(), m_written.end(), name) != m_written.end();
+    }
+
+    Value visit_assign(Assign* expr) override
+    {
+        analyze(expr->m_value);
+        m_written.push_back(expr->m_name.m_lexeme);
+        return Value{};
+    }
+
+    Value visit_binary(Binary* expr) override
+    {
+        analyze(expr->m_left);
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_call(Call*) override
+    {
+        m_opaque = true;
+        return Value{};
+    }
+
+    Value visit_get(Get* expr) override
+    {
+        analyze(expr->m_object);
+        return Value{};
+    }
+
+    Value visit_grouping(Grouping* expr) override
+    {
+        analyze(expr->m_expression);
+        return Value{};
+    }
+
+    Value visit_literal(Literal*) override { return Value{}; }
+
+    Value visit_logical(Logical* expr) override
+    {
+        analyze(expr->m_left);
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_set(Set* expr) override
+    {
+        analyze(expr->m_object);
+        analyze(expr->m_value);
+        return Value{};
+    }
+
+    Value visit_super(Super*) override { return Value{}; }
+    Value visit_this(This*) override { return Value{}; }
+
+    Value visit_unary(Unary* expr) override
+    {
+        analyze(expr->m_right);
+        return Value{};
+    }
+
+    Value visit_variable(Variable*) override { return Value{}; }
+
+    void visit_block(Block* stmt) override
+    {
+        if (!stmt->m_flattened) m_opaque = true;
+
+        for (Stmt* statement : stmt->m_statements)
+            analyze(statement);
+    }
+
+    void visit_class(Class*) override { m_opaque = true; }
+
+    void visit_expression(Expression* stmt) override { analyze(stmt->m_expression); }
+
+    void visit_function(Function*) override { m_opaque = true; }
+
+    void visit_if(If* stmt) override
+    {
+        analyze(stmt->m_condition);
+        analyze(stmt->m_thenBranch);
+        if (stmt->m_elseBranch != nullptr)
+            analyze(stmt->m_elseBranch);
+    }
+
+    void visit_print(Print* stmt) override { analyze(stmt->m_expression); }
+
+    void visit_return(Return* stmt) override
+    {
+        if (stmt->m_value != nullptr)
+            analyze(stmt->m_value);
+    }
+
+    void visit_var(Var* stmt) override
+    {
+        if (stmt->m_initializer != nullptr)
+            analyze(stmt->m_initializer);
+
+        m_written.push_back(stmt->m_name.m_lexeme);
+    }
+
+    void visit_while(While* stmt) override
+    {
+        analyze(stmt->m_condition);
+        analyze(stmt->m_body);
+    }
+};
+
+// Finds the invariant expressions of a loop that can be computed before
+// it. Moving an expression must not change what the program prints or
+// which error it stops on, so only the leading part of the condition or
+// body is searched: an expression is taken only if nothing evaluated
+// before it in the iteration could print or fail, and only if it is
+// evaluated unconditionally. Each one found is recorded by the address of
+// the pointer to it, for the caller to replace.
+class InvariantSearch
+{
+public:
+    std::vector<Expr**> m_sites;
+
+    InvariantSearch(const LoopEffects& effects, const std::vector<std::string_view>& defined)
+        : m_effects{effects}, m_defined{defined} { }
+
+    void search(Expr*& expr)
+    {
+        m_clean = true;
+        walk(expr);
+    }
+
+    void search(const std::vector<Stmt*>& statements)
+    {
+        m_clean = true;
+        walk(statements);
+    }
+
+private:
+    const LoopEffects& m_effects;
+    const std::vector<std::string_view>& m_defined;
+    // Nothing evaluated so far could have printed or failed.
+    bool m_clean = true;
+    // Inside the right operand of and/or, which may not run.
+    bool m_conditional = false;
+
+    bool invariant(Expr* expr) const
+    {
+        if (is_literal(expr)) return true;
+
+        if (auto variable = dynamic_cast<Variable*>(expr))
+            return !m_effects.writes(variable->m_name.m_lexeme);
+
+        if (auto unary = dynamic_cast<Unary*>(expr))
+            return invariant(unary->m_right);
+
+        if (auto binary = dynamic_cast<Binary*>(expr))
+            return invariant(binary->m_left) && invariant(binary->m_right);
+
+        if (auto logical = dynamic_cast<Logical*>(expr))
+            return invariant(logical->m_left) && invariant(logical->m_right);
+
+        return false;
+    }
+
+    bool defined(const Token& name) const
+    {
+        return std::find(m_defined.begin(), m_defined.end(), name.m_lexeme) != m_defined.end();
+    }
+
+    // A literal or a local is already as cheap as a temporary would be.
+    static bool worth_hoisting(Expr* expr)
+    {
+        if (auto variable = dynamic_cast<Variable*>(expr))
+            return variable->m_depth < 0;
+
+        return !is_literal(expr);
+    }
+
+    void walk(Expr*& expr)
+    {
+        if (m_clean && !m_conditional && worth_hoisting(expr) && invariant(expr))
+        {
+            // Becomes a read of a local, which can't fail.
+            m_sites.push_back(&expr);
+            return;
+        }
+
+        if (auto assign = dynamic_cast<Assign*>(expr))
+        {
+            walk(assign->m_value);
+            if (assign->m_depth < 0 && !defined(assign->m_name)) m_clean = false;
+        }
+        else if (auto binary = dynamic_cast<Binary*>(expr))
+        {
+            walk(binary->m_left);
+            walk(binary->m_right);
+            m_clean = false;
+        }
+        else if (auto get = dynamic_cast<Get*>(expr))
+        {
+            walk(get->m_object);
+            m_clean = false;
+        }
+        else if (auto logical = dynamic_cast<Logical*>(expr))
+        {
+            walk(logical->m_left);
+
+            bool conditional = m_conditional;
+            m_conditional = true;
+            walk(logical->m_right);
+            m_conditional = conditional;
+        }
+        else if (auto set = dynamic_cast<Set*>(expr))
+        {
+            walk(set->m_object);
+            walk(set->m_value);
+            m_clean = false;
+        }
+        else if (auto unary = dynamic_cast<Unary*>(expr))
+        {
+            walk(unary->m_right);
+            m_clean = false;
+        }
+        else if (auto variable = dynamic_cast<Variable*>(expr))
+        {
+            // An undefined global is an error.
+            if (variable->m_depth < 0 && !defined(variable->m_name)) m_clean = false;
+        }
+        else if (!is_literal(expr))
+            m_clean = false;
+    }
+
+    void walk(const std::vector<Stmt*>& statements)
+    {
+        for (Stmt* statement : statements)
+        {
+            if (!m_clean) return;
+
+            if (auto block = dynamic_cast<Block*>(statement))
+                walk(block->m_statements);
+            else if (auto expression = dynamic_cast<Expression*>(statement))
+                walk(expression->m_expression);
+            else if (auto var = dynamic_cast<Var*>(statement))
+            {
+                if (var->m_initializer != nullptr)
+                    walk(var->m_initializer);
+            }
+            else if (auto print = dynamic_cast<Print*>(statement))
+            {
+                walk(print->m_expression);
+                m_clean = false;
+            }
+            else if (auto branch = dynamic_cast<If*>(statement))
+            {
+                walk(branch->m_condition);
+                m_clean = false;
+            }
+            else
+                m_clean = false;
+        }
+    }
+};
+
+void Optimizer::optimize(std::vector<Stmt*>& statements)
+{
+    size_t kept = 0;
+    for (Stmt* statement : statements)
+    {
+        Stmt* optimized = optimize(statement);
+        if (optimized == nullptr) continue;
+
+        statements[kept++] = optimized;
+
+        // Nothing after a return in the same list can run.
+        if (dynamic_cast<Return*>(optimized)) break;
+    }
+
+    statements.resize(kept);
+}
+
+// A branch or loop body has to be a statement, so one that optimizes away
+// becomes an empty block. It declares nothing, so it needs no environment.
+Stmt* Optimizer::optimize_branch(Stmt* stmt)
+{
+    Stmt* optimized = optimize(stmt);
+    if (optimized != nullptr) return optimized;
+
+    Block* empty = m_program.m_arena.make<Block>(std::vector<Stmt*>{});
+    empty->m_flattened = true;
+    return empty;
+}
+
+Literal* Optimizer::literal(Value value)
+{
+    // A folded string is a new object, so the program has to keep it alive.
+    if (value.is_obj())
+        m_program.m_constants.push_back(value);
+
+    return m_program.m_arena.make<Literal>(value);
+}
+
+Value Optimizer::visit_assign(Assign* expr)
+{
+    expr->m_value = optimize(expr->m_value);
+    m_expr = expr;
+    return Value{};
+}
+
+Value Optimizer::visit_binary(Binary* expr)
+{
+    expr->m_left = optimize(expr->m_left);
+    expr->m_right = optimize(expr->m_right);
+    m_expr = expr;
+
+    if (!is_literal(expr->m_left) || !is_literal(expr->m_right)) return Value{};
+
+    Value left = literal_value(expr->m_left);
+    Value right = literal_value(expr->m_right);
+
+    switch (expr->m_operator.m_type)
+    {
+        case BANG_EQUAL:
+            m_expr = literal(left != right);
+            return Value{};
+        case EQUAL_EQUAL:
+            m_expr = literal(left == right);
+            return Value{};
+        case PLUS:
+            if (is_obj_type(left, OBJ_STRING) && is_obj_type(right, OBJ_STRING))
+            {
+                m_expr = literal(heap().intern(as_string(left)->m_chars + as_string(right)->m_chars));
+                return Value{};
+            }
+            break;
+        default:
+            break;
+    }
+
+    // Everything else takes two numbers, and anything else is a runtime
+    // error the interpreter has to report when the line runs.
+    if (!left.is_number() || !right.is_number()) return Value{};
+
+    double a = left.as_number();
+    double b = right.as_number();
+
+    switch (expr->m_operator.m_type)
+    {
+        case GREATER:       m_expr = literal(a > b); break;
+        case GREATER_EQUAL: m_expr = literal(a >= b); break;
+        case LESS:          m_expr = literal(a < b); break;
+        case LESS_EQUAL:    m_expr = literal(a <= b); break;
+        case MINUS:         m_expr = literal(a - b); break;
+        case PLUS:          m_expr = literal(a + b); break;
+        case SLASH:         m_expr = literal(a / b); break;
+        case STAR:          m_expr = literal(a * b); break;
+        default:            break;
+    }
+
+    return Value{};
+}
+
+Value Optimizer::visit_call(Call* expr)
+{
+    expr->m_calee = optimize(expr->m_calee);
+
+    for (Expr*& argument : expr->m_arguments)
+        argument = optimize(argument);
+
+    m_expr = inline_call(expr);
+    return Value{};
+}
+
+Value Optimizer::visit_get(Get* expr)
+{
+    expr->m_object = optimize(expr->m_object);
+    m_expr = expr;
+    return Value{};
+}
+
+Value Optimizer::visit_grouping(Grouping* expr)
+{
+    m_expr = optimize(expr->m_expression);
+    return Value{};
+}
+
+Value Optimizer::visit_literal(Literal* expr)
+{
+    m_expr = expr;
+    return Value{};
+}
+
+// A literal left operand decides which operand the expression yields.
+Value Optimizer::visit_logical(Logical* expr)
+{
+    expr->m_left = optimize(expr->m_left);
+    expr->m_right = optimize(expr->m_right);
+    m_expr = expr;
+
+    if (!is_literal(expr->m_left)) return Value{};
+
+    bool truthy = !literal_value(expr->m_left).is_falsey();
+    bool yields_left = expr->m_operator.m_type == TokenType::OR ? truthy : !truthy;
+    m_expr = yields_left ? expr->m_left : expr->m_right;
+    return Value{};
+}
+
+Value Optimizer::visit_set(Set* expr)
+{
+    expr->m_object = optimize(expr->m_object);
+    expr->m_value = optimize(expr->m_value);
+    m_expr = expr;
+    return Value{};
+}
+
+Value Optimizer::visit_super(Super* expr)
+{
+    m_expr = expr;
+    return Value{};
+}
+
+Value Optimizer::visit_this(This* expr)
+{
+    m_expr = expr;
+    return Value{};
+}
+
+Value Optimizer::visit_unary(Unary* expr)
+{
+    expr->m_right = optimize(expr->m_right);
+    m_expr = expr;
+
+    if (!is_literal(expr->m_right)) return Value{};
+
+    Value right = literal_value(expr->m_right);
+    switch (expr->m_operator.m_type)
+    {
+        case BANG:
+            m_expr = literal(right.is_falsey());
+            break;
+        case MINUS:
+            if (right.is_number())
+                m_expr = literal(-right.as_number());
+            break;
+        default:
+            break;
+    }
+
+    return Value{};
+}
+
+Value Optimizer::visit_variable(Variable* expr)
+{
+    m_expr = expr;
+    return Value{};
+}
+
+void Optimizer::visit_block(Block* stmt)
+{
+    size_t locals = m_locals.size();
+    int* slot_owner = m_slot_owner;
+    if (!stmt->m_flattened) m_slot_owner = &stmt->m_slot_count;
+
+    ++m_scope_depth;
+    optimize(stmt->m_statements);
+    --m_scope_depth;
+    m_locals.resize(locals);
+    m_slot_owner = slot_owner;
+
+    m_stmt = stmt;
+}
+
+void Optimizer::visit_class(Class* stmt)
+{
+    declare(stmt->m_name);
+
+    for (Function* method : stmt->m_methods)
+        optimize_function(method);
+
+    define(stmt->m_name);
+    m_stmt = stmt;
+}
+
+// Evaluating a literal has no effect, so the statement can go.
+void Optimizer::visit_expression(Expression* stmt)
+{
+    stmt->m_expression = optimize(stmt->m_expression);
+    m_stmt = is_literal(stmt->m_expression) ? nullptr : stmt;
+}
+
+void Optimizer::visit_function(Function* stmt)
+{
+    declare(stmt->m_name);
+    optimize_function(stmt);
+
+    // Only calls after the declaration can rely on it having run.
+    if (m_scope_depth == 0 && stmt->m_stable)
+        consider_inlining(stmt);
+
+    define(stmt->m_name);
+
+    m_stmt = stmt;
+}
+
+void Optimizer::optimize_function(Function* function)
+{
+    size_t locals = m_locals.size();
+    int* slot_owner = m_slot_owner;
+    m_slot_owner = &function->m_slot_count;
+
+    ++m_scope_depth;
+    for (const Token& param : function->m_params)
+        declare(param);
+
+    optimize(function->m_body);
+    --m_scope_depth;
+    m_locals.resize(locals);
+    m_slot_owner = slot_owner;
+}
+
+void Optimizer::consider_inlining(Function* function)
+{
+    if (function->m_body.size() != 1) return;
+
+    auto body = dynamic_cast<Return*>(function->m_body[0]);
+    if (body == nullptr || body->m_value == nullptr) return;
+
+    InlineAnalysis analysis{function};
+    analysis.analyze(body->m_value);
+    if (!analysis.m_inlinable || analysis.m_size > m_inline_threshold) return;
+
+    m_inlinable.emplace(function->m_name.m_lexeme, Inlinable{function, body->m_value, analysis.m_calls, std::move(analysis.m_globals)});
+}
+
+// Returns the expression to evaluate in place of a call: the callee's body
+// if it can be inlined here, or the call itself.
+Expr* Optimizer::inline_call(Call* expr)
+{
+    auto callee = dynamic_cast<Variable*>(expr->m_calee);
+    if (m_folding_inlined || callee == nullptr || callee->m_depth >= 0) return expr;
+
+    auto found = m_inlinable.find(callee->m_name.m_lexeme);
+    if (found == m_inlinable.end()) return expr;
+
+    const Inlinable& inlinable = found->second;
+    if (expr->m_arguments.size() != inlinable.m_function->m_params.size()) return expr;
+
+    // Arguments are substituted for every use of their parameter, so they
+    // have to read the same wherever the body reads them. Literals always
+    // do. A local does unless the body makes a call, which could reach a
+    // closure that assigns it between the call and the read; the call is
+    // kept then, its frame binding the arguments to fresh parameters. The
+    // body can't assign the local itself: InlineAnalysis only admits
+    // bodies that assign nothing but globals.
+    for (Expr* argument : expr->m_arguments)
+    {
+        if (is_literal(argument)) continue;
+
+        auto variable = dynamic_cast<Variable*>(argument);
+        if (variable == nullptr || variable->m_depth < 0 || inlinable.m_calls) return expr;
+    }
+
+    // The bytecode compiler looks names up itself, so a local here would
+    // capture a global the body refers to.
+    for (std::string_view name : inlinable.m_globals)
+        if (std::find(m_locals.begin(), m_locals.end(), name) != m_locals.end()) return expr;
+
+    Expr* body = Substitution{m_program.m_arena, expr->m_arguments}.copy(inlinable.m_body);
+
+    m_folding_inlined = true;
+    body = optimize(body);
+    m_folding_inlined = false;
+    return body;
+}
+
+void Optimizer::visit_if(If* stmt)
+{
+    stmt->m_condition = optimize(stmt->m_condition);
+
+    if (is_literal(stmt->m_condition))
+    {
+        Stmt* taken = literal_value(stmt->m_condition).is_falsey() ? stmt->m_elseBranch : stmt->m_thenBranch;
+        m_stmt = taken != nullptr ? optimize(taken) : nullptr;
+        return;
+    }
+
+    stmt->m_thenBranch = optimize_branch(stmt->m_thenBranch);
+    if (stmt->m_elseBranch != nullptr)
+        stmt->m_elseBranch = optimize(stmt->m_elseBranch);
+
+    m_stmt = stmt;
+}
+
+void Optimizer::visit_print(Print* stmt)
+{
+    stmt->m_expression = optimize(stmt->m_expression);
+    m_stmt = stmt;
+}
+
+void Optimizer::visit_return(Return* stmt)
+{
+    if (stmt->m_value != nullptr)
+        stmt->m_value = optimize(stmt->m_value);
+
+    // An inlined call is no longer a call.
+    if (stmt->m_tail_call && dynamic_cast<Call*>(stmt->m_value) == nullptr)
+        stmt->m_tail_call = false;
+
+    m_stmt = stmt;
+}
+
+void Optimizer::visit_var(Var* stmt)
+{
+    // Declared first: the compiler rejects a local read in its own
+    // initializer, which an inlined global of the same name would become.
+    declare(stmt->m_name);
+
+    if (stmt->m_initializer != nullptr)
+        stmt->m_initializer = optimize(stmt->m_initializer);
+
+    define(stmt->m_name);
+    m_stmt = stmt;
+}
+
+void Optimizer::visit_while(While* stmt)
+{
+    stmt->m_condition = optimize(stmt->m_condition);
+
+    if (is_literal(stmt->m_condition) && literal_value(stmt->m_condition).is_falsey())
+    {
+        m_stmt = nullptr;
+        return;
+    }
+
+    stmt->m_body = optimize_branch(stmt->m_body);
+    m_stmt = hoist_invariants(stmt);
+}
+
+// Rewrites
+//
+//     while (c) body
+//
+// as
+//
+//     { var t1 = e1; if (c) { var t2 = e2; while (c) body } }
+//
+// where e1 is invariant in c and e2 in body, and each is replaced by a
+// read of its temporary. The guard keeps e2 from being evaluated if the
+// loop never runs, and is only added when c can be evaluated twice without
+// effect. The blocks are flattened and the temporaries take new slots in
+// the enclosing environment, so no other variable's depth changes.
+Stmt* Optimizer::hoist_invariants(While* stmt)
+{
+    if (m_slot_owner == nullptr) return stmt;
+
+    LoopEffects effects;
+    effects.analyze(stmt);
+    if (effects.m_opaque) return stmt;
+
+    InvariantSearch condition{effects, m_defined};
+    condition.search(stmt->m_condition);
+
+    // Evaluating the condition again for the guard is only harmless if it
+    // assigns nothing.
+    LoopEffects condition_effects;
+    condition_effects.analyze(stmt->m_condition);
+
+    InvariantSearch body{effects, m_defined};
+    if (condition_effects.m_written.empty())
+    {
+        if (auto block = dynamic_cast<Block*>(stmt->m_body))
+            body.search(block->m_statements);
+        else
+            body.search(std::vector<Stmt*>{stmt->m_body});
+    }
+
+    if (condition.m_sites.empty() && body.m_sites.empty()) return stmt;
+
+    auto hoist = [this](const std::vector<Expr**>& sites) {
+        std::vector<Stmt*> temporaries;
+        for (Expr** site : sites)
+        {
+            Var* var = temporary(*site, line_of(*site));
+            Variable* read = m_program.m_arena.make<Variable>(var->m_name);
+            read->m_depth = 0;
+            read->m_slot = var->m_slot;
+            *site = read;
+            temporaries.push_back(var);
+        }
+        return temporaries;
+    };
+
+    auto flattened = [this](std::vector<Stmt*> statements) {
+        Block* block = m_program.m_arena.make<Block>(statements);
+        block->m_flattened = true;
+        return block;
+    };
+
+    std::vector<Stmt*> outer = hoist(condition.m_sites);
+    if (body.m_sites.empty())
+        outer.push_back(stmt);
+    else
+    {
+        std::vector<Stmt*> guarded = hoist(body.m_sites);
+        guarded.push_back(stmt);
+        outer.push_back(m_program.m_arena.make<If>(stmt->m_condition, flattened(guarded), nullptr));
+    }
+
+    return flattened(outer);
+}
+
+Var* Optimizer::temporary(Expr* initializer, int line)
+{
+    // Not a valid identifier, so it can't clash with a name in the script.
+    // The bytecode compiler looks locals up by name, so each is distinct.
+    ObjString* name = heap().intern("$invariant" + std::to_string(m_temporaries++));
+    m_program.m_constants.push_back(name);
+
+    Var* var = m_program.m_arena.make<Var>(Token{IDENTIFIER, name->m_chars, line}, initializer);
+    var->m_slot = (*m_slot_owner)++;
+    return var;
+}
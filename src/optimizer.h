@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#include "parser.h"
+#include "stmt.h"
+
+// Rewrites a resolved program in place before it runs:
+//
+// - Unary, Binary and Logical nodes whose operands are literals become the
+//   literal they evaluate to. Operations that would raise a runtime error
+//   are left for the interpreter to report.
+// - Groupings are dropped.
+// - An If with a literal condition becomes the branch it would take, and a
+//   While whose condition is a literal false disappears.
+// - Statements after a return in the same block are dropped, as are
+//   expression statements that fold to a literal.
+// - A call to a global function whose body is a single return of at most
+//   m_inline_threshold nodes is replaced by that expression, once the
+//   function has been declared. See inline_call().
+// - Invariant expressions in a loop are computed once, before it, into
+//   temporaries. See hoist_invariants().
+//
+// It runs after Resolver, so the program's errors are still reported in
+// full. Nodes keep their scope, so the slots Resolver assigned stay valid.
+class Optimizer : public VisitorExpr, public VisitorStmt
+{
+public:
+    static constexpr int DEFAULT_INLINE_THRESHOLD = 16;
+
+    Optimizer(Program& program, int inline_threshold = DEFAULT_INLINE_THRESHOLD)
+        : m_program{program}, m_inline_threshold{inline_threshold} { }
+
+    void optimize(std::vector<Stmt*>& statements);
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    // A function whose calls can be replaced by its returned expression.
+    struct Inlinable
+    {
+        Function* m_function;
+        Expr* m_body;
+        // Whether the body makes a call, which could assign a local passed
+        // as an argument.
+        bool m_calls;
+        // Globals the body refers to, which a local at the call site
+        // mustn't shadow.
+        std::vector<std::string_view> m_globals;
+    };
+
+    Program& m_program;
+    int m_inline_threshold;
+    std::unordered_map<std::string_view, Inlinable> m_inlinable;
+    // Names declared in the scopes around the node being visited.
+    std::vector<std::string_view> m_locals;
+    // Globals declared by the top-level statements visited so far. Code
+    // after a declaration only runs once it has, so reading these can't
+    // fail there.
+    std::vector<std::string_view> m_defined;
+    int m_scope_depth = 0;
+    // Set while folding an inlined body, which is never inlined into again.
+    bool m_folding_inlined = false;
+    // Slot count of the environment the visited code runs in, which loop
+    // temporaries are added to. Null at the top level, where there is none.
+    int* m_slot_owner = nullptr;
+    int m_temporaries = 0;
+    // What the node just visited should be replaced with. A null statement
+    // is dropped.
+    Expr* m_expr = nullptr;
+    Stmt* m_stmt = nullptr;
+
+    Expr* optimize(Expr* expr)
+    {
+        m_expr = expr;
+        expr->accept(*this);
+        return m_expr;
+    }
+
+    Stmt* optimize(Stmt* stmt)
+    {
+        m_stmt = stmt;
+        stmt->accept(*this);
+        return m_stmt;
+    }
+
+    Stmt* optimize_branch(Stmt* stmt);
+    Literal* literal(Value value);
+
+    void declare(const Token& name)
+    {
+        if (m_scope_depth > 0) m_locals.push_back(name.m_lexeme);
+    }
+
+    void define(const Token& name)
+    {
+        if (m_scope_depth == 0) m_defined.push_back(name.m_lexeme);
+    }
+
+    void optimize_function(Function* function);
+    void consider_inlining(Function* function);
+    Expr* inline_call(Call* expr);
+
+    Stmt* hoist_invariants(While* stmt);
+    Var* temporary(Expr* initializer, int line);
+};
@@ -39,20 +39,32 @@ bool Parser::is_at_end()
 
 Token Parser::peek()
 {
-    return m_tokens.at(current);
+    while (m_pulled <= current)
+        m_ring[m_pulled++ % LOOKAHEAD] = m_lexer.next_token();
+
+    return m_ring[current % LOOKAHEAD];
 }
 
 Token Parser::previous()
 {
-    return m_tokens.at(current - 1);
+    // Wrapped forwards, so a call before the first token can't index
+    // outside the ring.
+    return m_ring[(current + LOOKAHEAD - 1) % LOOKAHEAD];
 }
 
 ParseError Parser::error(Token token, std::string message)
 {
-    error(token, message);
+    ::error(token, message);
     return ParseError(message);
 }
 
+ObjString* Parser::intern(const Token& name)
+{
+    ObjString* key = heap().intern(name.m_lexeme);
+    m_program->m_constants.push_back(key);
+    return key;
+}
+
 Token Parser::consume(TokenType type, std::string message)
 {
     if(check(type)) 
@@ -80,38 +92,40 @@ void Parser::synchronize()
             case PRINT:
             case RETURN:
                 return;
+            default:
+                break;
         }
 
         advance();
     }
 }
 
-std::vector<std::shared_ptr<Stmt>> Parser::parse()
+std::unique_ptr<Program> Parser::parse()
 {
-    std::vector<std::shared_ptr<Stmt>> statements;
     while(!is_at_end())
-        statements.push_back(declaration());
+        m_program->m_statements.push_back(declaration());
 
-    return statements;
+    return std::move(m_program);
 }
 
-std::shared_ptr<Stmt> Parser::statement()
+Stmt* Parser::statement()
 {
     if(match(FOR)) return for_statement();
     if(match(IF)) return if_statement();
     if(match(PRINT)) return print_statement();
     if (match(RETURN)) return return_statement();
     if(match(WHILE)) return while_statement();
-    if(match(LEFT_BRACE)) return std::make_shared<Block>(block());
+    if(match(LEFT_BRACE)) return make<Block>(block());
 
     return expression_statement();
 }
 
-std::shared_ptr<Stmt> Parser::for_statement()
+Stmt* Parser::for_statement()
 {
+    int line = previous().m_line;
     consume(LEFT_PAREN, "Expect '(' after 'for'.");
 
-    std::shared_ptr<Stmt> initializer;
+    Stmt* initializer;
     if (match(SEMICOLON))
       initializer = nullptr;
     else if (match(VAR))
@@ -119,109 +133,132 @@ std::shared_ptr<Stmt> Parser::for_statement()
     else 
       initializer = expression_statement();
 
-    std::shared_ptr<Expr> condition = nullptr;
+    Expr* condition = nullptr;
     if(!check(SEMICOLON))
         condition = expression();
 
     consume(SEMICOLON, "Expect ';' after loop condition.");
 
-    std::shared_ptr<Expr> increment = nullptr;
+    Expr* increment = nullptr;
     if (!check(RIGHT_PAREN)) 
       increment = expression();
 
     consume(RIGHT_PAREN, "Expect ')' after for clauses.");
 
-    std::shared_ptr<Stmt> body = statement();
+    Stmt* body = statement();
 
     if (increment != nullptr) 
     {
-      body = std::make_shared<Block>(
-          std::vector<std::shared_ptr<Stmt>>{
+      body = make<Block>(
+          std::vector<Stmt*>{
               body,
-              std::make_shared<Expression>(increment)});
+              make<Expression>(increment)});
     }
     
     if (condition == nullptr)
-      condition = std::make_shared<Literal>(true);
+      condition = make<Literal>(true);
 
-    body = std::make_shared<While>(condition, body);
+    body = make<While>(condition, body, line);
 
     if (initializer != nullptr)
     {
-      body = std::make_shared<Block>(
-          std::vector<std::shared_ptr<Stmt>>{initializer, body});
+      body = make<Block>(
+          std::vector<Stmt*>{initializer, body});
     }
 
     return body;
 }
 
-std::shared_ptr<Stmt> Parser::if_statement()
+Stmt* Parser::if_statement()
 {
     consume(LEFT_PAREN, "Expect '(' after 'if'.");
-    std::shared_ptr<Expr> condition = expression();
+    Expr* condition = expression();
     consume(RIGHT_PAREN, "Expect ')' after if condition."); 
 
-    std::shared_ptr<Stmt> thenBranch = statement();
-    std::shared_ptr<Stmt> elseBranch = nullptr;
+    Stmt* thenBranch = statement();
+    Stmt* elseBranch = nullptr;
     if(match(ELSE))
         elseBranch = statement();
 
-    return std::make_shared<If>(condition, thenBranch, elseBranch);
+    return make<If>(condition, thenBranch, elseBranch);
 }
 
-std::shared_ptr<Stmt> Parser::while_statement()
+Stmt* Parser::while_statement()
 {
+    int line = previous().m_line;
     consume(LEFT_PAREN, "Expect '(' after 'while'.");
-    std::shared_ptr<Expr> condition = expression();
+    Expr* condition = expression();
     consume(RIGHT_PAREN, "Expect ')' after condition.");
 
-    std::shared_ptr<Stmt> body = statement();
+    Stmt* body = statement();
 
-    return std::make_shared<While>(condition, body);
+    return make<While>(condition, body, line);
 }
 
-std::shared_ptr<Stmt> Parser::print_statement()
+Stmt* Parser::print_statement()
 {
-    std::shared_ptr<Expr> value = expression();
+    Expr* value = expression();
 
     consume(SEMICOLON, "Expect ';' after value.");
 
-    return std::make_shared<Print>(value);
+    return make<Print>(value);
 }
 
-std::shared_ptr<Stmt> Parser::return_statement() {
+Stmt* Parser::return_statement() {
     Token keyword = previous();
-    std::shared_ptr<Expr> value = nullptr;
+    Expr* value = nullptr;
     if (!check(SEMICOLON)) {
       value = expression();
     }
 
     consume(SEMICOLON, "Expect ';' after return value.");
-    return std::make_shared<Return>(keyword, value);
+    return make<Return>(keyword, value);
   }
 
-std::shared_ptr<Stmt> Parser::var_declaration()
+Stmt* Parser::var_declaration()
 {
     Token name = consume(IDENTIFIER, "Expect variable name.");
 
-    std::shared_ptr<Expr> initializer = nullptr;
+    Expr* initializer = nullptr;
     if(match(EQUAL))
         initializer = expression();
 
     consume(SEMICOLON, "Expect ';' after variable declaration.");
-    return std::make_shared<Var>(name, initializer);
+    return make<Var>(name, initializer);
 }
 
-std::shared_ptr<Stmt> Parser::expression_statement()
+Stmt* Parser::expression_statement()
 {
-    std::shared_ptr<Expr> value = expression();
+    Expr* value = expression();
 
     consume(SEMICOLON, "Expect ';' after value.");
     
-    return std::make_shared<Expression>(value);
+    return make<Expression>(value);
 }
 
-std::shared_ptr<Function> Parser::function(std::string kind)
+Stmt* Parser::class_declaration()
+{
+    Token name = consume(IDENTIFIER, "Expect class name.");
+
+    Variable* superclass = nullptr;
+    if(match(LESS))
+    {
+        consume(IDENTIFIER, "Expect superclass name.");
+        superclass = make<Variable>(previous());
+    }
+
+    consume(LEFT_BRACE, "Expect '{' before class body.");
+
+    std::vector<Function*> methods;
+    while(!check(RIGHT_BRACE) && !is_at_end())
+        methods.push_back(function("method"));
+
+    consume(RIGHT_BRACE, "Expect '}' after class body.");
+
+    return make<Class>(name, superclass, methods);
+}
+
+Function* Parser::function(std::string kind)
 {
     Token name = consume(IDENTIFIER, "Expect " + kind + " name.");
     consume(LEFT_PAREN, "Expect '(' after " + kind + " name.");
@@ -238,14 +275,14 @@ std::shared_ptr<Function> Parser::function(std::string kind)
     }
     consume(RIGHT_PAREN, "Expect ')' after parameters.");
     consume(LEFT_BRACE, "Expect '{' before " + kind + " body.");
-    std::vector<std::shared_ptr<Stmt>> body = block();
+    std::vector<Stmt*> body = block();
 
-    return std::make_shared<Function>(name, parameters, body);
+    return make<Function>(name, parameters, body);
 }
 
-std::vector<std::shared_ptr<Stmt>> Parser::block()
+std::vector<Stmt*> Parser::block()
 {
-    std::vector<std::shared_ptr<Stmt>> statements;
+    std::vector<Stmt*> statements;
 
     while(!check(RIGHT_BRACE) && !is_at_end())
         statements.emplace_back(declaration());
@@ -254,19 +291,23 @@ std::vector<std::shared_ptr<Stmt>> Parser::block()
     return statements;
 }
 
-std::shared_ptr<Expr> Parser::assignment()
+Expr* Parser::assignment()
 {  
-    std::shared_ptr<Expr> expr = Or();
+    Expr* expr = Or();
 
     if(match(EQUAL))
     {
         Token equals = previous();
-        std::shared_ptr<Expr> value = assignment();
+        Expr* value = assignment();
 
-        if(auto var = std::dynamic_pointer_cast<Variable>(expr))
+        if(auto var = dynamic_cast<Variable*>(expr))
         {
             Token name = var->m_name;
-            return std::make_shared<Assign>(name, value);
+            return make<Assign>(name, value);
+        }
+        else if(auto get = dynamic_cast<Get*>(expr))
+        {
+            return make<Set>(get->m_name, value, get->m_object, get->m_key);
         }
 
         error(equals, "Invalid assignment target.");
@@ -275,47 +316,48 @@ std::shared_ptr<Expr> Parser::assignment()
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::Or()
+Expr* Parser::Or()
 {
-    std::shared_ptr<Expr> expr = And();
+    Expr* expr = And();
     while(match(OR))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = And();
-        expr = std::make_shared<Logical>(expr, op, right);
+        Expr* right = And();
+        expr = make<Logical>(expr, op, right);
     }
     
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::And()
+Expr* Parser::And()
 {
-    std::shared_ptr<Expr> expr = equality();
+    Expr* expr = equality();
     while(match(AND))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = equality();
-        expr = std::make_shared<Logical>(expr, op, right);
+        Expr* right = equality();
+        expr = make<Logical>(expr, op, right);
     }
     
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::expression()
+Expr* Parser::expression()
 {  
     return assignment();
 }
 
-std::shared_ptr<Stmt> Parser::declaration()
+Stmt* Parser::declaration()
 {
     try
     {
+        if(match(CLASS)) return class_declaration();
         if(match(FUN)) return function("function");
         if(match(VAR)) return var_declaration();
 
         return statement();
     }
-    catch(ParseError error)
+    catch(const ParseError&)
     {
        synchronize();
         return nullptr;
@@ -323,77 +365,77 @@ std::shared_ptr<Stmt> Parser::declaration()
     
 }
 
-std::shared_ptr<Expr> Parser::equality()
+Expr* Parser::equality()
 {
-    std::shared_ptr<Expr> expr = comparison();
+    Expr* expr = comparison();
 
     while(match(BANG_EQUAL, EQUAL_EQUAL))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = comparison();
-        expr = std::make_shared<Binary>(expr, op, right);
+        Expr* right = comparison();
+        expr = make<Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::comparison()
+Expr* Parser::comparison()
 {
-    std::shared_ptr<Expr> expr = term();
+    Expr* expr = term();
 
     while(match(GREATER, GREATER_EQUAL, LESS, LESS_EQUAL))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = term();
-        expr = std::make_shared<Binary>(expr, op, right);
+        Expr* right = term();
+        expr = make<Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::term()
+Expr* Parser::term()
 {
-    std::shared_ptr<Expr> expr = factor();
+    Expr* expr = factor();
 
     while(match(MINUS, PLUS))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = factor();
-        expr = std::make_shared<Binary>(expr, op, right);
+        Expr* right = factor();
+        expr = make<Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::factor()
+Expr* Parser::factor()
 {
-    std::shared_ptr<Expr> expr = unary();
+    Expr* expr = unary();
 
     while(match(SLASH, STAR))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = unary();
-        expr = std::make_shared<Binary>(expr, op, right);
+        Expr* right = unary();
+        expr = make<Binary>(expr, op, right);
     }
 
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::unary()
+Expr* Parser::unary()
 {
     if(match(BANG, MINUS))
     {
         Token op = previous();
-        std::shared_ptr<Expr> right = unary();
-        return std::make_shared<Unary>(op, right);
+        Expr* right = unary();
+        return make<Unary>(op, right);
     }
 
     return call();
 }
 
-std::shared_ptr<Expr> Parser::finish_call(std::shared_ptr<Expr> callee)
+Expr* Parser::finish_call(Expr* callee)
 {
-    std::vector<std::shared_ptr<Expr>> arguments;
+    std::vector<Expr*> arguments;
     if(!check(RIGHT_PAREN))
     {
         do
@@ -407,17 +449,22 @@ std::shared_ptr<Expr> Parser::finish_call(std::shared_ptr<Expr> callee)
 
     Token paren = consume(RIGHT_PAREN, "Expect ')' after arguments.");
 
-    return std::make_shared<Call>(callee, paren, arguments);
+    return make<Call>(callee, paren, arguments);
 }
 
-std::shared_ptr<Expr> Parser::call()
+Expr* Parser::call()
 {
-    std::shared_ptr<Expr> expr = primary();
+    Expr* expr = primary();
 
     while(true)
     {
         if(match(LEFT_PAREN))
             expr = finish_call(expr);
+        else if(match(DOT))
+        {
+            Token name = consume(IDENTIFIER, "Expect property name after '.'.");
+            expr = make<Get>(name, expr, intern(name));
+        }
         else
             break;
     }
@@ -425,23 +472,40 @@ std::shared_ptr<Expr> Parser::call()
     return expr;
 }
 
-std::shared_ptr<Expr> Parser::primary()
+Expr* Parser::primary()
 {
-    if (match(FALSE)) return std::make_shared<Literal>(false);
-    if (match(TRUE)) return std::make_shared<Literal>(true);
-    if (match(NIL)) return std::make_shared<Literal>(nullptr);
+    if (match(FALSE)) return make<Literal>(false);
+    if (match(TRUE)) return make<Literal>(true);
+    if (match(NIL)) return make<Literal>(nullptr);
 
     if (match(NUMBER, STRING)) 
-      return std::make_shared<Literal>(previous().m_literal);
+    {
+      Value value = previous().literal();
+      if (value.is_obj())
+        m_program->m_constants.push_back(value);
+
+      return make<Literal>(value);
+    }
+
+    if(match(SUPER))
+    {
+        Token keyword = previous();
+        consume(DOT, "Expect '.' after 'super'.");
+        Token method = consume(IDENTIFIER, "Expect superclass method name.");
+        return make<Super>(keyword, method, intern(method));
+    }
+
+    if(match(THIS))
+        return make<This>(previous());
 
     if(match(IDENTIFIER))
-        return std::make_shared<Variable>(previous());
+        return make<Variable>(previous());
 
     if (match(LEFT_PAREN)) 
     {
-      std::shared_ptr<Expr> expr = expression();
+      Expr* expr = expression();
       consume(RIGHT_PAREN, "Expect ')' after expression.");
-      return std::make_shared<Grouping>(expr);
+      return make<Grouping>(expr);
     }
 
     throw error(peek(), "Expect expression.");
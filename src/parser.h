@@ -4,18 +4,52 @@
 #include <memory>
 #include <stdexcept>
 
+#include "arena.h"
 #include "lex.h"
+#include "memory.h"
 #include "expr.h"
 #include "stmt.h"
-#include "lox_return.h"
 
 class ParseError;
 
+// The parse result. Every node of the tree is allocated from m_arena, so
+// dropping the Program frees the whole script in one release. The string
+// literals in the tree are kept alive through m_constants.
+class Program : public RootSet
+{
+public:
+    Arena m_arena;
+    std::vector<Stmt*> m_statements;
+    std::vector<Value> m_constants;
+
+    Program() { heap().add_roots(this); }
+    Program(const Program&) = delete;
+    ~Program() { heap().remove_roots(this); }
+
+    void mark_roots(Heap& heap) override
+    {
+        for (Value constant : m_constants)
+            heap.mark(constant);
+    }
+};
+
 class Parser 
 {
 private:
-    const std::vector<Token>& m_tokens;
+    // Tokens are pulled from m_lexer as the parser reaches them. The ring
+    // keeps the current token and the few before it, which is all the
+    // lookbehind previous() needs.
+    static constexpr int LOOKAHEAD = 4;
+
+    Lexer& m_lexer;
+    Token m_ring[LOOKAHEAD];
     int current = 0;
+    int m_pulled = 0;
+    std::unique_ptr<Program> m_program;
+
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    { return m_program->m_arena.make<T>(std::forward<Args>(args)...); }
 
     template <class... T>
     bool match(T... type);
@@ -27,37 +61,39 @@ private:
     Token previous();
     Token consume(TokenType type, std::string message);
     void synchronize();
+    ObjString* intern(const Token& name);
     ParseError error(Token token, std::string message);
 
-    std::shared_ptr<Stmt> statement();
-    std::shared_ptr<Stmt> for_statement();
-    std::shared_ptr<Stmt> if_statement();
-    std::shared_ptr<Stmt> while_statement();
-    std::shared_ptr<Stmt> print_statement();
-    std::shared_ptr<Stmt> return_statement();
-    std::shared_ptr<Stmt> var_declaration();
-    std::shared_ptr<Stmt> expression_statement();
-    std::shared_ptr<Function> function(std::string kind);
-    std::vector<std::shared_ptr<Stmt>> block();
-    std::shared_ptr<Expr> assignment();
-    std::shared_ptr<Expr> Or();
-    std::shared_ptr<Expr> And();
-    std::shared_ptr<Expr> expression();
-    std::shared_ptr<Stmt> declaration();
-    std::shared_ptr<Expr> equality();
-    std::shared_ptr<Expr> comparison();
-    std::shared_ptr<Expr> term();
-    std::shared_ptr<Expr> factor();
-    std::shared_ptr<Expr> unary();
-    std::shared_ptr<Expr> finish_call(std::shared_ptr<Expr> callee);
-    std::shared_ptr<Expr> call();
-    std::shared_ptr<Expr> primary();
+    Stmt* statement();
+    Stmt* for_statement();
+    Stmt* if_statement();
+    Stmt* while_statement();
+    Stmt* print_statement();
+    Stmt* return_statement();
+    Stmt* var_declaration();
+    Stmt* class_declaration();
+    Stmt* expression_statement();
+    Function* function(std::string kind);
+    std::vector<Stmt*> block();
+    Expr* assignment();
+    Expr* Or();
+    Expr* And();
+    Expr* expression();
+    Stmt* declaration();
+    Expr* equality();
+    Expr* comparison();
+    Expr* term();
+    Expr* factor();
+    Expr* unary();
+    Expr* finish_call(Expr* callee);
+    Expr* call();
+    Expr* primary();
 public:
-    Parser(const std::vector<Token>& tokens)
-        : m_tokens{tokens} { }
+    Parser(Lexer& lexer)
+        : m_lexer{lexer}, m_program{new Program} { }
     ~Parser() = default;
 
-    std::vector<std::shared_ptr<Stmt>> parse();
+    std::unique_ptr<Program> parse();
 };
 
 class ParseError : public std::runtime_error 
@@ -0,0 +1,492 @@
+#include <algorithm>
+
+#include "resolver.h"
+
+void error(Token token, std::string message);
+
+void Resolver::resolve(const std::vector<Stmt*>& statements)
+{
+    resolve_statements(statements);
+    infer_purity();
+}
+
+void Resolver::assume_assigned(std::string_view name)
+{
+    m_globals[name].m_assigned_outside = true;
+}
+
+bool Resolver::binds_global(std::string_view name) const
+{
+    auto global = m_globals.find(name);
+    return global != m_globals.end() && (global->second.m_declarations > 0 || global->second.m_assigned);
+}
+
+void Resolver::resolve_statements(const std::vector<Stmt*>& statements)
+{
+    for (Stmt* statement : statements)
+        resolve(statement);
+}
+
+static bool declares_closure(const std::vector<Stmt*>& statements);
+
+// True if stmt declares a function or class anywhere inside it. Lox has no
+// function expressions, so these are the only ways to capture a scope.
+static bool declares_closure(Stmt* stmt)
+{
+    if (dynamic_cast<Function*>(stmt) || dynamic_cast<Class*>(stmt))
+        return true;
+
+    if (auto block = dynamic_cast<Block*>(stmt))
+        return declares_closure(block->m_statements);
+
+    if (auto branch = dynamic_cast<If*>(stmt))
+        return declares_closure(branch->m_thenBranch)
+            || (branch->m_elseBranch != nullptr && declares_closure(branch->m_elseBranch));
+
+    if (auto loop = dynamic_cast<While*>(stmt))
+        return declares_closure(loop->m_body);
+
+    return false;
+}
+
+static bool declares_closure(const std::vector<Stmt*>& statements)
+{
+    for (Stmt* statement : statements)
+        if (declares_closure(statement))
+            return true;
+
+    return false;
+}
+
+void Resolver::begin_scope(bool flattened)
+{
+    int first_slot = flattened ? owner_scope().m_next_slot : 0;
+
+    m_scopes.emplace_back();
+    m_scopes.back().m_flattened = flattened;
+    m_scopes.back().m_first_slot = first_slot;
+}
+
+int Resolver::end_scope()
+{
+    int slot_count = m_scopes.back().m_slot_count;
+    bool flattened = m_scopes.back().m_flattened;
+    int first_slot = m_scopes.back().m_first_slot;
+    m_scopes.pop_back();
+
+    // The slots the scope took from its owner are free for the next one.
+    if (flattened)
+        owner_scope().m_next_slot = first_slot;
+
+    return slot_count;
+}
+
+Resolver::Scope& Resolver::owner_scope()
+{
+    int i = m_scopes.size() - 1;
+    while (m_scopes[i].m_flattened)
+        --i;
+
+    return m_scopes[i];
+}
+
+int Resolver::declare(const Token& name)
+{
+    if (m_scopes.empty()) return -1;
+
+    Scope& scope = m_scopes.back();
+    if (scope.m_names.count(name.m_lexeme))
+        error(name, "Already a variable with this name in this scope.");
+
+    Scope& owner = owner_scope();
+    int slot = owner.m_next_slot++;
+    owner.m_slot_count = std::max(owner.m_slot_count, owner.m_next_slot);
+
+    scope.m_names[name.m_lexeme] = Binding{slot, false};
+    return slot;
+}
+
+void Resolver::define(const Token& name)
+{
+    if (m_scopes.empty()) return;
+
+    m_scopes.back().m_names[name.m_lexeme].m_defined = true;
+}
+
+// Binds 'this' or 'super' in a scope of its own, where it takes slot 0.
+void Resolver::declare_keyword(TokenType type, std::string_view keyword, int line)
+{
+    Token name{type, keyword, line};
+    declare(name);
+    define(name);
+}
+
+// Depth counts environments, so flattened scopes don't add to it. Returns
+// the index of the scope that declares name, or -1 for a global.
+int Resolver::resolve_local(const Token& name, int& depth, int& slot)
+{
+    int environments = 0;
+    for (int i = m_scopes.size() - 1; i >= 0; --i)
+    {
+        auto binding = m_scopes[i].m_names.find(name.m_lexeme);
+        if (binding != m_scopes[i].m_names.end())
+        {
+            depth = environments;
+            slot = binding->second.m_slot;
+            return i;
+        }
+
+        if (!m_scopes[i].m_flattened)
+            environments++;
+    }
+
+    return -1;
+}
+
+void Resolver::declare_global(const Token& name, Function* function)
+{
+    Global& global = m_globals[name.m_lexeme];
+    global.m_declarations++;
+    global.m_function = function;
+}
+
+// A function is pure if its body has no effects and reads nothing but its
+// own locals and stable globals: those declared exactly once and never
+// assigned. It may only call globals declared with 'fun' that are pure in
+// turn. Native functions such as clock() are never declared in the
+// program, so calling one makes a function impure.
+//
+// Recursion means purity depends on itself, so every candidate starts out
+// pure and loses it until nothing changes.
+void Resolver::infer_purity()
+{
+    auto stable = [this](std::string_view name) -> Global* {
+        auto global = m_globals.find(name);
+        if (global == m_globals.end()) return nullptr;
+        if (global->second.m_declarations != 1 || global->second.m_assigned || global->second.m_assigned_outside)
+            return nullptr;
+        return &global->second;
+    };
+
+    for (auto& [function, purity] : m_purity)
+    {
+        for (std::string_view name : purity.m_reads)
+            if (stable(name) == nullptr)
+                purity.m_impure = true;
+
+        for (std::string_view name : purity.m_calls)
+        {
+            Global* callee = stable(name);
+            if (callee == nullptr || callee->m_function == nullptr)
+                purity.m_impure = true;
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& [function, purity] : m_purity)
+        {
+            if (purity.m_impure) continue;
+
+            for (std::string_view name : purity.m_calls)
+            {
+                if (m_purity[m_globals[name].m_function].m_impure)
+                {
+                    purity.m_impure = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (auto& [function, purity] : m_purity)
+        function->m_pure = !purity.m_impure;
+
+    for (auto& [name, global] : m_globals)
+        if (global.m_function != nullptr && stable(name) != nullptr)
+            global.m_function->m_stable = true;
+}
+
+void Resolver::resolve_function(Function* function, FunctionType type)
+{
+    FunctionType enclosing_function = m_current_function;
+    Function* enclosing_declaration = m_current_declaration;
+    int enclosing_scope = m_function_scope;
+    Purity* enclosing_purity = m_current_purity;
+    m_current_function = type;
+    m_current_declaration = function;
+    m_function_scope = m_scopes.size();
+    m_current_purity = type == TYPE_FUNCTION ? &m_purity[function] : nullptr;
+
+    begin_scope();
+    for (const Token& param : function->m_params)
+    {
+        declare(param);
+        define(param);
+    }
+
+    resolve_statements(function->m_body);
+    function->m_slot_count = end_scope();
+
+    m_current_function = enclosing_function;
+    m_current_declaration = enclosing_declaration;
+    m_function_scope = enclosing_scope;
+    m_current_purity = enclosing_purity;
+}
+
+Value Resolver::visit_assign(Assign* expr)
+{
+    resolve(expr->m_value);
+
+    int scope = resolve_local(expr->m_name, expr->m_depth, expr->m_slot);
+    if (scope < 0)
+        m_globals[expr->m_name.m_lexeme].m_assigned = true;
+
+    if (scope < m_function_scope)
+        impure();
+
+    return Value{};
+}
+
+Value Resolver::visit_binary(Binary* expr)
+{
+    resolve(expr->m_left);
+    resolve(expr->m_right);
+    return Value{};
+}
+
+Value Resolver::visit_call(Call* expr)
+{
+    resolve(expr->m_calee);
+    for (Expr* argument : expr->m_arguments)
+        resolve(argument);
+
+    auto callee = dynamic_cast<Variable*>(expr->m_calee);
+    if (callee != nullptr && callee->m_depth < 0)
+    {
+        if (m_current_purity != nullptr)
+            m_current_purity->m_calls.push_back(callee->m_name.m_lexeme);
+    }
+    else
+        impure();
+
+    return Value{};
+}
+
+// Fields are mutable, so reading one is as impure as writing one.
+Value Resolver::visit_get(Get* expr)
+{
+    impure();
+    resolve(expr->m_object);
+    return Value{};
+}
+
+Value Resolver::visit_grouping(Grouping* expr)
+{
+    resolve(expr->m_expression);
+    return Value{};
+}
+
+Value Resolver::visit_literal(Literal*)
+{
+    return Value{};
+}
+
+Value Resolver::visit_logical(Logical* expr)
+{
+    resolve(expr->m_left);
+    resolve(expr->m_right);
+    return Value{};
+}
+
+Value Resolver::visit_set(Set* expr)
+{
+    impure();
+    resolve(expr->m_value);
+    resolve(expr->m_object);
+    return Value{};
+}
+
+Value Resolver::visit_super(Super* expr)
+{
+    impure();
+
+    if (m_current_class == CLASS_NONE)
+        error(expr->m_keyword, "Can't use 'super' outside of a class.");
+    else if (m_current_class != CLASS_SUBCLASS)
+        error(expr->m_keyword, "Can't use 'super' in a class with no superclass.");
+
+    int slot;
+    resolve_local(expr->m_keyword, expr->m_depth, slot);
+    return Value{};
+}
+
+Value Resolver::visit_this(This* expr)
+{
+    impure();
+
+    if (m_current_class == CLASS_NONE)
+    {
+        error(expr->m_keyword, "Can't use 'this' outside of a class.");
+        return Value{};
+    }
+
+    int slot;
+    resolve_local(expr->m_keyword, expr->m_depth, slot);
+    return Value{};
+}
+
+Value Resolver::visit_unary(Unary* expr)
+{
+    resolve(expr->m_right);
+    return Value{};
+}
+
+Value Resolver::visit_variable(Variable* expr)
+{
+    if (!m_scopes.empty())
+    {
+        auto binding = m_scopes.back().m_names.find(expr->m_name.m_lexeme);
+        if (binding != m_scopes.back().m_names.end() && !binding->second.m_defined)
+            error(expr->m_name, "Can't read local variable in its own initializer.");
+    }
+
+    int scope = resolve_local(expr->m_name, expr->m_depth, expr->m_slot);
+    if (scope < 0)
+    {
+        if (m_current_purity != nullptr)
+            m_current_purity->m_reads.push_back(expr->m_name.m_lexeme);
+    }
+    else if (scope < m_function_scope)
+        impure();
+
+    return Value{};
+}
+
+void Resolver::visit_block(Block* stmt)
+{
+    // Top-level blocks have no environment to flatten into.
+    stmt->m_flattened = !m_scopes.empty() && !declares_closure(stmt->m_statements);
+
+    begin_scope(stmt->m_flattened);
+    resolve_statements(stmt->m_statements);
+    stmt->m_slot_count = end_scope();
+}
+
+void Resolver::visit_class(Class* stmt)
+{
+    ClassType enclosing_class = m_current_class;
+    m_current_class = CLASS_CLASS;
+
+    if (m_current_declaration != nullptr)
+        m_current_declaration->m_captures = true;
+    impure();
+
+    if (m_scopes.empty())
+        declare_global(stmt->m_name);
+
+    stmt->m_slot = declare(stmt->m_name);
+    define(stmt->m_name);
+
+    if (stmt->m_superclass != nullptr)
+    {
+        if (stmt->m_superclass->m_name.m_lexeme == stmt->m_name.m_lexeme)
+            error(stmt->m_superclass->m_name, "A class can't inherit from itself.");
+
+        m_current_class = CLASS_SUBCLASS;
+        resolve(stmt->m_superclass);
+
+        begin_scope();
+        declare_keyword(SUPER, "super", stmt->m_name.m_line);
+    }
+
+    begin_scope();
+    declare_keyword(THIS, "this", stmt->m_name.m_line);
+
+    for (Function* method : stmt->m_methods)
+    {
+        FunctionType declaration = TYPE_METHOD;
+        if (method->m_name.m_lexeme == "init")
+            declaration = TYPE_INITIALIZER;
+
+        resolve_function(method, declaration);
+    }
+
+    end_scope();
+
+    if (stmt->m_superclass != nullptr)
+        end_scope();
+
+    m_current_class = enclosing_class;
+}
+
+void Resolver::visit_expression(Expression* stmt)
+{
+    resolve(stmt->m_expression);
+}
+
+void Resolver::visit_function(Function* stmt)
+{
+    if (m_current_declaration != nullptr)
+        m_current_declaration->m_captures = true;
+    impure();
+
+    if (m_scopes.empty())
+        declare_global(stmt->m_name, stmt);
+
+    // Defined before the body is resolved so the function can recurse.
+    stmt->m_slot = declare(stmt->m_name);
+    define(stmt->m_name);
+
+    resolve_function(stmt, TYPE_FUNCTION);
+}
+
+void Resolver::visit_if(If* stmt)
+{
+    resolve(stmt->m_condition);
+    resolve(stmt->m_thenBranch);
+    if (stmt->m_elseBranch != nullptr)
+        resolve(stmt->m_elseBranch);
+}
+
+void Resolver::visit_print(Print* stmt)
+{
+    impure();
+    resolve(stmt->m_expression);
+}
+
+void Resolver::visit_return(Return* stmt)
+{
+    if (m_current_function == TYPE_NONE)
+        error(stmt->m_name, "Can't return from top-level code.");
+
+    if (stmt->m_value != nullptr)
+    {
+        if (m_current_function == TYPE_INITIALIZER)
+            error(stmt->m_name, "Can't return a value from an initializer.");
+
+        resolve(stmt->m_value);
+        stmt->m_tail_call = dynamic_cast<Call*>(stmt->m_value) != nullptr;
+    }
+}
+
+void Resolver::visit_var(Var* stmt)
+{
+    if (m_scopes.empty())
+        declare_global(stmt->m_name);
+
+    stmt->m_slot = declare(stmt->m_name);
+    if (stmt->m_initializer != nullptr)
+        resolve(stmt->m_initializer);
+
+    define(stmt->m_name);
+}
+
+void Resolver::visit_while(While* stmt)
+{
+    resolve(stmt->m_condition);
+    resolve(stmt->m_body);
+}
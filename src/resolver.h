@@ -0,0 +1,126 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#include "stmt.h"
+
+// Static pass run between Parser::parse() and execution. Every local
+// variable gets a slot in its scope, and every Variable/Assign node records
+// how many scopes out its declaration lives, so the interpreter never looks
+// a local up by name.
+//
+// It also infers which functions are pure, for memoization, and which
+// global functions are never rebound, for inlining: see infer_purity().
+class Resolver : public VisitorExpr, public VisitorStmt
+{
+public:
+    Resolver() = default;
+    ~Resolver() = default;
+
+    void resolve(const std::vector<Stmt*>& statements);
+
+    // Treats the global name as assigned by code outside the program, such
+    // as a restored Snapshot's, so no declaration of it counts as stable.
+    void assume_assigned(std::string_view name);
+    // True if the resolved program declares or assigns the global name.
+    bool binds_global(std::string_view name) const;
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    struct Binding
+    {
+        int m_slot;
+        bool m_defined;
+    };
+
+    // A flattened scope keeps its own names but allocates its slots from
+    // the nearest enclosing scope that isn't flattened. Sibling blocks
+    // reuse the same slots, so m_slot_count is a high-water mark.
+    struct Scope
+    {
+        std::unordered_map<std::string_view, Binding> m_names;
+        int m_slot_count = 0;
+        int m_next_slot = 0;
+        bool m_flattened = false;
+        // Flattened scopes only: the owner's m_next_slot when this began.
+        int m_first_slot = 0;
+    };
+
+    // What a function's body does that bears on its purity. Reads of and
+    // calls to globals can only be judged once the whole program is seen.
+    struct Purity
+    {
+        bool m_impure = false;
+        std::vector<std::string_view> m_reads;
+        std::vector<std::string_view> m_calls;
+    };
+
+    struct Global
+    {
+        int m_declarations = 0;
+        bool m_assigned = false;
+        // See assume_assigned().
+        bool m_assigned_outside = false;
+        // The declaration, if the global was declared with 'fun'.
+        Function* m_function = nullptr;
+    };
+
+    enum FunctionType { TYPE_NONE, TYPE_FUNCTION, TYPE_INITIALIZER, TYPE_METHOD };
+    enum ClassType { CLASS_NONE, CLASS_CLASS, CLASS_SUBCLASS };
+
+    std::vector<Scope> m_scopes;
+    FunctionType m_current_function = TYPE_NONE;
+    ClassType m_current_class = CLASS_NONE;
+    Function* m_current_declaration = nullptr;
+    // Index in m_scopes of the current function's parameter scope.
+    int m_function_scope = 0;
+
+    std::unordered_map<Function*, Purity> m_purity;
+    // Null inside methods, which are never memoized.
+    Purity* m_current_purity = nullptr;
+    std::unordered_map<std::string_view, Global> m_globals;
+
+    void resolve_statements(const std::vector<Stmt*>& statements);
+    void resolve(Stmt* stmt) { stmt->accept(*this); }
+    void resolve(Expr* expr) { expr->accept(*this); }
+    void resolve_function(Function* function, FunctionType type);
+
+    void begin_scope(bool flattened = false);
+    int  end_scope();
+    Scope& owner_scope();
+    int  declare(const Token& name);
+    void define(const Token& name);
+    int  resolve_local(const Token& name, int& depth, int& slot);
+    void declare_keyword(TokenType type, std::string_view keyword, int line);
+    void declare_global(const Token& name, Function* function = nullptr);
+
+    void impure() { if (m_current_purity != nullptr) m_current_purity->m_impure = true; }
+    void infer_purity();
+};
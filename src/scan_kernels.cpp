@@ -0,0 +1,299 @@
+#include <cstdint>
+#include <cstring>
+
+#include "scan_kernels.h"
+
+#if defined(__x86_64__)
+#define LOX_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static bool is_alnum(char c) { return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// Scalar versions. The vector kernels also use them for the last partial block.
+
+static const char* scalar_skip_whitespace(const char* p, const char* end, int* line)
+{
+    for (; p != end && is_whitespace(*p); ++p)
+        if (*p == '\n')
+            ++*line;
+
+    return p;
+}
+
+static const char* scalar_skip_alnum(const char* p, const char* end)
+{
+    while (p != end && is_alnum(*p))
+        ++p;
+
+    return p;
+}
+
+static const char* scalar_skip_digits(const char* p, const char* end)
+{
+    while (p != end && is_digit(*p))
+        ++p;
+
+    return p;
+}
+
+static const char* scalar_find_newline(const char* p, const char* end)
+{
+    const void* newline = std::memchr(p, '\n', end - p);
+    return newline != nullptr ? static_cast<const char*>(newline) : end;
+}
+
+static const char* scalar_find_quote(const char* p, const char* end, int* line)
+{
+    for (; p != end && *p != '"'; ++p)
+        if (*p == '\n')
+            ++*line;
+
+    return p;
+}
+
+#ifdef LOX_SCAN_X86
+
+// Each block is classified into a bitmask with one bit per byte. The run
+// ends at the lowest clear bit of the "keep going" mask. Bytes >= 0x80 are
+// negative as signed chars, so the signed range checks below reject them.
+
+// SSE2 is part of the x86-64 baseline and needs no dispatch.
+
+static __m128i sse2_in_range(__m128i c, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(low - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), c));
+}
+
+static const char* sse2_skip_whitespace(const char* p, const char* end, int* line)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i newline = _mm_cmpeq_epi8(c, _mm_set1_epi8('\n'));
+        __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\r')), newline));
+
+        uint32_t newlines = _mm_movemask_epi8(newline);
+        uint32_t stop = ~_mm_movemask_epi8(blank) & 0xFFFF;
+        if (stop != 0)
+        {
+            int n = __builtin_ctz(stop);
+            *line += __builtin_popcount(newlines & ((1u << n) - 1));
+            return p + n;
+        }
+
+        *line += __builtin_popcount(newlines);
+        p += 16;
+    }
+
+    return scalar_skip_whitespace(p, end, line);
+}
+
+static const char* sse2_skip_alnum(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i letter = sse2_in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i alnum = _mm_or_si128(letter, sse2_in_range(c, '0', '9'));
+
+        uint32_t stop = ~_mm_movemask_epi8(alnum) & 0xFFFF;
+        if (stop != 0)
+            return p + __builtin_ctz(stop);
+
+        p += 16;
+    }
+
+    return scalar_skip_alnum(p, end);
+}
+
+static const char* sse2_skip_digits(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+        uint32_t stop = ~_mm_movemask_epi8(sse2_in_range(c, '0', '9')) & 0xFFFF;
+        if (stop != 0)
+            return p + __builtin_ctz(stop);
+
+        p += 16;
+    }
+
+    return scalar_skip_digits(p, end);
+}
+
+static const char* sse2_find_newline(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+        uint32_t found = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        if (found != 0)
+            return p + __builtin_ctz(found);
+
+        p += 16;
+    }
+
+    return scalar_find_newline(p, end);
+}
+
+static const char* sse2_find_quote(const char* p, const char* end, int* line)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+        uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        uint32_t found = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('"')));
+        if (found != 0)
+        {
+            int n = __builtin_ctz(found);
+            *line += __builtin_popcount(newlines & ((1u << n) - 1));
+            return p + n;
+        }
+
+        *line += __builtin_popcount(newlines);
+        p += 16;
+    }
+
+    return scalar_find_quote(p, end, line);
+}
+
+// AVX2 versions of the same kernels, 32 bytes at a time. They are compiled
+// for AVX2 individually, so the rest of the program still runs on any x86-64.
+
+#define LOX_AVX2 __attribute__((target("avx2")))
+
+LOX_AVX2 static __m256i avx2_in_range(__m256i c, char low, char high)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(low - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), c));
+}
+
+LOX_AVX2 static const char* avx2_skip_whitespace(const char* p, const char* end, int* line)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i newline = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n'));
+        __m256i blank = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                                                        _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')), newline));
+
+        uint32_t newlines = _mm256_movemask_epi8(newline);
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(blank));
+        if (stop != 0)
+        {
+            int n = __builtin_ctz(stop);
+            *line += __builtin_popcount(newlines & ((1u << n) - 1));
+            return p + n;
+        }
+
+        *line += __builtin_popcount(newlines);
+        p += 32;
+    }
+
+    return sse2_skip_whitespace(p, end, line);
+}
+
+LOX_AVX2 static const char* avx2_skip_alnum(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i letter = avx2_in_range(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i alnum = _mm256_or_si256(letter, avx2_in_range(c, '0', '9'));
+
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(alnum));
+        if (stop != 0)
+            return p + __builtin_ctz(stop);
+
+        p += 32;
+    }
+
+    return sse2_skip_alnum(p, end);
+}
+
+LOX_AVX2 static const char* avx2_skip_digits(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(avx2_in_range(c, '0', '9')));
+        if (stop != 0)
+            return p + __builtin_ctz(stop);
+
+        p += 32;
+    }
+
+    return sse2_skip_digits(p, end);
+}
+
+LOX_AVX2 static const char* avx2_find_newline(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+        uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        if (found != 0)
+            return p + __builtin_ctz(found);
+
+        p += 32;
+    }
+
+    return sse2_find_newline(p, end);
+}
+
+LOX_AVX2 static const char* avx2_find_quote(const char* p, const char* end, int* line)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+        uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('"')));
+        if (found != 0)
+        {
+            int n = __builtin_ctz(found);
+            *line += __builtin_popcount(newlines & ((1u << n) - 1));
+            return p + n;
+        }
+
+        *line += __builtin_popcount(newlines);
+        p += 32;
+    }
+
+    return sse2_find_quote(p, end, line);
+}
+
+#undef LOX_AVX2
+
+#endif
+
+static ScanKernels select_kernels()
+{
+#ifdef LOX_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {avx2_skip_whitespace, avx2_skip_alnum, avx2_skip_digits, avx2_find_newline, avx2_find_quote};
+
+    return {sse2_skip_whitespace, sse2_skip_alnum, sse2_skip_digits, sse2_find_newline, sse2_find_quote};
+#else
+    return {scalar_skip_whitespace, scalar_skip_alnum, scalar_skip_digits, scalar_find_newline, scalar_find_quote};
+#endif
+}
+
+const ScanKernels& scan_kernels()
+{
+    static const ScanKernels kernels = select_kernels();
+    return kernels;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Scanning loops the lexer runs over long stretches of source. Each one
+// returns the first byte at or after begin that ends the run, or end when the
+// run reaches the end of the source. Kernels never read past end, so they
+// are safe on an mmapped file whose size is a multiple of the page size.
+struct ScanKernels
+{
+    // Spaces, tabs, carriage returns and newlines. Adds the newlines crossed to *line.
+    const char* (*skip_whitespace)(const char* begin, const char* end, int* line);
+    // [0-9A-Za-z], the characters that continue an identifier.
+    const char* (*skip_alnum)(const char* begin, const char* end);
+    // [0-9].
+    const char* (*skip_digits)(const char* begin, const char* end);
+    // Stops at the next '\n', which ends a // comment.
+    const char* (*find_newline)(const char* begin, const char* end);
+    // Stops at the next '"'. Adds the newlines crossed to *line.
+    const char* (*find_quote)(const char* begin, const char* end, int* line);
+};
+
+// The widest implementation the CPU supports: AVX2, then SSE2, then scalar.
+// Chosen once, on first use.
+const ScanKernels& scan_kernels();
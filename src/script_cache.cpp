@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+
+#include "script_cache.h"
+#include "tree_codec.h"
+
+// The file is the header, the tree_codec string table padded to a whole
+// word, the nodes' words, where each node starts in them, and last the
+// numbers of the top-level statements. A hash of all but the header
+// catches a damaged file before any of it is read.
+struct ScriptCache::Header
+{
+    char m_magic[4];
+    uint32_t m_format;
+    uint64_t m_interpreter_size;
+    uint64_t m_interpreter_time;
+    uint64_t m_source_hash;
+    uint64_t m_source_size;
+    int64_t m_options;
+    // Of everything after the header.
+    uint64_t m_payload_hash;
+    uint32_t m_string_bytes;
+    uint32_t m_node_count;
+    uint32_t m_word_count;
+    uint32_t m_statement_count;
+};
+
+static constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+ScriptCache::ScriptCache(std::string path, std::string_view source, int64_t options)
+    : m_path{std::move(path)}, m_source_hash{hash_text(source)}, m_source_size{source.size()}, m_options{options}
+{
+    if (!interpreter_stamp(m_interpreter_size, m_interpreter_time))
+        m_interpreter_size = 0;
+}
+
+bool ScriptCache::matches(const Header& header) const
+{
+    return std::memcmp(header.m_magic, MAGIC, sizeof MAGIC) == 0
+        && header.m_format == FORMAT
+        && header.m_interpreter_size == m_interpreter_size
+        && header.m_interpreter_time == m_interpreter_time
+        && header.m_source_hash == m_source_hash
+        && header.m_source_size == m_source_size
+        && header.m_options == m_options;
+}
+
+std::unique_ptr<Program> ScriptCache::load()
+{
+    if (m_interpreter_size == 0) return nullptr;
+
+    m_file = std::make_unique<SourceFile>(m_path);
+    std::string_view data = m_file->text();
+    Header header;
+    if (!m_file->is_open() || data.size() < sizeof header) return nullptr;
+
+    std::memcpy(&header, data.data(), sizeof header);
+    if (!matches(header)) return nullptr;
+
+    // The words start 4-aligned: the mapping is page aligned, the header
+    // a multiple of 8 long and the strings padded.
+    size_t strings_end = sizeof header + (header.m_string_bytes + 3) / 4 * 4;
+    size_t word_count = size_t(header.m_word_count) + header.m_node_count + header.m_statement_count;
+    if (data.size() != strings_end + word_count * 4) return nullptr;
+    if (hash_text(data.substr(sizeof header)) != header.m_payload_hash) return nullptr;
+
+    // Every node takes at least a word, which bounds what decoding reserves.
+    if (header.m_node_count > header.m_word_count) return nullptr;
+
+    auto program = std::make_unique<Program>();
+    auto words = reinterpret_cast<const uint32_t*>(data.data() + strings_end);
+    const uint32_t* offsets = words + header.m_word_count;
+    const uint32_t* statements = offsets + header.m_node_count;
+    TreeDecoder decoder{*program, data.substr(sizeof header, header.m_string_bytes), words, header.m_word_count,
+                        offsets, header.m_node_count, false};
+    try
+    {
+        for (uint32_t i = 0; i < header.m_statement_count; ++i)
+            program->m_statements.push_back(decoder.stmt(statements[i]));
+    }
+    catch (const TreeDecoder::Corrupt&)
+    {
+        return nullptr;
+    }
+
+    return program;
+}
+
+void ScriptCache::store(const Program& program)
+{
+    if (m_interpreter_size == 0) return;
+
+    TreeEncoder encoder;
+    std::vector<uint32_t> statements = encoder.encode(program.m_statements);
+    uint32_t word_count = uint32_t(encoder.m_words.size());
+    uint32_t node_count = uint32_t(encoder.m_offsets.size());
+    encoder.m_words.insert(encoder.m_words.end(), encoder.m_offsets.begin(), encoder.m_offsets.end());
+    encoder.m_words.insert(encoder.m_words.end(), statements.begin(), statements.end());
+    encoder.m_strings.resize((encoder.m_strings.size() + 3) / 4 * 4);
+
+    Header header{};
+    std::memcpy(header.m_magic, MAGIC, sizeof MAGIC);
+    header.m_format = FORMAT;
+    header.m_interpreter_size = m_interpreter_size;
+    header.m_interpreter_time = m_interpreter_time;
+    header.m_source_hash = m_source_hash;
+    header.m_source_size = m_source_size;
+    header.m_options = m_options;
+    header.m_payload_hash = hash_text(encoder.m_strings + std::string{reinterpret_cast<const char*>(encoder.m_words.data()),
+                                                                 encoder.m_words.size() * 4});
+    header.m_string_bytes = uint32_t(encoder.m_strings.size());
+    header.m_node_count = node_count;
+    header.m_word_count = word_count;
+    header.m_statement_count = uint32_t(statements.size());
+
+    // Written aside and renamed into place, so a run that reads the cache
+    // meanwhile sees the old file or the new one, never half of one.
+    std::string temporary = m_path + "." + std::to_string(getpid());
+    {
+        std::ofstream out{temporary, std::ios::binary};
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        out.write(encoder.m_strings.data(), encoder.m_strings.size());
+        out.write(reinterpret_cast<const char*>(encoder.m_words.data()), encoder.m_words.size() * 4);
+        if (!out)
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), m_path.c_str()) != 0)
+        std::remove(temporary.c_str());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "parser.h"
+#include "source_file.h"
+
+// The front end's output for one script, saved next to it as a .loxc file
+// so the next run can skip lexing, parsing, resolving and optimizing. lox
+// only uses it when run with --cache.
+//
+// The file holds the tree exactly as the passes left it, slots and flags
+// included, which is all any engine needs. It's keyed by a hash of the
+// source, the optimizer options and the lox executable itself, so editing
+// the script or rebuilding lox quietly invalidates it. Loading maps the
+// file and builds the nodes straight from the mapping; token lexemes keep
+// pointing into it, so the cache has to outlive the Program it loads.
+class ScriptCache
+{
+public:
+    // Bumped whenever the encoding changes.
+    static constexpr uint32_t FORMAT = 2;
+
+    // options tells apart trees the optimizer shaped differently.
+    ScriptCache(std::string path, std::string_view source, int64_t options);
+    ScriptCache(const ScriptCache&) = delete;
+    ScriptCache& operator=(const ScriptCache&) = delete;
+
+    // The cached program, or null if there is none for this source, lox
+    // and options, or it's damaged.
+    std::unique_ptr<Program> load();
+
+    // Saves program for later runs. A cache that can't be written is
+    // skipped without complaint.
+    void store(const Program& program);
+
+private:
+    struct Header;
+
+    std::string m_path;
+    uint64_t m_source_hash;
+    uint64_t m_source_size;
+    int64_t m_options;
+    uint64_t m_interpreter_size = 0;
+    uint64_t m_interpreter_time = 0;
+    std::unique_ptr<SourceFile> m_file;
+
+    bool matches(const Header& header) const;
+};
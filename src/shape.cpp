@@ -0,0 +1,46 @@
+#include "shape.h"
+#include "memory.h"
+
+// Keeps the names in the shape tree alive for as long as the tree is.
+class ShapeRoots : public RootSet
+{
+public:
+    Shape* const m_root;
+
+    ShapeRoots(Shape* root) : m_root{root} { heap().add_roots(this); }
+    ~ShapeRoots() { heap().remove_roots(this); }
+
+    void mark_roots(Heap& heap) override { m_root->mark_names(heap); }
+};
+
+Shape* Shape::root()
+{
+    static Shape root{nullptr, nullptr, -1};
+    static ShapeRoots roots{&root};
+    return &root;
+}
+
+int Shape::find(ObjString* name) const
+{
+    for (const Shape* shape = this; shape->m_name != nullptr; shape = shape->m_parent)
+        if (shape->m_name == name)
+            return shape->m_slot;
+
+    return -1;
+}
+
+Shape* Shape::add(ObjString* name)
+{
+    std::unique_ptr<Shape>& child = m_transitions[name];
+    if (child == nullptr)
+        child.reset(new Shape{this, name, field_count()});
+
+    return child.get();
+}
+
+void Shape::mark_names(Heap& heap) const
+{
+    heap.mark(m_name);
+    for (auto& transition : m_transitions)
+        transition.second->mark_names(heap);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+
+#include "object.h"
+
+// Hidden class of a LoxInstance. A shape records which field lives in which
+// slot of the instance's field array. Adding a field moves the instance
+// along a transition to a child shape, so instances that gain the same
+// fields in the same order share a shape.
+//
+// Shapes are never freed. Every instance starts from the one root shape,
+// and property names come from the source text, so the tree stays as small
+// as the set of field orders the program actually uses. The inline caches
+// in Get and Set can therefore hold plain Shape pointers.
+class Shape
+{
+private:
+    std::unordered_map<ObjString*, std::unique_ptr<Shape>> m_transitions;
+
+    Shape(const Shape* parent, ObjString* name, int slot)
+        : m_parent{parent}, m_name{name}, m_slot{slot} { }
+
+public:
+    const Shape* const m_parent;
+    // The field this shape added, stored at m_slot. Null for the root.
+    ObjString* const m_name;
+    const int m_slot;
+
+    static Shape* root();
+
+    int field_count() const { return m_slot + 1; }
+
+    // Slot of name, or -1 if instances of this shape don't have it.
+    int find(ObjString* name) const;
+    Shape* add(ObjString* name);
+
+    void mark_names(Heap& heap) const;
+};
+
+// Inline cache for one property access site. Each entry remembers where a
+// shape keeps the property; a Set entry that adds the field also records
+// the shape to move to. A site seeing one shape is monomorphic and hits on
+// the first compare. Up to ENTRIES shapes are cached, and past that the
+// site is megamorphic and every further shape goes through Shape::find().
+class PropertyCache
+{
+public:
+    static constexpr int ENTRIES = 4;
+
+    struct Entry
+    {
+        const Shape* m_shape = nullptr;
+        int m_slot = -1;
+        Shape* m_transition = nullptr;
+    };
+
+    int load(const Shape* shape, ObjString* name)
+    {
+        for (int i = 0; i < m_count; ++i)
+            if (m_entries[i].m_shape == shape)
+                return m_entries[i].m_slot;
+
+        Entry entry{shape, shape->find(name), nullptr};
+        remember(entry);
+        return entry.m_slot;
+    }
+
+    Entry store(Shape* shape, ObjString* name)
+    {
+        for (int i = 0; i < m_count; ++i)
+            if (m_entries[i].m_shape == shape)
+                return m_entries[i];
+
+        Entry entry{shape, shape->find(name), nullptr};
+        if (entry.m_slot < 0)
+        {
+            entry.m_transition = shape->add(name);
+            entry.m_slot = entry.m_transition->m_slot;
+        }
+
+        remember(entry);
+        return entry;
+    }
+
+private:
+    Entry m_entries[ENTRIES];
+    int m_count = 0;
+
+    void remember(const Entry& entry)
+    {
+        if (m_count < ENTRIES)
+            m_entries[m_count++] = entry;
+    }
+};
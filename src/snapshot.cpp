@@ -0,0 +1,654 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "tree_codec.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "lox_class.h"
+#include "lox_function.h"
+#include "lox_instance.h"
+
+// The file is the header, the tree_codec string table padded to a whole
+// word, the functions' declarations as tree_codec words with where each
+// node starts in them, and then two lists of words about the objects.
+//
+// The first creates them: a record per object, numbered from 2 in the
+// order they come, with 0 for none and 1 for the globals. Records only
+// refer to objects before them, so strings come first, then environments,
+// functions, classes with each superclass before its subclasses,
+// instances, and natives. The second fills in what may refer to anything:
+// each environment's enclosing one and its slots, each instance's fields
+// by slot, the globals, and last the globals the saved code assigns.
+struct Snapshot::Header
+{
+    char m_magic[4];
+    uint32_t m_format;
+    uint64_t m_interpreter_size;
+    uint64_t m_interpreter_time;
+    // Of everything after the header.
+    uint64_t m_payload_hash;
+    uint32_t m_string_bytes;
+    uint32_t m_word_count;
+    uint32_t m_node_count;
+    uint32_t m_object_count;
+    uint32_t m_object_words;
+    uint32_t m_content_words;
+};
+
+static constexpr char MAGIC[4] = {'L', 'O', 'X', 'S'};
+
+enum ObjectKind : uint32_t { OBJECT_STRING, OBJECT_ENVIRONMENT, OBJECT_FUNCTION, OBJECT_CLASS, OBJECT_INSTANCE, OBJECT_CLOCK };
+
+enum ValueTag : uint32_t { VALUE_NIL, VALUE_FALSE, VALUE_TRUE, VALUE_NUMBER, VALUE_OBJECT };
+
+class Snapshot::Writer
+{
+public:
+    struct Unsupported
+    {
+        std::string m_what;
+    };
+
+    TreeEncoder m_encoder;
+    std::vector<uint32_t> m_objects;
+    std::vector<uint32_t> m_contents;
+    uint32_t m_object_count = 0;
+
+    Writer(Environment* globals) : m_globals{globals} { }
+
+    void write()
+    {
+        for (auto& [name, global] : m_globals->m_values)
+            gather(global.m_value);
+
+        while (!m_pending.empty())
+        {
+            Obj* object = m_pending.back();
+            m_pending.pop_back();
+            classify(object);
+        }
+
+        // A class is created with its superclass, so the chain goes first.
+        auto chain = [](LoxClass* klass) {
+            int length = 0;
+            for (; klass != nullptr; klass = klass->superclass)
+                length++;
+
+            return length;
+        };
+        std::stable_sort(m_classes.begin(), m_classes.end(), [&](LoxClass* a, LoxClass* b) {
+            return chain(a) < chain(b);
+        });
+
+        number(m_strings);
+        number(m_environments);
+        number(m_functions);
+        number(m_classes);
+        number(m_instances);
+        number(m_clocks);
+        write_objects();
+        write_contents();
+    }
+
+private:
+    Environment* m_globals;
+    std::unordered_map<Obj*, uint32_t> m_ids;
+    std::vector<Obj*> m_pending;
+    std::vector<Obj*> m_strings;
+    std::vector<Obj*> m_environments;
+    std::vector<Obj*> m_functions;
+    std::vector<LoxClass*> m_classes;
+    std::vector<Obj*> m_instances;
+    std::vector<Obj*> m_clocks;
+
+    template <class T>
+    void number(const std::vector<T*>& objects)
+    {
+        for (T* object : objects)
+            m_ids[object] = 2 + m_object_count++;
+    }
+
+    void gather(Obj* object)
+    {
+        if (object == nullptr || object == m_globals) return;
+        if (m_ids.emplace(object, 0).second)
+            m_pending.push_back(object);
+    }
+
+    void gather(Value value)
+    {
+        if (value.is_obj()) gather(value.as_obj());
+    }
+
+    void classify(Obj* object)
+    {
+        switch (object->m_type)
+        {
+            case OBJ_STRING:
+                m_strings.push_back(object);
+                return;
+            case OBJ_ENVIRONMENT:
+            {
+                auto environment = static_cast<Environment*>(object);
+                m_environments.push_back(environment);
+                gather(environment->m_enclosing);
+                for (int i = 0; i < environment->m_slot_count; ++i)
+                    gather(environment->m_slots[i]);
+
+                return;
+            }
+            case OBJ_INSTANCE:
+            {
+                auto instance = static_cast<LoxInstance*>(object);
+                m_instances.push_back(instance);
+                gather(instance->klass);
+                for (const Shape* shape = instance->shape; shape->m_name != nullptr; shape = shape->m_parent)
+                    gather(shape->m_name);
+
+                for (Value field : instance->fields)
+                    gather(field);
+
+                return;
+            }
+            case OBJ_CALLABLE:
+            {
+                auto callable = static_cast<LoxCallable*>(object);
+                if (auto function = dynamic_cast<LoxFunction*>(callable))
+                {
+                    m_functions.push_back(function);
+                    gather(function->closure);
+                    return;
+                }
+
+                if (auto klass = dynamic_cast<LoxClass*>(callable))
+                {
+                    m_classes.push_back(klass);
+                    gather(klass->superclass);
+                    for (auto& [name, method] : klass->methods)
+                    {
+                        gather(name);
+                        gather(method);
+                    }
+
+                    return;
+                }
+
+                if (dynamic_cast<NativeClock*>(callable))
+                {
+                    m_clocks.push_back(callable);
+                    return;
+                }
+
+                throw Unsupported{callable->to_string()};
+            }
+            default:
+                // The VM's objects live in its own globals, which are never saved.
+                throw Unsupported{"a bytecode object"};
+        }
+    }
+
+    uint32_t id(Obj* object) const
+    {
+        if (object == nullptr) return 0;
+        if (object == m_globals) return 1;
+        return m_ids.at(object);
+    }
+
+    void text(std::vector<uint32_t>& words, std::string_view text)
+    {
+        words.push_back(m_encoder.text_offset(text));
+        words.push_back(uint32_t(text.size()));
+    }
+
+    void value(Value value)
+    {
+        if (value.is_nil())
+            m_contents.push_back(VALUE_NIL);
+        else if (value.is_bool())
+            m_contents.push_back(value.as_bool() ? VALUE_TRUE : VALUE_FALSE);
+        else if (value.is_number())
+        {
+            uint64_t bits;
+            double number = value.as_number();
+            std::memcpy(&bits, &number, sizeof bits);
+            m_contents.insert(m_contents.end(), {VALUE_NUMBER, uint32_t(bits), uint32_t(bits >> 32)});
+        }
+        else
+            m_contents.insert(m_contents.end(), {VALUE_OBJECT, id(value.as_obj())});
+    }
+
+    void write_objects()
+    {
+        for (Obj* object : m_strings)
+        {
+            m_objects.push_back(OBJECT_STRING);
+            text(m_objects, static_cast<ObjString*>(object)->m_chars);
+        }
+
+        for (Obj* object : m_environments)
+            m_objects.insert(m_objects.end(), {OBJECT_ENVIRONMENT, uint32_t(static_cast<Environment*>(object)->m_slot_count)});
+
+        for (Obj* object : m_functions)
+        {
+            auto function = static_cast<LoxFunction*>(object);
+            uint32_t declaration = m_encoder.encode(function->declaration);
+            m_objects.insert(m_objects.end(), {OBJECT_FUNCTION, declaration, id(function->closure), function->is_initializer});
+        }
+
+        for (LoxClass* klass : m_classes)
+        {
+            m_objects.push_back(OBJECT_CLASS);
+            text(m_objects, klass->name);
+            m_objects.insert(m_objects.end(), {id(klass->superclass), uint32_t(klass->methods.size())});
+            for (auto& [name, method] : klass->methods)
+                m_objects.insert(m_objects.end(), {id(name), id(method)});
+        }
+
+        for (Obj* object : m_instances)
+            m_objects.insert(m_objects.end(), {OBJECT_INSTANCE, id(static_cast<LoxInstance*>(object)->klass)});
+
+        for (size_t i = 0; i < m_clocks.size(); ++i)
+            m_objects.push_back(OBJECT_CLOCK);
+    }
+
+    void write_contents()
+    {
+        for (Obj* object : m_environments)
+        {
+            auto environment = static_cast<Environment*>(object);
+            m_contents.push_back(id(environment->m_enclosing));
+            for (int i = 0; i < environment->m_slot_count; ++i)
+                value(environment->m_slots[i]);
+        }
+
+        for (Obj* object : m_instances)
+        {
+            auto instance = static_cast<LoxInstance*>(object);
+            std::vector<ObjString*> names(instance->fields.size());
+            for (const Shape* shape = instance->shape; shape->m_name != nullptr; shape = shape->m_parent)
+                names[shape->m_slot] = shape->m_name;
+
+            m_contents.push_back(uint32_t(names.size()));
+            for (size_t i = 0; i < names.size(); ++i)
+            {
+                m_contents.push_back(id(names[i]));
+                value(instance->fields[i]);
+            }
+        }
+
+        m_contents.push_back(uint32_t(m_globals->m_values.size()));
+        for (auto& [name, global] : m_globals->m_values)
+        {
+            text(m_contents, name);
+            value(global.m_value);
+        }
+
+        std::vector<std::string_view>& assigned = m_encoder.m_assigned_globals;
+        std::sort(assigned.begin(), assigned.end());
+        assigned.erase(std::unique(assigned.begin(), assigned.end()), assigned.end());
+        m_contents.push_back(uint32_t(assigned.size()));
+        for (std::string_view name : assigned)
+            text(m_contents, name);
+    }
+};
+
+// Reads the object lists back. Like TreeDecoder, every read is checked.
+class Snapshot::Restorer
+{
+public:
+    struct Corrupt { };
+
+    Restorer(Snapshot& snapshot, Environment* globals, const uint32_t* objects, const uint32_t* contents,
+             size_t content_words)
+        : m_snapshot{snapshot}, m_globals{globals}, m_cursor{objects}, m_end{contents},
+          m_contents{contents}, m_contents_end{contents + content_words} { }
+
+    void restore(uint32_t object_count)
+    {
+        m_objects.reserve(object_count + 2);
+        m_objects.push_back(nullptr);
+        m_objects.push_back(m_globals);
+        for (uint32_t i = 0; i < object_count; ++i)
+            create();
+
+        if (m_cursor != m_end) throw Corrupt{};
+
+        m_cursor = m_contents;
+        m_end = m_contents_end;
+        fill();
+        if (m_cursor != m_end) throw Corrupt{};
+    }
+
+private:
+    Snapshot& m_snapshot;
+    Environment* m_globals;
+    const uint32_t* m_cursor;
+    const uint32_t* m_end;
+    const uint32_t* m_contents;
+    const uint32_t* m_contents_end;
+    std::vector<Obj*> m_objects;
+    std::vector<Environment*> m_environments;
+    std::vector<LoxInstance*> m_instances;
+
+    uint32_t word()
+    {
+        if (m_cursor == m_end) throw Corrupt{};
+        return *m_cursor++;
+    }
+
+    size_t count()
+    {
+        uint32_t count = word();
+        if (count > static_cast<size_t>(m_end - m_cursor)) throw Corrupt{};
+        return count;
+    }
+
+    std::string_view text()
+    {
+        uint32_t offset = word();
+        return m_snapshot.m_decoder->text(offset, word());
+    }
+
+    Obj* object(ObjType type)
+    {
+        uint32_t id = word();
+        if (id >= m_objects.size() || m_objects[id] == nullptr || m_objects[id]->m_type != type) throw Corrupt{};
+        return m_objects[id];
+    }
+
+    // A callable of class T, or null for id 0.
+    template <class T>
+    T* callable()
+    {
+        if (m_cursor != m_end && *m_cursor == 0)
+        {
+            m_cursor++;
+            return nullptr;
+        }
+
+        auto callable = dynamic_cast<T*>(static_cast<LoxCallable*>(object(OBJ_CALLABLE)));
+        if (callable == nullptr) throw Corrupt{};
+        return callable;
+    }
+
+    Environment* environment()
+    {
+        if (m_cursor != m_end && *m_cursor == 0)
+        {
+            m_cursor++;
+            return nullptr;
+        }
+
+        return static_cast<Environment*>(object(OBJ_ENVIRONMENT));
+    }
+
+    ObjString* string() { return static_cast<ObjString*>(object(OBJ_STRING)); }
+
+    Value value()
+    {
+        switch (word())
+        {
+            case VALUE_NIL: return nullptr;
+            case VALUE_FALSE: return false;
+            case VALUE_TRUE: return true;
+            case VALUE_NUMBER:
+            {
+                uint64_t bits = word();
+                bits |= uint64_t(word()) << 32;
+                double number;
+                std::memcpy(&number, &bits, sizeof number);
+                return number;
+            }
+            case VALUE_OBJECT:
+            {
+                uint32_t id = word();
+                if (id == 0 || id >= m_objects.size()) throw Corrupt{};
+                return m_objects[id];
+            }
+            default:
+                throw Corrupt{};
+        }
+    }
+
+    void create()
+    {
+        switch (word())
+        {
+            case OBJECT_STRING:
+                m_objects.push_back(heap().intern(text()));
+                break;
+            case OBJECT_ENVIRONMENT:
+            {
+                // Each slot takes at least a word of the contents.
+                uint32_t slot_count = word();
+                if (slot_count > static_cast<size_t>(m_contents_end - m_contents)) throw Corrupt{};
+
+                auto environment = heap().allocate<Environment>(nullptr, int(slot_count));
+                m_environments.push_back(environment);
+                m_objects.push_back(environment);
+                break;
+            }
+            case OBJECT_FUNCTION:
+            {
+                auto declaration = dynamic_cast<Function*>(m_snapshot.m_decoder->stmt(word()));
+                if (declaration == nullptr) throw Corrupt{};
+
+                Environment* closure = environment();
+                if (closure == nullptr) throw Corrupt{};
+
+                bool is_initializer = word() != 0;
+                m_snapshot.m_functions.push_back(declaration);
+                m_objects.push_back(heap().allocate<LoxFunction>(declaration, closure, is_initializer));
+                break;
+            }
+            case OBJECT_CLASS:
+            {
+                std::string_view name = text();
+                LoxClass* superclass = callable<LoxClass>();
+                std::unordered_map<ObjString*, LoxFunction*> methods;
+                for (size_t i = count(); i > 0; --i)
+                {
+                    ObjString* method = string();
+                    LoxFunction* function = callable<LoxFunction>();
+                    if (function == nullptr) throw Corrupt{};
+                    methods[method] = function;
+                }
+
+                m_objects.push_back(heap().allocate<LoxClass>(name, superclass, std::move(methods)));
+                break;
+            }
+            case OBJECT_INSTANCE:
+            {
+                auto klass = callable<LoxClass>();
+                if (klass == nullptr) throw Corrupt{};
+
+                auto instance = heap().allocate<LoxInstance>(klass);
+                m_instances.push_back(instance);
+                m_objects.push_back(instance);
+                break;
+            }
+            case OBJECT_CLOCK:
+                m_objects.push_back(heap().allocate<NativeClock>());
+                break;
+            default:
+                throw Corrupt{};
+        }
+    }
+
+    void fill()
+    {
+        for (Environment* environment : m_environments)
+        {
+            environment->m_enclosing = this->environment();
+            for (int i = 0; i < environment->m_slot_count; ++i)
+                environment->m_slots[i] = value();
+
+            heap().write_barrier(environment);
+        }
+
+        for (LoxInstance* instance : m_instances)
+        {
+            for (size_t i = count(); i > 0; --i)
+            {
+                instance->shape = instance->shape->add(string());
+                instance->fields.push_back(value());
+            }
+
+            heap().write_barrier(instance);
+        }
+
+        size_t globals = count();
+        m_globals->m_values.reserve(m_globals->m_values.size() + globals);
+        for (size_t i = globals; i > 0; --i)
+        {
+            std::string_view name = text();
+            m_globals->define(name, value());
+            m_snapshot.m_defined_globals.push_back(name);
+        }
+
+        for (size_t i = count(); i > 0; --i)
+            m_snapshot.m_assigned_globals.push_back(text());
+    }
+};
+
+Snapshot::~Snapshot() = default;
+
+static std::unique_ptr<Snapshot> damaged(const std::string& path)
+{
+    std::cerr << "Snapshot \"" << path << "\" is damaged.\n";
+    return nullptr;
+}
+
+bool Snapshot::save(const std::string& path, Environment* globals)
+{
+    Header header{};
+    if (!interpreter_stamp(header.m_interpreter_size, header.m_interpreter_time))
+    {
+        std::cerr << "Can't identify the running lox to stamp a snapshot with.\n";
+        return false;
+    }
+
+    Writer writer{globals};
+    try
+    {
+        writer.write();
+    }
+    catch (const Writer::Unsupported& unsupported)
+    {
+        std::cerr << "Can't save " << unsupported.m_what << " in a snapshot.\n";
+        return false;
+    }
+
+    TreeEncoder& encoder = writer.m_encoder;
+    std::string payload = std::move(encoder.m_strings);
+    payload.resize((payload.size() + 3) / 4 * 4);
+    header.m_string_bytes = uint32_t(payload.size());
+    header.m_word_count = uint32_t(encoder.m_words.size());
+    header.m_node_count = uint32_t(encoder.m_offsets.size());
+    header.m_object_count = writer.m_object_count;
+    header.m_object_words = uint32_t(writer.m_objects.size());
+    header.m_content_words = uint32_t(writer.m_contents.size());
+    for (auto* words : {&encoder.m_words, &encoder.m_offsets, &writer.m_objects, &writer.m_contents})
+        payload.append(reinterpret_cast<const char*>(words->data()), words->size() * 4);
+
+    std::memcpy(header.m_magic, MAGIC, sizeof MAGIC);
+    header.m_format = FORMAT;
+    header.m_payload_hash = hash_text(payload);
+
+    // Written aside and renamed into place, as ScriptCache does.
+    std::string temporary = path + "." + std::to_string(getpid());
+    {
+        std::ofstream out{temporary, std::ios::binary};
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        out.write(payload.data(), payload.size());
+        if (!out)
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            std::cerr << "Could not write snapshot \"" << path << "\".\n";
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        std::cerr << "Could not write snapshot \"" << path << "\".\n";
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<Snapshot> Snapshot::load(const std::string& path, Environment* globals)
+{
+    std::unique_ptr<Snapshot> snapshot{new Snapshot};
+    snapshot->m_file = std::make_unique<SourceFile>(path);
+    std::string_view data = snapshot->m_file->text();
+    if (!snapshot->m_file->is_open())
+    {
+        std::cerr << "Could not open snapshot \"" << path << "\".\n";
+        return nullptr;
+    }
+
+    Header header;
+    uint64_t interpreter_size, interpreter_time;
+    if (data.size() < sizeof header) return damaged(path);
+
+    std::memcpy(&header, data.data(), sizeof header);
+    if (std::memcmp(header.m_magic, MAGIC, sizeof MAGIC) != 0 || header.m_format != FORMAT) return damaged(path);
+
+    if (!interpreter_stamp(interpreter_size, interpreter_time)
+        || header.m_interpreter_size != interpreter_size || header.m_interpreter_time != interpreter_time)
+    {
+        std::cerr << "Snapshot \"" << path << "\" was saved by another build of lox.\n";
+        return nullptr;
+    }
+
+    // The words start 4-aligned, as in a ScriptCache.
+    size_t strings_end = sizeof header + header.m_string_bytes;
+    size_t word_count = size_t(header.m_word_count) + header.m_node_count + header.m_object_words
+                      + header.m_content_words;
+    if (header.m_string_bytes % 4 != 0 || data.size() != strings_end + word_count * 4) return damaged(path);
+    if (hash_text(data.substr(sizeof header)) != header.m_payload_hash) return damaged(path);
+
+    // Every node and object takes at least a word, which bounds what
+    // restoring reserves.
+    if (header.m_node_count > header.m_word_count || header.m_object_count > header.m_object_words)
+        return damaged(path);
+
+    auto words = reinterpret_cast<const uint32_t*>(data.data() + strings_end);
+    const uint32_t* offsets = words + header.m_word_count;
+    const uint32_t* objects = offsets + header.m_node_count;
+    const uint32_t* contents = objects + header.m_object_words;
+    snapshot->m_decoder = std::make_unique<TreeDecoder>(snapshot->m_program,
+                                                        data.substr(sizeof header, header.m_string_bytes), words,
+                                                        header.m_word_count, offsets, header.m_node_count, true);
+    try
+    {
+        Restorer{*snapshot, globals, objects, contents, header.m_content_words}.restore(header.m_object_count);
+    }
+    catch (const Restorer::Corrupt&)
+    {
+        return damaged(path);
+    }
+    catch (const TreeDecoder::Corrupt&)
+    {
+        return damaged(path);
+    }
+
+    return snapshot;
+}
+
+void Snapshot::rebound()
+{
+    for (Function* function : m_functions)
+        function->m_stable = function->m_pure = false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.h"
+#include "source_file.h"
+
+class Environment;
+class TreeDecoder;
+
+// The global environment of a finished run, saved so a later run can start
+// from it instead of running the same prelude again:
+//
+//     lox --save-snapshot=prelude.snap prelude
+//     lox --snapshot=prelude.snap script
+//
+// Everything the globals reach is saved: closures and their environments,
+// classes, instances and strings, along with the resolved declarations of
+// every function among them. Restoring allocates the objects straight from
+// the mapped file and wires them up in a few passes over it. A function's
+// body stays encoded until the function first runs, so restoring costs the
+// objects, not the code.
+//
+// The file is tied to the lox build that wrote it, like a ScriptCache.
+class Snapshot
+{
+public:
+    // Bumped whenever the encoding changes.
+    static constexpr uint32_t FORMAT = 1;
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot();
+
+    // Saves what globals reaches to path. False, with a message on stderr,
+    // if it reaches something a snapshot can't hold or the file can't be
+    // written.
+    static bool save(const std::string& path, Environment* globals);
+
+    // Restores the snapshot at path into globals, or returns null, with a
+    // message on stderr, if the file is missing, damaged or from another
+    // build. The snapshot holds the restored functions' code, so it has to
+    // outlive them.
+    static std::unique_ptr<Snapshot> load(const std::string& path, Environment* globals);
+
+    // Globals the snapshot defines, and those its code assigns, which
+    // Resolver has to treat as assigned in a program run on top of it.
+    const std::vector<std::string_view>& defined_globals() const { return m_defined_globals; }
+    const std::vector<std::string_view>& assigned_globals() const { return m_assigned_globals; }
+
+    // Called when the program run on top declares or assigns one of the
+    // snapshot's globals. What Resolver proved about the snapshot's
+    // functions assumed nothing else would, so none of them count as
+    // stable or pure any more.
+    void rebound();
+
+private:
+    struct Header;
+    class Writer;
+    class Restorer;
+
+    std::unique_ptr<SourceFile> m_file;
+    Program m_program;
+    std::unique_ptr<TreeDecoder> m_decoder;
+    std::vector<Function*> m_functions;
+    std::vector<std::string_view> m_defined_globals;
+    std::vector<std::string_view> m_assigned_globals;
+
+    Snapshot() = default;
+};
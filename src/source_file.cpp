@@ -0,0 +1,40 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source_file.h"
+
+SourceFile::SourceFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0)
+    {
+        m_size = info.st_size;
+
+        // An empty file cannot be mapped, but it is still a valid script.
+        if (m_size == 0)
+            m_open = true;
+        else
+        {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                madvise(data, m_size, MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(data);
+                m_open = true;
+            }
+        }
+    }
+
+    close(fd);
+}
+
+SourceFile::~SourceFile()
+{
+    if (m_data != nullptr)
+        munmap(const_cast<char*>(m_data), m_size);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A script mapped read-only into memory. Tokens and the AST point straight
+// into the mapping, so it has to outlive every Program parsed from it.
+class SourceFile
+{
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+
+public:
+    SourceFile(const std::string& path);
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+    ~SourceFile();
+
+    bool is_open() const { return m_open; }
+    std::string_view text() const { return {m_data, m_size}; }
+};
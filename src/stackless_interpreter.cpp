@@ -0,0 +1,645 @@
+#include <algorithm>
+
+#include "stackless_interpreter.h"
+#include "environment.h"
+#include "lox_class.h"
+#include "lox_function.h"
+#include "lox_instance.h"
+#include "memory.h"
+#include "runtime_error.h"
+
+void runtime_error(RuntimeError error);
+
+void StacklessInterpreter::mark_roots(Heap& heap)
+{
+    Interpreter::mark_roots(heap);
+
+    for (Value value : m_values)
+        heap.mark(value);
+
+    for (size_t i = 0; i < m_pool_used; ++i)
+        heap.mark(m_frame_pool[i].m_enclosing);
+
+    for (const Continuation& continuation : m_work)
+        if (continuation.m_kind == K_BLOCK_EXIT || continuation.m_kind == K_CALL_FRAME)
+            heap.mark(continuation.m_environment);
+
+    for (const PendingMemo& memo : m_memos)
+    {
+        heap.mark(memo.m_function);
+        for (Value argument : memo.m_key)
+            heap.mark(argument);
+    }
+}
+
+// Grows the value stack ahead of count more values, moving the slots of
+// any pooled frames along with it.
+void StacklessInterpreter::reserve_values(size_t count)
+{
+    if (m_values.size() + count <= m_values.capacity()) return;
+
+    const Value* previous = m_values.data();
+    m_values.reserve(std::max(m_values.capacity() * 2, m_values.size() + count));
+
+    for (size_t i = 0; i < m_pool_used; ++i)
+        m_frame_pool[i].move_frame(previous, m_values.data());
+}
+
+void StacklessInterpreter::interpret(const std::vector<Stmt*>& statements)
+{
+    try
+    {
+        push_sequence(statements);
+        run();
+    }
+    catch(const RuntimeError& error)
+    {
+        runtime_error(error);
+        m_work.clear();
+        m_values.clear();
+        m_memos.clear();
+        m_pool_used = 0;
+        m_call_depth = 0;
+        m_environment = m_globals;
+    }
+}
+
+void StacklessInterpreter::run()
+{
+    while (!m_work.empty())
+    {
+        Continuation& continuation = m_work.back();
+        switch (continuation.m_kind)
+        {
+            case K_UNARY:
+            {
+                Unary* expr = static_cast<Unary*>(continuation.m_expr);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(expr->m_right);
+                    break;
+                }
+
+                m_work.pop_back();
+                m_values.back() = unary(expr, m_values.back());
+                break;
+            }
+
+            case K_BINARY:
+            {
+                Binary* expr = static_cast<Binary*>(continuation.m_expr);
+                switch (continuation.m_step++)
+                {
+                    case 0: schedule(expr->m_left); break;
+                    case 1: schedule(expr->m_right); break;
+                    default:
+                    {
+                        m_work.pop_back();
+                        Value right = pop_value();
+                        m_values.back() = binary(expr, m_values.back(), right);
+                    }
+                }
+                break;
+            }
+
+            case K_LOGICAL:
+            {
+                Logical* expr = static_cast<Logical*>(continuation.m_expr);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(expr->m_left);
+                    break;
+                }
+
+                m_work.pop_back();
+                if (short_circuits(expr, m_values.back()))
+                    break;
+
+                m_values.pop_back();
+                schedule(expr->m_right);
+                break;
+            }
+
+            case K_ASSIGN:
+            {
+                Assign* expr = static_cast<Assign*>(continuation.m_expr);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(expr->m_value);
+                    break;
+                }
+
+                m_work.pop_back();
+                if (expr->m_depth < 0)
+                    m_globals->assign(expr->m_name, m_values.back());
+                else
+                    m_environment->assign_at(expr->m_depth, expr->m_slot, m_values.back());
+                break;
+            }
+
+            case K_GET:
+            {
+                Get* expr = static_cast<Get*>(continuation.m_expr);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(expr->m_object);
+                    break;
+                }
+
+                m_work.pop_back();
+                m_values.back() = get_property(expr, m_values.back());
+                break;
+            }
+
+            case K_SET:
+            {
+                Set* expr = static_cast<Set*>(continuation.m_expr);
+                switch (continuation.m_step++)
+                {
+                    case 0:
+                        schedule(expr->m_object);
+                        break;
+                    case 1:
+                        if (!is_obj_type(m_values.back(), OBJ_INSTANCE))
+                            throw RuntimeError(expr->m_name, "Only instances have fields.");
+
+                        schedule(expr->m_value);
+                        break;
+                    default:
+                    {
+                        m_work.pop_back();
+                        Value value = pop_value();
+                        m_values.back() = set_property(expr, m_values.back(), value);
+                    }
+                }
+                break;
+            }
+
+            case K_CALL:
+            case K_TAIL_CALL:
+                step_call(continuation);
+                break;
+
+            case K_EXPRESSION:
+            case K_PRINT:
+            {
+                Expr* expr = continuation.m_kind == K_PRINT
+                    ? static_cast<Print*>(continuation.m_stmt)->m_expression
+                    : static_cast<Expression*>(continuation.m_stmt)->m_expression;
+
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(expr);
+                    break;
+                }
+
+                if (continuation.m_kind == K_PRINT)
+                    std::cout << stringify(m_values.back()) << "\n";
+
+                m_work.pop_back();
+                m_values.pop_back();
+                break;
+            }
+
+            case K_VAR:
+            {
+                Var* stmt = static_cast<Var*>(continuation.m_stmt);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(stmt->m_initializer);
+                    break;
+                }
+
+                m_work.pop_back();
+                Value value = pop_value();
+                if (stmt->m_slot < 0)
+                    m_globals->define(stmt->m_name.m_lexeme, value);
+                else
+                    m_environment->define(stmt->m_slot, value);
+                break;
+            }
+
+            case K_IF:
+            {
+                If* stmt = static_cast<If*>(continuation.m_stmt);
+                if (continuation.m_step++ == 0)
+                {
+                    schedule(stmt->m_condition);
+                    break;
+                }
+
+                m_work.pop_back();
+                Stmt* branch = is_truthy(pop_value()) ? stmt->m_thenBranch : stmt->m_elseBranch;
+                if (branch != nullptr)
+                    schedule(branch);
+                break;
+            }
+
+            case K_WHILE:
+            {
+                While* stmt = static_cast<While*>(continuation.m_stmt);
+                if (continuation.m_step == 0)
+                {
+                    // Native code runs the rest of the loop, unless it bails.
+                    Value value;
+                    Tiering::LoopResult tier = m_tiering.loop(stmt, m_environment, m_max_depth - m_call_depth, value);
+                    if (tier == Tiering::LOOP_DONE)
+                    {
+                        m_work.pop_back();
+                        break;
+                    }
+
+                    if (tier == Tiering::LOOP_RETURNED)
+                    {
+                        return_value(value);
+                        break;
+                    }
+
+                    continuation.m_step = 1;
+                    schedule(stmt->m_condition);
+                    break;
+                }
+
+                if (!is_truthy(pop_value()))
+                {
+                    m_work.pop_back();
+                    break;
+                }
+
+                continuation.m_step = 0;
+                schedule(stmt->m_body);
+                break;
+            }
+
+            case K_RETURN:
+            {
+                Return* stmt = static_cast<Return*>(continuation.m_stmt);
+                if (continuation.m_step++ == 0)
+                {
+                    if (stmt->m_value == nullptr)
+                        return_value(nullptr);
+                    else if (stmt->m_tail_call)
+                        push_work(K_TAIL_CALL, stmt->m_value);
+                    else
+                        schedule(stmt->m_value);
+                    break;
+                }
+
+                return_value(pop_value());
+                break;
+            }
+
+            case K_SEQUENCE:
+            {
+                const std::vector<Stmt*>& statements = *continuation.m_statements;
+                if (continuation.m_step == statements.size())
+                {
+                    m_work.pop_back();
+                    break;
+                }
+
+                schedule(statements[continuation.m_step++]);
+                break;
+            }
+
+            case K_BLOCK_EXIT:
+                m_environment = continuation.m_environment;
+                m_work.pop_back();
+                break;
+
+            // Reached when a body runs off its end without a return.
+            case K_CALL_FRAME:
+                complete_call(nullptr);
+                break;
+        }
+    }
+}
+
+void StacklessInterpreter::step_call(Continuation& continuation)
+{
+    Call* expr = static_cast<Call*>(continuation.m_expr);
+    size_t step = continuation.m_step++;
+
+    if (step == 0)
+    {
+        schedule(expr->m_calee);
+        return;
+    }
+
+    if (step <= expr->m_arguments.size())
+    {
+        schedule(expr->m_arguments[step - 1]);
+        return;
+    }
+
+    bool tail = continuation.m_kind == K_TAIL_CALL;
+    m_work.pop_back();
+
+    int arg_count = expr->m_arguments.size();
+    size_t base = m_values.size() - 1 - arg_count;
+    LoxCallable* function = check_call(expr, m_values[base], arg_count);
+    call(expr, function, base, tail);
+}
+
+// The callee is at base on the value stack, with its arguments above it.
+void StacklessInterpreter::call(Call* expr, LoxCallable* function, size_t base, bool tail)
+{
+    if (auto target = dynamic_cast<LoxFunction*>(function))
+    {
+        if (tail)
+        {
+            tail_call(target, base);
+            return;
+        }
+
+        if (m_call_depth >= m_max_depth)
+            throw RuntimeError{expr->m_paren, "Stack overflow."};
+
+        enter(target, base, false);
+        return;
+    }
+
+    if (auto klass = dynamic_cast<LoxClass*>(function))
+    {
+        LoxFunction* initializer = klass->find_method(heap().intern("init"));
+        if (initializer == nullptr)
+        {
+            m_values.resize(base);
+            push_value(heap().allocate<LoxInstance>(klass));
+            return;
+        }
+
+        if (m_call_depth >= m_max_depth)
+            throw RuntimeError{expr->m_paren, "Stack overflow."};
+
+        // The bound initializer takes the class's place as the callee, and
+        // its environment keeps the instance alive.
+        m_values[base] = initializer->bind(heap().allocate<LoxInstance>(klass));
+        enter(static_cast<LoxFunction*>(m_values[base].as_obj()), base, false);
+        return;
+    }
+
+    Value result = function->call(*this, m_values.data() + base + 1);
+    m_values.resize(base);
+    push_value(result);
+}
+
+// Starts running function's body, as LoxFunction::call does but pushing a
+// call frame instead of recursing.
+void StacklessInterpreter::enter(LoxFunction* function, size_t base, bool tail)
+{
+    Function* declaration = function->declaration;
+    Value* arguments = m_values.data() + base + 1;
+
+    if (!tail && declaration->m_pure && m_memoize)
+    {
+        if (function->memo == nullptr)
+            function->memo = std::make_unique<MemoTable>();
+
+        MemoTable::Key key(arguments, arguments + declaration->m_params.size());
+        if (const Value* cached = function->memo->find(key))
+        {
+            m_memo_stats.m_hits++;
+            Value result = *cached;
+            m_values.resize(base);
+            push_value(result);
+            return;
+        }
+
+        m_memo_stats.m_misses++;
+        m_memos.push_back(PendingMemo{m_work.size(), function, std::move(key)});
+    }
+
+    // Compiled code runs the whole call at once. This call isn't counted in
+    // the depth yet, so nested calls may add up to the difference.
+    Value result;
+    if (!tail && m_tiering.call(function, arguments, m_max_depth - m_call_depth, result))
+    {
+        store_memo(result);
+        m_values.resize(base);
+        push_value(result);
+        return;
+    }
+
+    Environment* environment;
+    if (declaration->m_captures)
+    {
+        environment = heap().allocate<Environment>(function->closure, declaration->m_slot_count);
+        for (size_t i = 0; i < declaration->m_params.size(); ++i)
+            environment->define(i, arguments[i]);
+    }
+    else
+    {
+        reserve_values(base + 1 + declaration->m_slot_count - m_values.size());
+        m_values.resize(base + 1 + declaration->m_slot_count);
+
+        if (m_pool_used == m_frame_pool.size())
+            m_frame_pool.emplace_back();
+
+        environment = &m_frame_pool[m_pool_used++];
+        environment->bind_frame(function->closure, m_values.data() + base + 1, declaration->m_slot_count);
+    }
+
+    if (!tail)
+        m_call_depth++;
+
+    push_restore(K_CALL_FRAME, base, m_environment);
+    m_environment = environment;
+    push_sequence(declaration->body());
+}
+
+// Replaces the returning function's frame with function's, so tail calls
+// take no more stack of either kind. Like LoxFunction::call, only the
+// original call is memoized.
+void StacklessInterpreter::tail_call(LoxFunction* function, size_t callee)
+{
+    size_t frame = m_work.size() - 1;
+    while (m_work[frame].m_kind != K_CALL_FRAME)
+        --frame;
+
+    Continuation returning = m_work[frame];
+    size_t base = returning.m_step;
+
+    LoxFunction* current = static_cast<LoxFunction*>(m_values[base].as_obj());
+    if (!current->declaration->m_captures)
+        m_pool_used--;
+
+    std::copy(m_values.begin() + callee, m_values.end(), m_values.begin() + base);
+    m_values.resize(base + (m_values.size() - callee));
+
+    m_work.resize(frame);
+    m_environment = returning.m_environment;
+    enter(function, base, true);
+}
+
+void StacklessInterpreter::return_value(Value value)
+{
+    while (m_work.back().m_kind != K_CALL_FRAME)
+        m_work.pop_back();
+
+    complete_call(value);
+}
+
+// Pops the call frame on top of m_work, leaving value in place of the
+// callee and its arguments.
+void StacklessInterpreter::complete_call(Value value)
+{
+    Continuation frame = m_work.back();
+    m_work.pop_back();
+
+    size_t base = frame.m_step;
+    LoxFunction* function = static_cast<LoxFunction*>(m_values[base].as_obj());
+    if (function->is_initializer)
+        value = function->closure->get_at(0, 0);
+
+    if (!function->declaration->m_captures)
+        m_pool_used--;
+
+    m_environment = frame.m_environment;
+    m_values.resize(base);
+    m_values.push_back(value);
+    m_call_depth--;
+    store_memo(value);
+}
+
+// Stores the result of a call that returns to m_work's current size, if it
+// was memoized.
+void StacklessInterpreter::store_memo(Value value)
+{
+    if (m_memos.empty() || m_memos.back().m_frame != m_work.size())
+        return;
+
+    PendingMemo& memo = m_memos.back();
+    if (memo.m_function->memo->insert(std::move(memo.m_key), value))
+        m_memo_stats.m_evictions++;
+
+    heap().write_barrier(memo.m_function);
+    m_memos.pop_back();
+}
+
+Value StacklessInterpreter::Scheduler::visit_assign(Assign* expr)
+{
+    m_engine.push_work(K_ASSIGN, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_binary(Binary* expr)
+{
+    m_engine.push_work(K_BINARY, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_call(Call* expr)
+{
+    m_engine.push_work(K_CALL, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_get(Get* expr)
+{
+    m_engine.push_work(K_GET, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_grouping(Grouping* expr)
+{
+    m_engine.schedule(expr->m_expression);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_literal(Literal* expr)
+{
+    m_engine.push_value(expr->m_value);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_logical(Logical* expr)
+{
+    m_engine.push_work(K_LOGICAL, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_set(Set* expr)
+{
+    m_engine.push_work(K_SET, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_super(Super* expr)
+{
+    m_engine.push_value(m_engine.Interpreter::visit_super(expr));
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_this(This* expr)
+{
+    m_engine.push_value(m_engine.Interpreter::visit_this(expr));
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_unary(Unary* expr)
+{
+    m_engine.push_work(K_UNARY, expr);
+    return Value{};
+}
+
+Value StacklessInterpreter::Scheduler::visit_variable(Variable* expr)
+{
+    m_engine.push_value(m_engine.Interpreter::visit_variable(expr));
+    return Value{};
+}
+
+void StacklessInterpreter::Scheduler::visit_block(Block* stmt)
+{
+    if (!stmt->m_flattened)
+    {
+        m_engine.push_restore(K_BLOCK_EXIT, 0, m_engine.m_environment);
+        m_engine.m_environment = heap().allocate<Environment>(m_engine.m_environment, stmt->m_slot_count);
+    }
+
+    m_engine.push_sequence(stmt->m_statements);
+}
+
+// Only evaluates the superclass, which is a plain variable.
+void StacklessInterpreter::Scheduler::visit_class(Class* stmt)
+{
+    m_engine.Interpreter::visit_class(stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_expression(Expression* stmt)
+{
+    m_engine.push_work(K_EXPRESSION, stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_function(Function* stmt)
+{
+    m_engine.Interpreter::visit_function(stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_if(If* stmt)
+{
+    m_engine.push_work(K_IF, stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_print(Print* stmt)
+{
+    m_engine.push_work(K_PRINT, stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_return(Return* stmt)
+{
+    m_engine.push_work(K_RETURN, stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_var(Var* stmt)
+{
+    if (stmt->m_initializer == nullptr)
+        m_engine.Interpreter::visit_var(stmt);
+    else
+        m_engine.push_work(K_VAR, stmt);
+}
+
+void StacklessInterpreter::Scheduler::visit_while(While* stmt)
+{
+    m_engine.push_work(K_WHILE, stmt);
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "interpreter.h"
+#include "memo_table.h"
+
+// Runs the same resolved AST as Interpreter without recursing on the C++
+// stack, so Lox recursion is only as deep as m_max_depth allows.
+//
+// Pending work is a stack of Continuations, each one a node and how far
+// its evaluation has got. Expressions leave their results on a value
+// stack, and a call's callee, arguments and locals sit together at the
+// top of it, so a deep recursion is two dense arrays rather than a chain
+// of native frames. Both stacks live on the heap and grow as needed.
+//
+// Leaf operations (arithmetic, property access, declarations) are
+// Interpreter's own, so the two modes can't drift apart.
+class StacklessInterpreter : public Interpreter
+{
+public:
+    static constexpr int DEFAULT_MAX_DEPTH = 100000;
+
+    StacklessInterpreter() : m_scheduler{*this} { m_max_depth = DEFAULT_MAX_DEPTH; }
+
+    void mark_roots(Heap& heap) override;
+
+    void interpret(const std::vector<Stmt*>& statements);
+
+private:
+    enum Kind : uint8_t
+    {
+        K_UNARY, K_BINARY, K_LOGICAL, K_ASSIGN, K_GET, K_SET, K_CALL, K_TAIL_CALL,
+        K_EXPRESSION, K_PRINT, K_VAR, K_IF, K_WHILE, K_RETURN,
+        // Runs a statement list in the current environment.
+        K_SEQUENCE,
+        // Restores the environment a block replaced.
+        K_BLOCK_EXIT,
+        // An active call. Returns unwind to it.
+        K_CALL_FRAME,
+    };
+
+    struct Continuation
+    {
+        Kind m_kind;
+        // How far the node has got, or for K_CALL_FRAME the offset of the
+        // callee on the value stack.
+        uint32_t m_step;
+        union
+        {
+            Expr* m_expr;
+            Stmt* m_stmt;
+            const std::vector<Stmt*>* m_statements;
+            // K_BLOCK_EXIT and K_CALL_FRAME: the environment to restore.
+            Environment* m_environment;
+        };
+    };
+
+    // Memoized call waiting for its result, stored when the call frame at
+    // index m_frame of m_work returns.
+    struct PendingMemo
+    {
+        size_t m_frame;
+        LoxFunction* m_function;
+        MemoTable::Key m_key;
+    };
+
+    // Turns a node into work: leaves are evaluated on the spot, anything
+    // with children becomes a Continuation.
+    class Scheduler : public VisitorExpr, public VisitorStmt
+    {
+    public:
+        Scheduler(StacklessInterpreter& engine) : m_engine{engine} { }
+
+        Value visit_assign(Assign* expr) override;
+        Value visit_binary(Binary* expr) override;
+        Value visit_call(Call* expr) override;
+        Value visit_get(Get* expr) override;
+        Value visit_grouping(Grouping* expr) override;
+        Value visit_literal(Literal* expr) override;
+        Value visit_logical(Logical* expr) override;
+        Value visit_set(Set* expr) override;
+        Value visit_super(Super* expr) override;
+        Value visit_this(This* expr) override;
+        Value visit_unary(Unary* expr) override;
+        Value visit_variable(Variable* expr) override;
+
+        void visit_block(Block* stmt) override;
+        void visit_class(Class* stmt) override;
+        void visit_expression(Expression* stmt) override;
+        void visit_function(Function* stmt) override;
+        void visit_if(If* stmt) override;
+        void visit_print(Print* stmt) override;
+        void visit_return(Return* stmt) override;
+        void visit_var(Var* stmt) override;
+        void visit_while(While* stmt) override;
+
+    private:
+        StacklessInterpreter& m_engine;
+    };
+
+    Scheduler m_scheduler;
+    std::vector<Continuation> m_work;
+    std::vector<Value> m_values;
+    // Pooled call frames, as in Interpreter. A deque never moves them.
+    std::deque<Environment> m_frame_pool;
+    size_t m_pool_used = 0;
+    std::vector<PendingMemo> m_memos;
+
+    void schedule(Expr* expr) { expr->accept(m_scheduler); }
+    void schedule(Stmt* stmt)
+    {
+        heap().safepoint();
+        stmt->accept(m_scheduler);
+    }
+
+    void push_work(Kind kind, Expr* expr)
+    {
+        Continuation continuation{kind, 0, {}};
+        continuation.m_expr = expr;
+        m_work.push_back(continuation);
+    }
+
+    void push_work(Kind kind, Stmt* stmt)
+    {
+        Continuation continuation{kind, 0, {}};
+        continuation.m_stmt = stmt;
+        m_work.push_back(continuation);
+    }
+
+    void push_sequence(const std::vector<Stmt*>& statements)
+    {
+        Continuation continuation{K_SEQUENCE, 0, {}};
+        continuation.m_statements = &statements;
+        m_work.push_back(continuation);
+    }
+
+    void push_restore(Kind kind, uint32_t step, Environment* environment)
+    {
+        Continuation continuation{kind, step, {}};
+        continuation.m_environment = environment;
+        m_work.push_back(continuation);
+    }
+
+    void reserve_values(size_t count);
+    void push_value(Value value)
+    {
+        reserve_values(1);
+        m_values.push_back(value);
+    }
+
+    Value pop_value()
+    {
+        Value value = m_values.back();
+        m_values.pop_back();
+        return value;
+    }
+
+    void run();
+    void step_call(Continuation& continuation);
+    void call(Call* expr, LoxCallable* function, size_t base, bool tail);
+    void enter(LoxFunction* function, size_t base, bool tail);
+    void tail_call(LoxFunction* function, size_t callee);
+    void return_value(Value value);
+    void complete_call(Value value);
+    void store_memo(Value value);
+};
@@ -1,11 +1,14 @@
 #pragma once
 
-#include <any>
+#include <cstdint>
 #include <vector>
 #include <utility>
 #include "lex.h"
 #include "expr.h"
 
+struct JitFunction;
+struct JitLoop;
+
 class Block;
 class Class;
 class Expression;
@@ -18,135 +21,191 @@ class While;
 
 class VisitorStmt {
 public:
-    virtual std::any visit_block(std::shared_ptr<Block> stmt) = 0;
-    virtual std::any visit_class(std::shared_ptr<Class> stmt) = 0;
-    virtual std::any visit_expression(std::shared_ptr<Expression> stmt) = 0;
-    virtual std::any visit_function(std::shared_ptr<Function> stmt) = 0;
-    virtual std::any visit_if(std::shared_ptr<If> stmt) = 0;
-    virtual std::any visit_print(std::shared_ptr<Print> stmt) = 0;
-    virtual std::any visit_return(std::shared_ptr<Return> stmt) = 0;
-    virtual std::any visit_var(std::shared_ptr<Var> stmt) = 0;
-    virtual std::any visit_while(std::shared_ptr<While> stmt) = 0;
+    virtual void visit_block(Block* stmt) = 0;
+    virtual void visit_class(Class* stmt) = 0;
+    virtual void visit_expression(Expression* stmt) = 0;
+    virtual void visit_function(Function* stmt) = 0;
+    virtual void visit_if(If* stmt) = 0;
+    virtual void visit_print(Print* stmt) = 0;
+    virtual void visit_return(Return* stmt) = 0;
+    virtual void visit_var(Var* stmt) = 0;
+    virtual void visit_while(While* stmt) = 0;
 };
 
 class Stmt {
 public:
-    virtual std::any accept(VisitorStmt& visitor) = 0;
+    virtual void accept(VisitorStmt& visitor) = 0;
 };
 
-class Block : public Stmt, public std::enable_shared_from_this<Block> {
+// Supplies a Function's body the first time it's needed, for trees that
+// are decoded piecemeal, such as a restored Snapshot's.
+class BodySource {
 public:
-    std::vector<std::shared_ptr<Stmt>> m_statements;
+    virtual std::vector<Stmt*> decode_body(Function* function) = 0;
+
+protected:
+    ~BodySource() = default;
+};
 
-    Block(const std::vector<std::shared_ptr<Stmt>>& statements) 
+class Block : public Stmt {
+public:
+    std::vector<Stmt*> m_statements;
+    // Set by Resolver: how many locals the block's environment holds.
+    int m_slot_count = 0;
+    // Set by Resolver when no closure can capture the block's scope. Its
+    // locals then take slots in the enclosing environment and the block
+    // runs without one of its own.
+    bool m_flattened = false;
+
+    Block(const std::vector<Stmt*>& statements) 
         : m_statements(std::move(statements)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_block(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_block(this);
     }
 };
 
-class Class : public Stmt, public std::enable_shared_from_this<Class> {
+class Class : public Stmt {
 public:
     const Token m_name;
-    const std::shared_ptr<Variable> m_superclass;
-    const std::vector<std::shared_ptr<Function>> m_methods;
+    Variable* const m_superclass;
+    const std::vector<Function*> m_methods;
+    int m_slot = -1;
 
-    Class(Token name, std::shared_ptr<Variable> superclass, const std::vector<std::shared_ptr<Function>>& methods) 
+    Class(Token name, Variable* superclass, const std::vector<Function*>& methods) 
         : m_name(std::move(name)), m_superclass(std::move(superclass)), m_methods(std::move(methods)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_class(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_class(this);
     }
 };
 
-class Expression : public Stmt, public std::enable_shared_from_this<Expression> {
+class Expression : public Stmt {
 public:
-    const std::shared_ptr<Expr> m_expression;
+    Expr* m_expression;
 
-    Expression(std::shared_ptr<Expr> expression) 
+    Expression(Expr* expression) 
         : m_expression(std::move(expression)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_expression(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_expression(this);
     }
 };
 
-class Function : public Stmt, public std::enable_shared_from_this<Function> {
+class Function : public Stmt {
 public:
     const Token m_name;
     const std::vector<Token> m_params;
-    const std::vector<std::shared_ptr<Stmt>> m_body;
-
-    Function(Token name, const std::vector<Token>& params, const std::vector<std::shared_ptr<Stmt>>& body) 
+    std::vector<Stmt*> m_body;
+    int m_slot = -1;
+    int m_slot_count = 0;
+    // Set by Resolver when the body declares a function or class, whose
+    // closure would outlive the call.
+    bool m_captures = false;
+    // Set by Resolver when a call's result depends only on its arguments
+    // and the call has no effects, so the result can be memoized.
+    bool m_pure = false;
+    // Set by Resolver when the function is a global declared once and
+    // never assigned, so its name always refers to this declaration.
+    bool m_stable = false;
+    // Tiering state: calls made so far in the interpreter, and what the
+    // JIT made of the function once they made it hot. See Tiering.
+    uint32_t m_calls = 0;
+    JitFunction* m_native = nullptr;
+    // Set while m_body is still encoded. See body().
+    BodySource* m_body_source = nullptr;
+
+    Function(Token name, const std::vector<Token>& params, const std::vector<Stmt*>& body) 
         : m_name(std::move(name)), m_params(std::move(params)), m_body(std::move(body)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_function(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_function(this);
+    }
+
+    // The body, decoded first if it still needs to be. The engines run
+    // bodies through here, so a restored function that never runs is
+    // never decoded.
+    const std::vector<Stmt*>& body() {
+        if (m_body_source != nullptr) {
+            BodySource* source = m_body_source;
+            m_body_source = nullptr;
+            m_body = source->decode_body(this);
+        }
+        return m_body;
     }
 };
 
-class If : public Stmt, public std::enable_shared_from_this<If> {
+class If : public Stmt {
 public:
-    const std::shared_ptr<Expr> m_condition;
-    const std::shared_ptr<Stmt> m_thenBranch;
-    const std::shared_ptr<Stmt> m_elseBranch;
+    Expr* m_condition;
+    Stmt* m_thenBranch;
+    Stmt* m_elseBranch;
 
-    If(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> thenBranch, std::shared_ptr<Stmt> elseBranch) 
+    If(Expr* condition, Stmt* thenBranch, Stmt* elseBranch) 
         : m_condition(std::move(condition)), m_thenBranch(std::move(thenBranch)), m_elseBranch(std::move(elseBranch)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_if(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_if(this);
     }
 };
 
-class Print : public Stmt, public std::enable_shared_from_this<Print> {
+class Print : public Stmt {
 public:
-    const std::shared_ptr<Expr> m_expression;
+    Expr* m_expression;
 
-    Print(std::shared_ptr<Expr> expression) 
+    Print(Expr* expression) 
         : m_expression(std::move(expression)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_print(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_print(this);
     }
 };
 
-class Return : public Stmt, public std::enable_shared_from_this<Return> {
+class Return : public Stmt {
 public:
     const Token m_name;
-    const std::shared_ptr<Expr> m_value;
+    Expr* m_value;
+    // Set by Resolver when m_value is a call whose result is returned as
+    // is, so the callee can replace the returning function's frame.
+    bool m_tail_call = false;
 
-    Return(Token name, std::shared_ptr<Expr> value) 
+    Return(Token name, Expr* value) 
         : m_name(std::move(name)), m_value(std::move(value)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_return(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_return(this);
     }
 };
 
-class Var : public Stmt, public std::enable_shared_from_this<Var> {
+class Var : public Stmt {
 public:
     const Token m_name;
-    const std::shared_ptr<Expr> m_initializer;
+    Expr* m_initializer;
+    int m_slot = -1;
 
-    Var(Token name, std::shared_ptr<Expr> initializer) 
+    Var(Token name, Expr* initializer) 
         : m_name(std::move(name)), m_initializer(std::move(initializer)) {}
 
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_var(shared_from_this());
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_var(this);
     }
 };
 
-class While : public Stmt, public std::enable_shared_from_this<While> {
+class While : public Stmt {
 public:
-    const std::shared_ptr<Expr> m_condition;
-    const std::shared_ptr<Stmt> m_body;
-
-    While(std::shared_ptr<Expr> condition, std::shared_ptr<Stmt> body) 
-        : m_condition(std::move(condition)), m_body(std::move(body)) {}
-
-    virtual std::any accept(VisitorStmt& visitor) override {
-        return visitor.visit_while(shared_from_this());
+    Expr* m_condition;
+    Stmt* m_body;
+    // The line of the 'while' or 'for' keyword.
+    const int m_line;
+    // Tiering state: iterations run so far in the interpreter, and what
+    // the JIT made of the loop once they made it hot. See Tiering.
+    uint32_t m_iterations = 0;
+    JitLoop* m_native = nullptr;
+
+    While(Expr* condition, Stmt* body, int line) 
+        : m_condition(std::move(condition)), m_body(std::move(body)), m_line(line) {}
+
+    virtual void accept(VisitorStmt& visitor) override {
+        visitor.visit_while(this);
     }
 };
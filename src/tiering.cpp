@@ -0,0 +1,122 @@
+#include "tiering.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "environment.h"
+#include "lox_function.h"
+
+bool Tiering::call(LoxFunction* function, const Value* arguments, int frames_left, Value& result)
+{
+    Function* declaration = function->declaration;
+    if (!m_enabled || function->is_initializer)
+        return false;
+
+    JitFunction* native = declaration->m_native;
+    if (native == nullptr)
+    {
+        if (++declaration->m_calls < m_call_threshold)
+            return false;
+
+        native = declaration->m_native = m_jit.compile(declaration);
+        if (m_log && !native->m_enabled)
+            log("fun " + std::string{declaration->m_name.m_lexeme} + " stays interpreted after "
+                + std::to_string(declaration->m_calls) + " calls: it " + native->m_unsupported);
+
+        adopt_installed(declaration);
+    }
+
+    if (!native->m_enabled)
+        return false;
+
+    JitState state{std::min(frames_left, Jit::MAX_FRAMES)};
+    uint64_t bits = native->m_code(arguments, &state);
+    if (state.m_bailed)
+    {
+        if (++native->m_bailouts == MAX_BAILOUTS)
+        {
+            native->m_enabled = false;
+            if (m_log)
+                log("fun " + std::string{declaration->m_name.m_lexeme} + " -> interpreted after "
+                    + std::to_string(MAX_BAILOUTS) + " bailouts");
+        }
+
+        return false;
+    }
+
+    result = Value::from_bits(bits);
+    return true;
+}
+
+Tiering::LoopResult Tiering::run_loop(While* loop, Environment* environment, int frames_left, Value& result)
+{
+    JitLoop* native = loop->m_native;
+    if (native == nullptr)
+    {
+        native = loop->m_native = m_jit.compile(loop, environment);
+        std::string where = "loop at line " + std::to_string(loop->m_line);
+        if (m_log && !native->m_enabled)
+            log(where + " stays interpreted after " + std::to_string(loop->m_iterations)
+                + " iterations: it " + native->m_unsupported);
+        else if (m_log)
+            log(where + " -> native after " + std::to_string(loop->m_iterations) + " iterations");
+
+        adopt_installed(nullptr);
+    }
+
+    if (!native->m_enabled)
+        return LOOP_INTERPRET;
+
+    std::vector<Value*> outer;
+    outer.reserve(native->m_outer.size());
+    for (const JitLoop::Outer& variable : native->m_outer)
+        outer.push_back(variable.m_global != nullptr ? variable.m_global
+                                                     : environment->address_at(variable.m_depth, variable.m_slot));
+
+    JitState state{std::min(frames_left, Jit::MAX_FRAMES)};
+    uint64_t bits = native->m_code(outer.data(), &state);
+    if (state.m_bailed)
+    {
+        if (++native->m_bailouts == MAX_BAILOUTS)
+        {
+            native->m_enabled = false;
+            if (m_log)
+                log("loop at line " + std::to_string(loop->m_line) + " -> interpreted after "
+                    + std::to_string(MAX_BAILOUTS) + " bailouts");
+        }
+
+        return LOOP_INTERPRET;
+    }
+
+    if (!state.m_returned)
+        return LOOP_DONE;
+
+    result = Value::from_bits(bits);
+    return LOOP_RETURNED;
+}
+
+void Tiering::adopt_installed(Function* hot)
+{
+    for (Function* function : m_jit.take_installed())
+    {
+        // A callee compiled along the way needn't get hot on its own.
+        function->m_native = m_jit.compile(function);
+        if (!m_log) continue;
+
+        std::string name = "fun " + std::string{function->m_name.m_lexeme};
+        if (function == hot)
+            log(name + " -> native after " + std::to_string(function->m_calls) + " calls");
+        else
+            log(name + " -> native, called from compiled code");
+    }
+}
+
+void Tiering::log(const std::string& message)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+    std::cerr << "[tier] " << std::fixed << std::setprecision(3) << elapsed.count() << " ms: "
+              << message << "\n" << std::defaultfloat;
+}
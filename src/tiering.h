@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "jit.h"
+#include "stmt.h"
+#include "value.h"
+
+class Environment;
+class LoxFunction;
+
+// Decides what runs where. Everything starts out in the interpreter, which
+// needs nothing beyond the resolved and optimized AST, so code that runs
+// only a few times, like a script's setup, never pays for compilation.
+// Each Function counts its calls and each While its iterations, and once a
+// count reaches its threshold Tiering asks the JIT for native code, which
+// from then on runs instead. Code that can't be compiled, or whose native
+// code keeps bailing out, stays in the interpreter for good.
+//
+// Loops are entered at the start of an iteration, so a hot loop in code
+// that runs once, such as a script's main loop, still moves over midway.
+class Tiering
+{
+public:
+    static constexpr uint32_t DEFAULT_CALL_THRESHOLD = 100;
+    static constexpr uint32_t DEFAULT_LOOP_THRESHOLD = 1000;
+    static constexpr int MAX_BAILOUTS = 16;
+
+    enum LoopResult
+    {
+        // The interpreter runs the next iteration.
+        LOOP_INTERPRET,
+        // The loop ran to completion.
+        LOOP_DONE,
+        // The body returned, with the value in result.
+        LOOP_RETURNED,
+    };
+
+    bool m_enabled = true;
+    uint32_t m_call_threshold = DEFAULT_CALL_THRESHOLD;
+    uint32_t m_loop_threshold = DEFAULT_LOOP_THRESHOLD;
+    // Report each move between tiers, and why, on stderr.
+    bool m_log = false;
+
+    explicit Tiering(Environment* globals) : m_jit{globals} { }
+
+    // Runs a call of function natively if it's hot and compiles, leaving
+    // its result in result. Returns false if the interpreter should run it,
+    // which includes when the native code bailed out.
+    bool call(LoxFunction* function, const Value* arguments, int frames_left, Value& result);
+
+    // Called at the start of every iteration of loop, which runs in
+    // environment.
+    LoopResult loop(While* loop, Environment* environment, int frames_left, Value& result)
+    {
+        if (!m_enabled || (loop->m_native == nullptr && ++loop->m_iterations < m_loop_threshold))
+            return LOOP_INTERPRET;
+
+        return run_loop(loop, environment, frames_left, result);
+    }
+
+private:
+    Jit m_jit;
+    std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+
+    LoopResult run_loop(While* loop, Environment* environment, int frames_left, Value& result);
+
+    // Moves the functions just compiled, the hot one and any it calls, to
+    // their native code.
+    void adopt_installed(Function* hot);
+    void log(const std::string& message);
+};
@@ -0,0 +1,507 @@
+#include "transpiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "object.h"
+
+std::string Transpiler::transpile(const std::vector<Stmt*>& statements)
+{
+    Emitter script;
+    m_emitter = &script;
+    for (Stmt* statement : statements)
+        emit(statement);
+
+    m_emitter = nullptr;
+
+    std::stringstream out;
+    out << "// Generated by loxc from " << m_script << ". Build with lox_runtime.h on the\n"
+        << "// include path.\n\n"
+        << "#include \"lox_runtime.h\"\n\n"
+        << "namespace {\n\n";
+
+    for (const std::stringstream* section : {&m_constants, &m_globals, &m_prototypes, &m_functions})
+    {
+        std::string text = section->str();
+        if (!text.empty())
+            out << text << "\n";
+    }
+
+    out << "void script()\n{\n" << script.m_code.str() << "}\n\n"
+        << "}\n\n"
+        << "int main()\n{\n    return lox::run(script);\n}\n";
+
+    return out.str();
+}
+
+Value Transpiler::visit_assign(Assign* expr)
+{
+    std::string value = emit(expr->m_value);
+    std::string line = std::to_string(expr->m_name.m_line);
+    if (expr->m_depth < 0)
+        m_text = global(expr->m_name) + ".assign(" + value + ", " + line + ")";
+    else
+        m_text = "(" + slot(expr->m_depth, expr->m_slot) + " = " + value + ")";
+
+    return Value{};
+}
+
+Value Transpiler::visit_binary(Binary* expr)
+{
+    std::string operands = this->operands(expr->m_left, expr->m_right);
+    std::string line = std::to_string(expr->m_operator.m_line);
+
+    const char* function = nullptr;
+    switch (expr->m_operator.m_type)
+    {
+        case EQUAL_EQUAL:
+            m_text = "lox::equal(" + operands + ")";
+            return Value{};
+        case BANG_EQUAL:
+            m_text = "lox::not_equal(" + operands + ")";
+            return Value{};
+        case PLUS: function = "lox::add"; break;
+        case MINUS: function = "lox::subtract"; break;
+        case STAR: function = "lox::multiply"; break;
+        case SLASH: function = "lox::divide"; break;
+        case GREATER: function = "lox::greater"; break;
+        case GREATER_EQUAL: function = "lox::greater_equal"; break;
+        case LESS: function = "lox::less"; break;
+        case LESS_EQUAL: function = "lox::less_equal"; break;
+        default: break;
+    }
+
+    m_text = std::string{function} + "(" + operands + ", " + line + ")";
+    return Value{};
+}
+
+Value Transpiler::visit_call(Call* expr)
+{
+    std::string code = "lox::call(" + std::to_string(expr->m_paren.m_line) + ", {" + emit(expr->m_calee);
+    for (Expr* argument : expr->m_arguments)
+        code += ", " + emit(argument);
+
+    m_text = code + "})";
+    return Value{};
+}
+
+Value Transpiler::visit_get(Get* expr)
+{
+    std::string object = emit(expr->m_object);
+    m_text = "lox::get(" + object + ", " + name(expr->m_name.m_lexeme) + ", "
+             + std::to_string(expr->m_name.m_line) + ")";
+    return Value{};
+}
+
+Value Transpiler::visit_grouping(Grouping* expr)
+{
+    m_text = emit(expr->m_expression);
+    return Value{};
+}
+
+Value Transpiler::visit_literal(Literal* expr)
+{
+    Value value = expr->m_value;
+    if (value.is_nil())
+        m_text = "lox::Value{}";
+    else if (value.is_bool())
+        m_text = value.as_bool() ? "lox::Value{true}" : "lox::Value{false}";
+    else if (value.is_number())
+    {
+        double number = value.as_number();
+        char text[32];
+        if (!std::isfinite(number))
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof bits);
+            std::snprintf(text, sizeof text, "0x%016llxull", static_cast<unsigned long long>(bits));
+            m_text = std::string{"lox::number_bits("} + text + ")";
+        }
+        else
+        {
+            // Enough digits to read back the same double, and a point so
+            // C++ reads a double at all.
+            std::snprintf(text, sizeof text, "%.17g", number);
+            m_text = text;
+            if (m_text.find_first_of(".e") == std::string::npos)
+                m_text += ".0";
+
+            m_text = "lox::Value{" + m_text + "}";
+        }
+    }
+    else
+        m_text = string(as_string(value)->m_chars);
+
+    return Value{};
+}
+
+Value Transpiler::visit_logical(Logical* expr)
+{
+    std::string left = emit(expr->m_left);
+    std::string right = emit(expr->m_right);
+    const char* function = expr->m_operator.m_type == OR ? "lox::logical_or" : "lox::logical_and";
+    m_text = std::string{function} + "(" + left + ", [&]() -> lox::Value { return " + right + "; })";
+    return Value{};
+}
+
+Value Transpiler::visit_set(Set* expr)
+{
+    std::string object = emit(expr->m_object);
+    std::string value = emit(expr->m_value);
+    m_text = "lox::set({lox::fields(" + object + ", " + std::to_string(expr->m_name.m_line) + "), "
+             + value + "}, " + name(expr->m_name.m_lexeme) + ")";
+    return Value{};
+}
+
+Value Transpiler::visit_super(Super* expr)
+{
+    m_text = "lox::super_method(" + slot(expr->m_depth, 0) + ", " + slot(expr->m_depth - 1, 0) + ", "
+             + name(expr->m_method.m_lexeme) + ", " + std::to_string(expr->m_method.m_line) + ")";
+    return Value{};
+}
+
+Value Transpiler::visit_this(This* expr)
+{
+    m_text = slot(expr->m_depth, 0);
+    return Value{};
+}
+
+Value Transpiler::visit_unary(Unary* expr)
+{
+    std::string right = emit(expr->m_right);
+    if (expr->m_operator.m_type == MINUS)
+        m_text = "lox::negate(" + right + ", " + std::to_string(expr->m_operator.m_line) + ")";
+    else
+        m_text = "lox::logical_not(" + right + ")";
+
+    return Value{};
+}
+
+Value Transpiler::visit_variable(Variable* expr)
+{
+    if (expr->m_depth < 0)
+        m_text = global(expr->m_name) + ".get(" + std::to_string(expr->m_name.m_line) + ")";
+    else
+        m_text = slot(expr->m_depth, expr->m_slot);
+
+    return Value{};
+}
+
+void Transpiler::visit_block(Block* stmt)
+{
+    line() << "{\n";
+    m_emitter->m_indent++;
+
+    if (!stmt->m_flattened)
+    {
+        std::string name = "e" + std::to_string(m_emitter->m_levels.size());
+        line() << "lox::Ref<lox::Env> " << name << " = lox::env(" << current_env() << ", "
+               << stmt->m_slot_count << ");\n";
+        m_emitter->m_levels.push_back({false, name});
+    }
+
+    for (Stmt* statement : stmt->m_statements)
+        emit(statement);
+
+    if (!stmt->m_flattened)
+        m_emitter->m_levels.pop_back();
+
+    m_emitter->m_indent--;
+    line() << "}\n";
+}
+
+void Transpiler::visit_class(Class* stmt)
+{
+    line() << "{\n";
+    m_emitter->m_indent++;
+
+    // Methods of a subclass close over an extra environment that binds
+    // 'super', as in Interpreter::visit_class.
+    std::string environment = current_env();
+    std::string superclass = "nullptr";
+    if (stmt->m_superclass != nullptr)
+    {
+        std::string value = emit(stmt->m_superclass);
+        line() << "lox::Ref<lox::Class> superclass = lox::superclass(" << value << ", "
+               << stmt->m_superclass->m_name.m_line << ");\n";
+        line() << "lox::Ref<lox::Env> super = lox::env(" << environment << ", 1);\n";
+        line() << "super->m_slots[0] = superclass.get();\n";
+        environment = "super.get()";
+        superclass = "superclass.get()";
+    }
+
+    std::string methods;
+    const std::vector<Function*>& declared = stmt->m_methods;
+    for (auto method = declared.begin(); method != declared.end(); ++method)
+    {
+        // A method declared twice keeps its last body.
+        std::string_view method_name = (*method)->m_name.m_lexeme;
+        bool redeclared = std::any_of(method + 1, declared.end(), [&](Function* later) {
+            return later->m_name.m_lexeme == method_name;
+        });
+        if (redeclared) continue;
+
+        bool is_initializer = method_name == "init";
+        std::string code = function(*method);
+        methods += methods.empty() ? "" : ", ";
+        methods += "{" + name(method_name) + ", lox::method(" + code + ", " + environment + ", "
+                   + (is_initializer ? "true" : "false") + ")}";
+    }
+
+    std::string klass = "lox::make_class(\"" + std::string{stmt->m_name.m_lexeme} + "\", " + superclass
+                        + ", {" + methods + "})";
+    line() << define(stmt->m_slot, stmt->m_name, klass) << ";\n";
+
+    m_emitter->m_indent--;
+    line() << "}\n";
+}
+
+void Transpiler::visit_expression(Expression* stmt)
+{
+    Expr* expression = stmt->m_expression;
+    std::string code = emit(expression);
+    if (dynamic_cast<Call*>(expression) || dynamic_cast<Assign*>(expression) || dynamic_cast<Set*>(expression))
+        line() << code << ";\n";
+    else
+        line() << "(void)" << code << ";\n";
+}
+
+void Transpiler::visit_function(Function* stmt)
+{
+    std::string code = function(stmt);
+    line() << define(stmt->m_slot, stmt->m_name, "lox::closure(" + code + ", " + current_env() + ")") << ";\n";
+}
+
+void Transpiler::visit_if(If* stmt)
+{
+    line() << "if (lox::truthy(" << emit(stmt->m_condition) << "))\n";
+    emit_body(stmt->m_thenBranch);
+    if (stmt->m_elseBranch != nullptr)
+    {
+        line() << "else\n";
+        emit_body(stmt->m_elseBranch);
+    }
+}
+
+void Transpiler::visit_print(Print* stmt)
+{
+    line() << "lox::print(" << emit(stmt->m_expression) << ");\n";
+}
+
+void Transpiler::visit_return(Return* stmt)
+{
+    if (stmt->m_value == nullptr)
+    {
+        line() << "return lox::Value{};\n";
+        return;
+    }
+
+    if (stmt->m_tail_call)
+    {
+        auto call = static_cast<Call*>(stmt->m_value);
+        std::string code = "lox::tail_call(" + std::to_string(call->m_paren.m_line) + ", {" + emit(call->m_calee);
+        for (Expr* argument : call->m_arguments)
+            code += ", " + emit(argument);
+
+        line() << "return " << code << "});\n";
+        return;
+    }
+
+    line() << "return " << emit(stmt->m_value) << ";\n";
+}
+
+void Transpiler::visit_var(Var* stmt)
+{
+    std::string value = stmt->m_initializer != nullptr ? emit(stmt->m_initializer) : "lox::Value{}";
+    line() << define(stmt->m_slot, stmt->m_name, value) << ";\n";
+}
+
+void Transpiler::visit_while(While* stmt)
+{
+    line() << "while (lox::truthy(" << emit(stmt->m_condition) << "))\n";
+    emit_body(stmt->m_body);
+}
+
+void Transpiler::emit_body(Stmt* stmt)
+{
+    if (dynamic_cast<Block*>(stmt))
+    {
+        emit(stmt);
+        return;
+    }
+
+    line() << "{\n";
+    m_emitter->m_indent++;
+    emit(stmt);
+    m_emitter->m_indent--;
+    line() << "}\n";
+}
+
+std::stringstream& Transpiler::line()
+{
+    m_emitter->m_code << std::string(4 * m_emitter->m_indent, ' ');
+    return m_emitter->m_code;
+}
+
+std::string Transpiler::function(Function* stmt)
+{
+    std::string id = std::to_string(m_next_id++);
+    std::string name{stmt->m_name.m_lexeme};
+    std::string code = "f" + id + "_" + name;
+    std::string info = "fn" + id;
+    m_prototypes << "lox::Value " << code << "(lox::Closure*, const lox::Value*);\n"
+                 << "const lox::Function " << info << "{\"" << name << "\", " << stmt->m_params.size() << ", "
+                 << code << "};\n";
+
+    Emitter emitter;
+    emitter.m_in_function = true;
+    Emitter* enclosing = m_emitter;
+    m_emitter = &emitter;
+
+    // The same frame LoxFunction::call sets up: a local array unless a
+    // closure can capture it.
+    if (stmt->m_captures)
+    {
+        emitter.m_uses_self = true;
+        line() << "lox::Ref<lox::Env> e0 = lox::env(self->m_env.get(), " << stmt->m_slot_count << ");\n";
+        emitter.m_levels.push_back({false, "e0"});
+    }
+    else
+    {
+        line() << "lox::Value l[" << std::max(stmt->m_slot_count, 1) << "];\n";
+        emitter.m_levels.push_back({true, "l"});
+    }
+
+    for (size_t i = 0; i < stmt->m_params.size(); ++i)
+        line() << slot(0, static_cast<int>(i)) << " = args[" << i << "];\n";
+
+    for (Stmt* statement : stmt->m_body)
+        emit(statement);
+
+    line() << "return lox::Value{};\n";
+
+    // Parameters the body never reads are left unnamed, so the generated
+    // code builds clean under -Wunused-parameter.
+    m_functions << "lox::Value " << code << "(lox::Closure*" << (emitter.m_uses_self ? " self" : "")
+                << ", const lox::Value*" << (stmt->m_params.empty() ? "" : " args") << ")\n{\n"
+                << emitter.m_code.str() << "}\n\n";
+    m_emitter = enclosing;
+    return "&" + info;
+}
+
+std::string Transpiler::slot(int depth, int slot)
+{
+    const std::vector<Level>& levels = m_emitter->m_levels;
+    int count = static_cast<int>(levels.size());
+    if (depth < count)
+    {
+        const Level& level = levels[count - 1 - depth];
+        if (level.m_array)
+            return level.m_name + "[" + std::to_string(slot) + "]";
+
+        return level.m_name + "->m_slots[" + std::to_string(slot) + "]";
+    }
+
+    // Past the function's own environments lies the closure's chain.
+    m_emitter->m_uses_self = true;
+    std::string environment = "self->m_env";
+    if (depth > count)
+        environment += "->ancestor(" + std::to_string(depth - count) + ")";
+
+    return environment + "->m_slots[" + std::to_string(slot) + "]";
+}
+
+std::string Transpiler::current_env()
+{
+    const std::vector<Level>& levels = m_emitter->m_levels;
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+    {
+        if (!level->m_array)
+            return level->m_name + ".get()";
+    }
+
+    if (!m_emitter->m_in_function) return "nullptr";
+
+    m_emitter->m_uses_self = true;
+    return "self->m_env.get()";
+}
+
+std::string Transpiler::global(const Token& name)
+{
+    auto found = m_global_names.find(name.m_lexeme);
+    if (found != m_global_names.end())
+        return found->second;
+
+    std::string text{name.m_lexeme};
+    std::string code = "g_" + text;
+    m_globals << "lox::Global " << code << "{\"" << text << "\"";
+    if (text == "clock")
+        m_globals << ", lox::clock()";
+
+    m_globals << "};\n";
+    m_global_names.emplace(name.m_lexeme, code);
+    return code;
+}
+
+std::string Transpiler::define(int slot, const Token& name, const std::string& value)
+{
+    if (slot < 0)
+        return global(name) + ".define(" + value + ")";
+
+    return this->slot(0, slot) + " = " + value;
+}
+
+std::string Transpiler::name(std::string_view text)
+{
+    auto found = m_names.find(text);
+    if (found != m_names.end())
+        return found->second;
+
+    std::string code = "n_" + std::string{text};
+    m_constants << "const lox::Name " << code << " = lox::name(\"" << text << "\");\n";
+    m_names.emplace(text, code);
+    return code;
+}
+
+std::string Transpiler::string(const std::string& chars)
+{
+    auto found = m_strings.find(chars);
+    if (found != m_strings.end())
+        return found->second;
+
+    std::string literal;
+    for (unsigned char c : chars)
+    {
+        switch (c)
+        {
+            case '\\': literal += "\\\\"; break;
+            case '"': literal += "\\\""; break;
+            case '\n': literal += "\\n"; break;
+            case '\r': literal += "\\r"; break;
+            case '\t': literal += "\\t"; break;
+            default:
+                if (c < 0x20 || c >= 0x7f)
+                {
+                    // Three digits, so a digit after it can't join in.
+                    char escape[8];
+                    std::snprintf(escape, sizeof escape, "\\%03o", c);
+                    literal += escape;
+                }
+                else
+                    literal += static_cast<char>(c);
+        }
+    }
+
+    std::string code = "k" + std::to_string(m_strings.size());
+    m_constants << "const lox::Value " << code << " = lox::string(\"" << literal << "\");\n";
+    m_strings.emplace(chars, code);
+    return code;
+}
+
+std::string Transpiler::operands(Expr* left, Expr* right)
+{
+    std::string code = "{" + emit(left);
+    return code + ", " + emit(right) + "}";
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#include "stmt.h"
+
+// Lowers a resolved program to a C++ translation unit that runs it on
+// lox_runtime.h, for loxc.
+//
+// Every Lox function becomes a C++ function, and the top level becomes
+// script(). Locals keep the (depth, slot) addresses Resolver gave them,
+// in the same chain of environments the interpreter builds: a function
+// that creates no closures keeps its slots in a local array, and any
+// other function or unflattened block allocates an environment. Globals
+// become statics, one per name. Operators and calls go through the
+// runtime, which reports errors just as the interpreter does.
+class Transpiler : public VisitorExpr, public VisitorStmt
+{
+public:
+    explicit Transpiler(std::string_view script) : m_script{script} { }
+
+    std::string transpile(const std::vector<Stmt*>& statements);
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    // One environment of the function being emitted, innermost last: the
+    // function's local array, or a runtime Env held in a C++ local.
+    struct Level
+    {
+        bool m_array;
+        std::string m_name;
+    };
+
+    // The C++ function being emitted. Nested declarations start their own
+    // and come back to this one.
+    struct Emitter
+    {
+        std::stringstream m_code;
+        std::vector<Level> m_levels;
+        bool m_in_function = false;
+        // Whether the code reads the closure's environment, so the
+        // function needs to name its self parameter.
+        bool m_uses_self = false;
+        int m_indent = 1;
+    };
+
+    std::string_view m_script;
+    Emitter* m_emitter = nullptr;
+    // The expression just emitted.
+    std::string m_text;
+    int m_next_id = 0;
+
+    std::stringstream m_constants;
+    std::stringstream m_globals;
+    std::stringstream m_prototypes;
+    std::stringstream m_functions;
+    std::unordered_map<std::string, std::string> m_strings;
+    std::unordered_map<std::string_view, std::string> m_names;
+    std::unordered_map<std::string_view, std::string> m_global_names;
+
+    std::string emit(Expr* expr)
+    {
+        expr->accept(*this);
+        return std::move(m_text);
+    }
+
+    void emit(Stmt* stmt) { stmt->accept(*this); }
+    // Emits a statement that C++ needs as one, such as a loop body.
+    void emit_body(Stmt* stmt);
+    std::stringstream& line();
+
+    // Emits stmt's body as a C++ function, returning its Function info.
+    std::string function(Function* stmt);
+    std::string slot(int depth, int slot);
+    std::string current_env();
+    std::string global(const Token& name);
+    std::string define(int slot, const Token& name, const std::string& value);
+    std::string name(std::string_view text);
+    std::string string(const std::string& chars);
+    std::string operands(Expr* left, Expr* right);
+};
@@ -0,0 +1,716 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "tree_codec.h"
+#include "memory.h"
+#include "object.h"
+
+enum NodeKind : uint32_t
+{
+    NODE_ASSIGN,
+    NODE_BINARY,
+    NODE_CALL,
+    NODE_GET,
+    NODE_GROUPING,
+    NODE_LITERAL,
+    NODE_LOGICAL,
+    NODE_SET,
+    NODE_SUPER,
+    NODE_THIS,
+    NODE_UNARY,
+    NODE_VARIABLE,
+
+    NODE_BLOCK,
+    NODE_CLASS,
+    NODE_EXPRESSION,
+    NODE_FUNCTION,
+    NODE_IF,
+    NODE_PRINT,
+    NODE_RETURN,
+    NODE_VAR,
+    NODE_WHILE,
+};
+
+enum LiteralTag : uint32_t { LITERAL_NIL, LITERAL_FALSE, LITERAL_TRUE, LITERAL_NUMBER, LITERAL_STRING };
+
+uint64_t hash_text(std::string_view text)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, text.data() + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+
+    for (; i < text.size(); ++i)
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 1099511628211ull;
+
+    return hash;
+}
+
+bool interpreter_stamp(uint64_t& size, uint64_t& time)
+{
+    struct stat info;
+    if (stat("/proc/self/exe", &info) != 0) return false;
+
+    size = info.st_size;
+    time = uint64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+uint32_t TreeEncoder::encode(Expr* expr)
+{
+    if (expr == nullptr) return 0;
+    if (auto found = m_numbers.find(expr); found != m_numbers.end()) return found->second;
+
+    // Children are encoded first, so the record starts after theirs.
+    expr->accept(*this);
+    m_offsets.push_back(m_record);
+    return m_numbers[expr] = uint32_t(m_offsets.size());
+}
+
+uint32_t TreeEncoder::encode(Stmt* stmt)
+{
+    if (stmt == nullptr) return 0;
+    if (auto found = m_numbers.find(stmt); found != m_numbers.end()) return found->second;
+
+    stmt->accept(*this);
+    m_offsets.push_back(m_record);
+    return m_numbers[stmt] = uint32_t(m_offsets.size());
+}
+
+uint32_t TreeEncoder::text_offset(std::string_view text)
+{
+    auto found = m_offsets_of_text.find(text);
+    if (found != m_offsets_of_text.end()) return found->second;
+
+    uint32_t offset = uint32_t(m_strings.size());
+    m_strings.append(text);
+    m_offsets_of_text.emplace(text, offset);
+    return offset;
+}
+
+void TreeEncoder::begin(uint32_t kind)
+{
+    m_record = uint32_t(m_words.size());
+    m_words.push_back(kind);
+}
+
+void TreeEncoder::words(std::initializer_list<uint32_t> words)
+{
+    m_words.insert(m_words.end(), words);
+}
+
+void TreeEncoder::list(const std::vector<uint32_t>& numbers)
+{
+    m_words.push_back(uint32_t(numbers.size()));
+    m_words.insert(m_words.end(), numbers.begin(), numbers.end());
+}
+
+void TreeEncoder::text(std::string_view text)
+{
+    words({text_offset(text), uint32_t(text.size())});
+}
+
+void TreeEncoder::token(const Token& token)
+{
+    words({uint32_t(token.m_type)});
+    text(token.m_lexeme);
+    words({uint32_t(token.m_line)});
+}
+
+Value TreeEncoder::visit_assign(Assign* expr)
+{
+    uint32_t value = encode(expr->m_value);
+    if (expr->m_depth < 0)
+        m_assigned_globals.push_back(expr->m_name.m_lexeme);
+
+    begin(NODE_ASSIGN);
+    token(expr->m_name);
+    words({value, uint32_t(expr->m_depth), uint32_t(expr->m_slot)});
+    return Value{};
+}
+
+Value TreeEncoder::visit_binary(Binary* expr)
+{
+    uint32_t left = encode(expr->m_left);
+    uint32_t right = encode(expr->m_right);
+    begin(NODE_BINARY);
+    token(expr->m_operator);
+    words({left, right});
+    return Value{};
+}
+
+Value TreeEncoder::visit_call(Call* expr)
+{
+    uint32_t callee = encode(expr->m_calee);
+    std::vector<uint32_t> arguments = encode(expr->m_arguments);
+    begin(NODE_CALL);
+    token(expr->m_paren);
+    words({callee});
+    list(arguments);
+    return Value{};
+}
+
+Value TreeEncoder::visit_get(Get* expr)
+{
+    uint32_t object = encode(expr->m_object);
+    begin(NODE_GET);
+    token(expr->m_name);
+    words({object});
+    return Value{};
+}
+
+Value TreeEncoder::visit_grouping(Grouping* expr)
+{
+    uint32_t expression = encode(expr->m_expression);
+    begin(NODE_GROUPING);
+    words({expression});
+    return Value{};
+}
+
+Value TreeEncoder::visit_literal(Literal* expr)
+{
+    Value value = expr->m_value;
+    begin(NODE_LITERAL);
+    if (value.is_nil())
+        words({LITERAL_NIL});
+    else if (value.is_bool())
+        words({value.as_bool() ? LITERAL_TRUE : LITERAL_FALSE});
+    else if (value.is_number())
+    {
+        uint64_t bits;
+        double number = value.as_number();
+        std::memcpy(&bits, &number, sizeof bits);
+        words({LITERAL_NUMBER, uint32_t(bits), uint32_t(bits >> 32)});
+    }
+    else
+    {
+        words({LITERAL_STRING});
+        text(as_string(value)->m_chars);
+    }
+
+    return Value{};
+}
+
+Value TreeEncoder::visit_logical(Logical* expr)
+{
+    uint32_t left = encode(expr->m_left);
+    uint32_t right = encode(expr->m_right);
+    begin(NODE_LOGICAL);
+    token(expr->m_operator);
+    words({left, right});
+    return Value{};
+}
+
+Value TreeEncoder::visit_set(Set* expr)
+{
+    uint32_t object = encode(expr->m_object);
+    uint32_t value = encode(expr->m_value);
+    begin(NODE_SET);
+    token(expr->m_name);
+    words({object, value});
+    return Value{};
+}
+
+Value TreeEncoder::visit_super(Super* expr)
+{
+    begin(NODE_SUPER);
+    token(expr->m_keyword);
+    token(expr->m_method);
+    words({uint32_t(expr->m_depth)});
+    return Value{};
+}
+
+Value TreeEncoder::visit_this(This* expr)
+{
+    begin(NODE_THIS);
+    token(expr->m_keyword);
+    words({uint32_t(expr->m_depth)});
+    return Value{};
+}
+
+Value TreeEncoder::visit_unary(Unary* expr)
+{
+    uint32_t right = encode(expr->m_right);
+    begin(NODE_UNARY);
+    token(expr->m_operator);
+    words({right});
+    return Value{};
+}
+
+Value TreeEncoder::visit_variable(Variable* expr)
+{
+    begin(NODE_VARIABLE);
+    token(expr->m_name);
+    words({uint32_t(expr->m_depth), uint32_t(expr->m_slot)});
+    return Value{};
+}
+
+void TreeEncoder::visit_block(Block* stmt)
+{
+    std::vector<uint32_t> statements = encode(stmt->m_statements);
+    begin(NODE_BLOCK);
+    words({uint32_t(stmt->m_slot_count), stmt->m_flattened});
+    list(statements);
+}
+
+void TreeEncoder::visit_class(Class* stmt)
+{
+    uint32_t superclass = encode(stmt->m_superclass);
+    std::vector<uint32_t> methods = encode(stmt->m_methods);
+    begin(NODE_CLASS);
+    token(stmt->m_name);
+    words({superclass, uint32_t(stmt->m_slot)});
+    list(methods);
+}
+
+void TreeEncoder::visit_expression(Expression* stmt)
+{
+    uint32_t expression = encode(stmt->m_expression);
+    begin(NODE_EXPRESSION);
+    words({expression});
+}
+
+void TreeEncoder::visit_function(Function* stmt)
+{
+    std::vector<uint32_t> body = encode(stmt->body());
+    begin(NODE_FUNCTION);
+    token(stmt->m_name);
+    words({uint32_t(stmt->m_params.size())});
+    for (const Token& param : stmt->m_params)
+        token(param);
+
+    list(body);
+    words({uint32_t(stmt->m_slot), uint32_t(stmt->m_slot_count), stmt->m_captures, stmt->m_pure, stmt->m_stable});
+}
+
+void TreeEncoder::visit_if(If* stmt)
+{
+    uint32_t condition = encode(stmt->m_condition);
+    uint32_t then_branch = encode(stmt->m_thenBranch);
+    uint32_t else_branch = encode(stmt->m_elseBranch);
+    begin(NODE_IF);
+    words({condition, then_branch, else_branch});
+}
+
+void TreeEncoder::visit_print(Print* stmt)
+{
+    uint32_t expression = encode(stmt->m_expression);
+    begin(NODE_PRINT);
+    words({expression});
+}
+
+void TreeEncoder::visit_return(Return* stmt)
+{
+    uint32_t value = encode(stmt->m_value);
+    begin(NODE_RETURN);
+    token(stmt->m_name);
+    words({value, stmt->m_tail_call});
+}
+
+void TreeEncoder::visit_var(Var* stmt)
+{
+    uint32_t initializer = encode(stmt->m_initializer);
+    begin(NODE_VAR);
+    token(stmt->m_name);
+    words({initializer, uint32_t(stmt->m_slot)});
+}
+
+void TreeEncoder::visit_while(While* stmt)
+{
+    uint32_t condition = encode(stmt->m_condition);
+    uint32_t body = encode(stmt->m_body);
+    begin(NODE_WHILE);
+    words({condition, body, uint32_t(stmt->m_line)});
+}
+
+// Reads one record. A node can only refer to nodes numbered before it,
+// the limit, so damage can't make decoding loop.
+class TreeDecoder::Reader
+{
+public:
+    Reader(TreeDecoder& decoder, uint32_t offset, uint32_t limit)
+        : m_decoder{decoder}, m_cursor{decoder.m_words + offset},
+          m_end{decoder.m_words + decoder.m_word_count}, m_limit{limit} { }
+
+    uint32_t word()
+    {
+        if (m_cursor == m_end) throw Corrupt{};
+        return *m_cursor++;
+    }
+
+    int integer() { return static_cast<int32_t>(word()); }
+    bool flag() { return word() != 0; }
+    uint32_t offset() const { return uint32_t(m_cursor - m_decoder.m_words); }
+
+    size_t count()
+    {
+        uint32_t count = word();
+        if (count > static_cast<size_t>(m_end - m_cursor)) throw Corrupt{};
+        return count;
+    }
+
+    // Steps over a list of node numbers without decoding them.
+    void skip_list()
+    {
+        m_cursor += count();
+    }
+
+    std::string_view text()
+    {
+        uint32_t offset = word();
+        return m_decoder.text(offset, word());
+    }
+
+    Token token()
+    {
+        uint32_t type = word();
+        if (type > END) throw Corrupt{};
+
+        std::string_view lexeme = text();
+        return Token{static_cast<TokenType>(type), lexeme, integer()};
+    }
+
+    Expr* optional_expr()
+    {
+        uint32_t number = this->number();
+        return number == 0 ? nullptr : m_decoder.expr(number);
+    }
+
+    Stmt* optional_stmt()
+    {
+        uint32_t number = this->number();
+        return number == 0 ? nullptr : m_decoder.stmt(number);
+    }
+
+    Expr* expr()
+    {
+        Expr* expr = optional_expr();
+        if (expr == nullptr) throw Corrupt{};
+        return expr;
+    }
+
+    Stmt* stmt()
+    {
+        Stmt* stmt = optional_stmt();
+        if (stmt == nullptr) throw Corrupt{};
+        return stmt;
+    }
+
+    std::vector<Expr*> exprs()
+    {
+        std::vector<Expr*> exprs(count());
+        for (Expr*& expr : exprs)
+            expr = this->expr();
+
+        return exprs;
+    }
+
+    std::vector<Stmt*> stmts()
+    {
+        std::vector<Stmt*> stmts(count());
+        for (Stmt*& stmt : stmts)
+            stmt = this->stmt();
+
+        return stmts;
+    }
+
+    // A node of a known type, such as a class's methods.
+    template <class T, class Node>
+    static T* cast(Node* node)
+    {
+        auto cast = dynamic_cast<T*>(node);
+        if (node != nullptr && cast == nullptr) throw Corrupt{};
+        return cast;
+    }
+
+private:
+    TreeDecoder& m_decoder;
+    const uint32_t* m_cursor;
+    const uint32_t* m_end;
+    uint32_t m_limit;
+
+    uint32_t number()
+    {
+        uint32_t number = word();
+        if (number >= m_limit) throw Corrupt{};
+        return number;
+    }
+};
+
+TreeDecoder::TreeDecoder(Program& program, std::string_view strings, const uint32_t* words, size_t word_count,
+                         const uint32_t* offsets, uint32_t node_count, bool lazy_bodies)
+    : m_program{program}, m_strings{strings}, m_words{words}, m_word_count{word_count}, m_offsets{offsets},
+      m_lazy_bodies{lazy_bodies}, m_nodes(node_count)
+{
+}
+
+Expr* TreeDecoder::expr(uint32_t number)
+{
+    if (kind(number) >= NODE_BLOCK) throw Corrupt{};
+    return static_cast<Expr*>(node(number));
+}
+
+Stmt* TreeDecoder::stmt(uint32_t number)
+{
+    if (kind(number) < NODE_BLOCK) throw Corrupt{};
+    return static_cast<Stmt*>(node(number));
+}
+
+std::string_view TreeDecoder::text(uint32_t offset, uint32_t length) const
+{
+    if (offset > m_strings.size() || length > m_strings.size() - offset) throw Corrupt{};
+    return m_strings.substr(offset, length);
+}
+
+std::vector<Stmt*> TreeDecoder::decode_body(Function* function)
+{
+    auto body = m_bodies.find(function);
+    try
+    {
+        if (body == m_bodies.end()) throw Corrupt{};
+
+        Reader reader{*this, body->second.m_offset, body->second.m_number};
+        m_bodies.erase(body);
+        return reader.stmts();
+    }
+    catch (const Corrupt&)
+    {
+        // The file was checked whole when it was loaded, so this is a bug
+        // rather than damage, and there's no running on without the body.
+        std::cerr << "Corrupt body for '" << function->m_name.m_lexeme << "' in encoded tree.\n";
+        std::abort();
+    }
+}
+
+uint32_t TreeDecoder::kind(uint32_t number) const
+{
+    if (number == 0 || number > m_nodes.size() || m_offsets[number - 1] >= m_word_count) throw Corrupt{};
+    return m_words[m_offsets[number - 1]];
+}
+
+void* TreeDecoder::node(uint32_t number)
+{
+    if (m_nodes[number - 1] == nullptr)
+        decode(number);
+
+    return m_nodes[number - 1];
+}
+
+ObjString* TreeDecoder::intern(std::string_view text)
+{
+    ObjString* string = heap().intern(text);
+    m_program.m_constants.push_back(string);
+    return string;
+}
+
+void TreeDecoder::decode(uint32_t number)
+{
+    Arena& arena = m_program.m_arena;
+    Reader reader{*this, m_offsets[number - 1], number};
+    Expr* expr = nullptr;
+    Stmt* stmt = nullptr;
+    switch (reader.word())
+    {
+        case NODE_ASSIGN:
+        {
+            Token name = reader.token();
+            auto assign = arena.make<Assign>(name, reader.expr());
+            assign->m_depth = reader.integer();
+            assign->m_slot = reader.integer();
+            expr = assign;
+            break;
+        }
+        case NODE_BINARY:
+        {
+            Token op = reader.token();
+            Expr* left = reader.expr();
+            expr = arena.make<Binary>(left, op, reader.expr());
+            break;
+        }
+        case NODE_CALL:
+        {
+            Token paren = reader.token();
+            Expr* callee = reader.expr();
+            expr = arena.make<Call>(callee, paren, reader.exprs());
+            break;
+        }
+        case NODE_GET:
+        {
+            Token name = reader.token();
+            expr = arena.make<Get>(name, reader.expr(), intern(name.m_lexeme));
+            break;
+        }
+        case NODE_GROUPING:
+            expr = arena.make<Grouping>(reader.expr());
+            break;
+        case NODE_LITERAL:
+        {
+            Value value;
+            switch (reader.word())
+            {
+                case LITERAL_NIL: value = nullptr; break;
+                case LITERAL_FALSE: value = false; break;
+                case LITERAL_TRUE: value = true; break;
+                case LITERAL_NUMBER:
+                {
+                    uint64_t bits = reader.word();
+                    bits |= uint64_t(reader.word()) << 32;
+                    double number;
+                    std::memcpy(&number, &bits, sizeof number);
+                    value = number;
+                    break;
+                }
+                case LITERAL_STRING:
+                    value = intern(reader.text());
+                    break;
+                default:
+                    throw Corrupt{};
+            }
+
+            expr = arena.make<Literal>(value);
+            break;
+        }
+        case NODE_LOGICAL:
+        {
+            Token op = reader.token();
+            Expr* left = reader.expr();
+            expr = arena.make<Logical>(left, op, reader.expr());
+            break;
+        }
+        case NODE_SET:
+        {
+            Token name = reader.token();
+            Expr* object = reader.expr();
+            expr = arena.make<Set>(name, reader.expr(), object, intern(name.m_lexeme));
+            break;
+        }
+        case NODE_SUPER:
+        {
+            Token keyword = reader.token();
+            Token method = reader.token();
+            auto super = arena.make<Super>(keyword, method, intern(method.m_lexeme));
+            super->m_depth = reader.integer();
+            expr = super;
+            break;
+        }
+        case NODE_THIS:
+        {
+            auto self = arena.make<This>(reader.token());
+            self->m_depth = reader.integer();
+            expr = self;
+            break;
+        }
+        case NODE_UNARY:
+        {
+            Token op = reader.token();
+            expr = arena.make<Unary>(op, reader.expr());
+            break;
+        }
+        case NODE_VARIABLE:
+        {
+            auto variable = arena.make<Variable>(reader.token());
+            variable->m_depth = reader.integer();
+            variable->m_slot = reader.integer();
+            expr = variable;
+            break;
+        }
+        case NODE_BLOCK:
+        {
+            int slot_count = reader.integer();
+            bool flattened = reader.flag();
+            auto block = arena.make<Block>(reader.stmts());
+            block->m_slot_count = slot_count;
+            block->m_flattened = flattened;
+            stmt = block;
+            break;
+        }
+        case NODE_CLASS:
+        {
+            Token name = reader.token();
+            auto superclass = Reader::cast<Variable>(reader.optional_expr());
+            int slot = reader.integer();
+            std::vector<Function*> methods;
+            for (Stmt* method : reader.stmts())
+                methods.push_back(Reader::cast<Function>(method));
+
+            auto klass = arena.make<Class>(name, superclass, methods);
+            klass->m_slot = slot;
+            stmt = klass;
+            break;
+        }
+        case NODE_EXPRESSION:
+            stmt = arena.make<Expression>(reader.expr());
+            break;
+        case NODE_FUNCTION:
+        {
+            Token name = reader.token();
+            std::vector<Token> params(reader.count());
+            for (Token& param : params)
+                param = reader.token();
+
+            Function* function;
+            if (m_lazy_bodies)
+            {
+                uint32_t body = reader.offset();
+                reader.skip_list();
+                function = arena.make<Function>(name, params, std::vector<Stmt*>{});
+                function->m_body_source = this;
+                m_bodies.emplace(function, Body{body, number});
+            }
+            else
+                function = arena.make<Function>(name, params, reader.stmts());
+
+            function->m_slot = reader.integer();
+            function->m_slot_count = reader.integer();
+            function->m_captures = reader.flag();
+            function->m_pure = reader.flag();
+            function->m_stable = reader.flag();
+            stmt = function;
+            break;
+        }
+        case NODE_IF:
+        {
+            Expr* condition = reader.expr();
+            Stmt* then_branch = reader.stmt();
+            stmt = arena.make<If>(condition, then_branch, reader.optional_stmt());
+            break;
+        }
+        case NODE_PRINT:
+            stmt = arena.make<Print>(reader.expr());
+            break;
+        case NODE_RETURN:
+        {
+            Token keyword = reader.token();
+            auto ret = arena.make<Return>(keyword, reader.optional_expr());
+            ret->m_tail_call = reader.flag();
+            stmt = ret;
+            break;
+        }
+        case NODE_VAR:
+        {
+            Token name = reader.token();
+            auto var = arena.make<Var>(name, reader.optional_expr());
+            var->m_slot = reader.integer();
+            stmt = var;
+            break;
+        }
+        case NODE_WHILE:
+        {
+            Expr* condition = reader.expr();
+            Stmt* body = reader.stmt();
+            stmt = arena.make<While>(condition, body, reader.integer());
+            break;
+        }
+        default:
+            throw Corrupt{};
+    }
+
+    m_nodes[number - 1] = expr != nullptr ? static_cast<void*>(expr) : static_cast<void*>(stmt);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#include "parser.h"
+#include "stmt.h"
+
+// The encoding of resolved trees that ScriptCache and Snapshot write.
+//
+// A tree becomes a list of 32-bit words. Nodes are numbered from 1 in the
+// order they're written, which puts children before the nodes that hold
+// them, and refer to each other by number, with 0 for none. A node shared
+// between parents is written once. Lexemes and string literals go in a
+// separate string table, each distinct text once. Only what the front end
+// sets is written: the engines' own state on the nodes, such as
+// specializations and call counts, starts over when the tree is decoded.
+
+// FNV-1a, eight bytes at a time, which keeps hashing a small part of the
+// parse a cache saves. Each step is a bijection of the running hash, so
+// texts that differ in a single word always hash differently.
+uint64_t hash_text(std::string_view text);
+
+// Identifies the running lox build by the size and time of its executable,
+// so rebuilding lox retires whatever an older build encoded. False if it
+// can't be told.
+bool interpreter_stamp(uint64_t& size, uint64_t& time);
+
+class TreeEncoder : public VisitorExpr, public VisitorStmt
+{
+public:
+    std::string m_strings;
+    std::vector<uint32_t> m_words;
+    // Where each node's record starts in m_words, by number less one.
+    std::vector<uint32_t> m_offsets;
+    // Every global an encoded Assign writes.
+    std::vector<std::string_view> m_assigned_globals;
+
+    uint32_t encode(Expr* expr);
+    uint32_t encode(Stmt* stmt);
+
+    template <class Node>
+    std::vector<uint32_t> encode(const std::vector<Node*>& nodes)
+    {
+        std::vector<uint32_t> numbers;
+        for (Node* node : nodes)
+            numbers.push_back(encode(node));
+
+        return numbers;
+    }
+
+    // Where text sits in m_strings, adding it if it's new.
+    uint32_t text_offset(std::string_view text);
+
+    Value visit_assign(Assign* expr) override;
+    Value visit_binary(Binary* expr) override;
+    Value visit_call(Call* expr) override;
+    Value visit_get(Get* expr) override;
+    Value visit_grouping(Grouping* expr) override;
+    Value visit_literal(Literal* expr) override;
+    Value visit_logical(Logical* expr) override;
+    Value visit_set(Set* expr) override;
+    Value visit_super(Super* expr) override;
+    Value visit_this(This* expr) override;
+    Value visit_unary(Unary* expr) override;
+    Value visit_variable(Variable* expr) override;
+
+    void visit_block(Block* stmt) override;
+    void visit_class(Class* stmt) override;
+    void visit_expression(Expression* stmt) override;
+    void visit_function(Function* stmt) override;
+    void visit_if(If* stmt) override;
+    void visit_print(Print* stmt) override;
+    void visit_return(Return* stmt) override;
+    void visit_var(Var* stmt) override;
+    void visit_while(While* stmt) override;
+
+private:
+    std::unordered_map<const void*, uint32_t> m_numbers;
+    std::unordered_map<std::string_view, uint32_t> m_offsets_of_text;
+    // Where the record being written starts.
+    uint32_t m_record = 0;
+
+    void begin(uint32_t kind);
+    void words(std::initializer_list<uint32_t> words);
+    void list(const std::vector<uint32_t>& numbers);
+    void text(std::string_view text);
+    void token(const Token& token);
+};
+
+// Rebuilds nodes in a Program's arena, each the first time it's asked
+// for, straight from the encoded words. Every read is checked, so damage
+// the caller's checks missed is reported with Corrupt rather than trusted.
+//
+// With lazy bodies a Function comes back without its body, which it
+// decodes through the decoder when it first runs. The decoder and the
+// words then have to outlive the tree.
+class TreeDecoder : public BodySource
+{
+public:
+    struct Corrupt { };
+
+    TreeDecoder(Program& program, std::string_view strings, const uint32_t* words, size_t word_count,
+                const uint32_t* offsets, uint32_t node_count, bool lazy_bodies);
+
+    Expr* expr(uint32_t number);
+    Stmt* stmt(uint32_t number);
+    std::string_view text(uint32_t offset, uint32_t length) const;
+
+    std::vector<Stmt*> decode_body(Function* function) override;
+
+private:
+    class Reader;
+
+    // A body still encoded: where its list starts, and the number of its
+    // Function, which its nodes all come before.
+    struct Body
+    {
+        uint32_t m_offset;
+        uint32_t m_number;
+    };
+
+    Program& m_program;
+    std::string_view m_strings;
+    const uint32_t* m_words;
+    size_t m_word_count;
+    const uint32_t* m_offsets;
+    bool m_lazy_bodies;
+    // Each node decoded so far, as the Expr* or Stmt* its kind makes it.
+    std::vector<void*> m_nodes;
+    std::unordered_map<Function*, Body> m_bodies;
+
+    uint32_t kind(uint32_t number) const;
+    void* node(uint32_t number);
+    void decode(uint32_t number);
+    ObjString* intern(std::string_view text);
+};
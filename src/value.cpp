@@ -0,0 +1,58 @@
+#include "value.h"
+#include "object.h"
+#include "lox_callable.h"
+#include "lox_instance.h"
+
+std::string format_number(double number)
+{
+    std::string text = std::to_string(number);
+    size_t dotPos = text.find('.');
+    if (dotPos != std::string::npos)
+    {
+        size_t lastNonZeroPos = text.size() - 1;
+        while (text[lastNonZeroPos] == '0' && lastNonZeroPos > dotPos)
+            lastNonZeroPos--;
+
+        if (text[lastNonZeroPos] == '.')
+            text.erase(lastNonZeroPos, std::string::npos);
+        else
+            text.erase(lastNonZeroPos + 1, std::string::npos);
+    }
+
+    return text;
+}
+
+static std::string function_name(ObjFunction* function)
+{
+    if (function->m_name == nullptr) return "<script>";
+    return "<fn " + function->m_name->m_chars + ">";
+}
+
+std::string to_string(Value value)
+{
+    if (value.is_nil()) return "nil";
+    if (value.is_bool()) return value.as_bool() ? "true" : "false";
+    if (value.is_number()) return format_number(value.as_number());
+
+    switch (value.as_obj()->m_type)
+    {
+        case OBJ_STRING:
+            return as_string(value)->m_chars;
+        case OBJ_FUNCTION:
+            return function_name(static_cast<ObjFunction*>(value.as_obj()));
+        case OBJ_CLOSURE:
+            return function_name(static_cast<ObjClosure*>(value.as_obj())->m_function);
+        case OBJ_NATIVE:
+            return "<native fn>";
+        case OBJ_UPVALUE:
+            return "upvalue";
+        case OBJ_CALLABLE:
+            return static_cast<LoxCallable*>(value.as_obj())->to_string();
+        case OBJ_ENVIRONMENT:
+            return "environment";
+        case OBJ_INSTANCE:
+            return static_cast<LoxInstance*>(value.as_obj())->to_string();
+    }
+
+    return "";
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+class Obj;
+
+// A Value is a single 64-bit word. Doubles are stored as themselves; every
+// other value hides inside the payload of a quiet NaN that arithmetic never
+// produces. Objects additionally set the sign bit and keep their pointer in
+// the low 48 bits.
+//
+// The singleton tags are chosen so the common tests are one mask and one
+// compare: nil and false differ only in bit 1, true and false only in bit 0.
+class Value
+{
+private:
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+
+    static constexpr uint64_t TAG_NIL = 1;
+    static constexpr uint64_t TAG_TRUE = 2;
+    static constexpr uint64_t TAG_FALSE = 3;
+
+    static constexpr uint64_t NIL_VAL = QNAN | TAG_NIL;
+    static constexpr uint64_t TRUE_VAL = QNAN | TAG_TRUE;
+    static constexpr uint64_t FALSE_VAL = QNAN | TAG_FALSE;
+
+    uint64_t m_bits;
+
+    static uint64_t from_double(double number)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &number, sizeof(double));
+        return bits;
+    }
+
+public:
+    Value() : m_bits{NIL_VAL} { }
+    Value(std::nullptr_t) : m_bits{NIL_VAL} { }
+    Value(bool boolean) : m_bits{FALSE_VAL ^ static_cast<uint64_t>(boolean)} { }
+    Value(double number) : m_bits{from_double(number)} { }
+    Value(Obj* obj) : m_bits{SIGN_BIT | QNAN | reinterpret_cast<uintptr_t>(obj)} { }
+
+    // Catches string literals that would otherwise silently become bools.
+    Value(const char*) = delete;
+
+    bool is_nil() const { return m_bits == NIL_VAL; }
+    bool is_bool() const { return (m_bits | 1) == FALSE_VAL; }
+    bool is_number() const { return (m_bits & QNAN) != QNAN; }
+    bool is_obj() const { return (m_bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+    bool as_bool() const { return m_bits == TRUE_VAL; }
+    Obj* as_obj() const { return reinterpret_cast<Obj*>(static_cast<uintptr_t>(m_bits & ~(SIGN_BIT | QNAN))); }
+
+    double as_number() const
+    {
+        double number;
+        std::memcpy(&number, &m_bits, sizeof(double));
+        return number;
+    }
+
+    bool is_falsey() const { return (m_bits | 2) == FALSE_VAL; }
+
+    bool operator==(const Value& other) const
+    {
+        // Only doubles need a numeric compare, so NaN stays unequal to itself.
+        if (is_number() && other.is_number())
+            return as_number() == other.as_number();
+
+        return m_bits == other.m_bits;
+    }
+
+    bool operator!=(const Value& other) const { return !(*this == other); }
+
+    // The raw encoding, for machine code that handles values itself: a
+    // value is a number unless its bits have all of NAN_MASK set.
+    static constexpr uint64_t NAN_MASK = QNAN;
+
+    uint64_t bits() const { return m_bits; }
+
+    static Value from_bits(uint64_t bits)
+    {
+        Value value;
+        value.m_bits = bits;
+        return value;
+    }
+};
+
+std::string format_number(double number);
+std::string to_string(Value value);
@@ -0,0 +1,460 @@
+#include <chrono>
+#include <iostream>
+
+#include "vm.h"
+#include "memory.h"
+#include "runtime_error.h"
+
+void runtime_error(RuntimeError error);
+
+static Value clock_native(int, Value*)
+{
+    auto ticks = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration<double>{ticks}.count();
+}
+
+VM::VM()
+    : m_stack(STACK_MAX), m_frames(FRAMES_MAX)
+{
+    reset_stack();
+    heap().add_roots(this);
+    define_native("clock", clock_native, 0);
+}
+
+VM::~VM()
+{
+    heap().remove_roots(this);
+}
+
+void VM::mark_roots(Heap& heap)
+{
+    for (Value* slot = m_stack.data(); slot < m_stack_top; ++slot)
+        heap.mark(*slot);
+
+    for (int i = 0; i < m_frame_count; ++i)
+        heap.mark(m_frames[i].m_closure);
+
+    for (ObjUpvalue* upvalue = m_open_upvalues; upvalue != nullptr; upvalue = upvalue->m_next_upvalue)
+        heap.mark(upvalue);
+
+    for (auto& global : m_globals)
+    {
+        heap.mark(global.first);
+        heap.mark(global.second);
+    }
+}
+
+void VM::reset_stack()
+{
+    m_stack_top = m_stack.data();
+    m_frame_count = 0;
+    m_open_upvalues = nullptr;
+}
+
+void VM::define_native(const std::string& name, NativeFn function, int arity)
+{
+    m_globals[heap().intern(name)] = heap().allocate<ObjNative>(function, arity);
+}
+
+void VM::error(const std::string& message)
+{
+    CallFrame& frame = m_frames[m_frame_count - 1];
+    const Chunk& chunk = frame.m_closure->m_function->m_chunk;
+    int line = chunk.m_lines[frame.m_ip - chunk.m_code.data() - 1];
+
+    throw RuntimeError(Token{END, "", line}, message);
+}
+
+void VM::interpret(ObjFunction* function)
+{
+    reset_stack();
+
+    ObjClosure* closure = heap().allocate<ObjClosure>(function);
+    push(closure);
+    call(closure, 0);
+
+    try
+    {
+        run();
+    }
+    catch(const RuntimeError& error)
+    {
+        runtime_error(error);
+        reset_stack();
+    }
+}
+
+void VM::call(ObjClosure* closure, int arg_count)
+{
+    if (arg_count != closure->m_function->m_arity)
+    {
+        error("Expected " + std::to_string(closure->m_function->m_arity) +
+              " arguments but got " + std::to_string(arg_count) + ".");
+    }
+
+    if (m_frame_count == FRAMES_MAX)
+        error("Stack overflow.");
+
+    CallFrame& frame = m_frames[m_frame_count++];
+    frame.m_closure = closure;
+    frame.m_ip = closure->m_function->m_chunk.m_code.data();
+    frame.m_slots = m_stack_top - arg_count - 1;
+}
+
+void VM::call_value(Value callee, int arg_count)
+{
+    if (is_obj_type(callee, OBJ_CLOSURE))
+    {
+        call(static_cast<ObjClosure*>(callee.as_obj()), arg_count);
+        return;
+    }
+
+    if (is_obj_type(callee, OBJ_NATIVE))
+    {
+        ObjNative* native = static_cast<ObjNative*>(callee.as_obj());
+        if (arg_count != native->m_arity)
+        {
+            error("Expected " + std::to_string(native->m_arity) +
+                  " arguments but got " + std::to_string(arg_count) + ".");
+        }
+
+        Value result = native->m_function(arg_count, m_stack_top - arg_count);
+        m_stack_top -= arg_count + 1;
+        push(result);
+        return;
+    }
+
+    error("Can only call functions and classes.");
+}
+
+ObjUpvalue* VM::capture_upvalue(Value* local)
+{
+    ObjUpvalue* previous = nullptr;
+    ObjUpvalue* upvalue = m_open_upvalues;
+    while (upvalue != nullptr && upvalue->m_location > local)
+    {
+        previous = upvalue;
+        upvalue = upvalue->m_next_upvalue;
+    }
+
+    if (upvalue != nullptr && upvalue->m_location == local)
+        return upvalue;
+
+    ObjUpvalue* created = heap().allocate<ObjUpvalue>(local);
+    created->m_next_upvalue = upvalue;
+
+    if (previous == nullptr)
+        m_open_upvalues = created;
+    else
+        previous->m_next_upvalue = created;
+
+    return created;
+}
+
+void VM::close_upvalues(Value* last)
+{
+    while (m_open_upvalues != nullptr && m_open_upvalues->m_location >= last)
+    {
+        ObjUpvalue* upvalue = m_open_upvalues;
+        upvalue->m_closed = *upvalue->m_location;
+        upvalue->m_location = &upvalue->m_closed;
+        heap().write_barrier(upvalue);
+        m_open_upvalues = upvalue->m_next_upvalue;
+    }
+}
+
+void VM::run()
+{
+    CallFrame* frame = &m_frames[m_frame_count - 1];
+    // The current frame's m_ip, kept in a local so it can live in a
+    // register. It is written back before anything that reads the frame.
+    uint8_t* ip = frame->m_ip;
+
+#define READ_BYTE() (*ip++)
+#define RUNTIME_ERROR(message) (frame->m_ip = ip, error(message))
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->m_closure->m_function->m_chunk.m_constants[READ_SHORT()])
+#define READ_STRING() as_string(READ_CONSTANT())
+#define BINARY_OP(op) \
+    do { \
+      if (!peek(0).is_number() || !peek(1).is_number()) \
+        RUNTIME_ERROR("Operands must be numbers."); \
+      double b = pop().as_number(); \
+      double a = pop().as_number(); \
+      push(a op b); \
+    } while (false)
+
+// Superinstructions read the operands of the instructions they fuse, which
+// follow them at fixed offsets from ip.
+#define OPERAND_SHORT(offset) static_cast<uint16_t>((ip[offset] << 8) | ip[(offset) + 1])
+
+#if defined(LOX_COMPUTED_GOTO) && defined(__GNUC__)
+    // Each handler ends in its own indirect jump to the next one, rather
+    // than all of them sharing the jump at the top of a switch, so the
+    // branch predictor learns which opcode tends to follow which.
+    static void* const targets[] = {
+        &&OP_CONSTANT_target, &&OP_NIL_target, &&OP_TRUE_target, &&OP_FALSE_target, &&OP_POP_target,
+        &&OP_GET_LOCAL_target, &&OP_SET_LOCAL_target,
+        &&OP_GET_GLOBAL_target, &&OP_DEFINE_GLOBAL_target, &&OP_SET_GLOBAL_target,
+        &&OP_GET_UPVALUE_target, &&OP_SET_UPVALUE_target,
+        &&OP_EQUAL_target, &&OP_GREATER_target, &&OP_GREATER_EQUAL_target, &&OP_LESS_target, &&OP_LESS_EQUAL_target,
+        &&OP_ADD_target, &&OP_SUBTRACT_target, &&OP_MULTIPLY_target, &&OP_DIVIDE_target, &&OP_NOT_target, &&OP_NEGATE_target,
+        &&OP_PRINT_target, &&OP_JUMP_target, &&OP_JUMP_IF_FALSE_target, &&OP_LOOP_target,
+        &&OP_CALL_target, &&OP_CLOSURE_target, &&OP_CLOSE_UPVALUE_target, &&OP_RETURN_target,
+        &&OP_POP_GET_LOCAL_target, &&OP_GET_LOCAL_GET_LOCAL_target, &&OP_SET_LOCAL_POP_target,
+        &&OP_GET_LOCAL_CONSTANT_ADD_target, &&OP_GET_LOCAL_CONSTANT_SUBTRACT_target, &&OP_GET_LOCAL_CONSTANT_LESS_target,
+        &&OP_JUMP_IF_FALSE_POP_target, &&OP_LESS_JUMP_IF_FALSE_POP_target,
+    };
+    static_assert(sizeof(targets) / sizeof(targets[0]) == OP_COUNT, "Every opcode needs a dispatch target.");
+
+#define TARGET(op) op##_target
+#define DISPATCH() goto *targets[READ_BYTE()]
+#define DISPATCH_LOOP DISPATCH();
+#else
+#define TARGET(op) case op
+#define DISPATCH() continue
+#define DISPATCH_LOOP for (;;) switch (READ_BYTE())
+#endif
+
+    DISPATCH_LOOP
+    {
+        TARGET(OP_CONSTANT): push(READ_CONSTANT()); DISPATCH();
+        TARGET(OP_NIL):      push(nullptr); DISPATCH();
+        TARGET(OP_TRUE):     push(true); DISPATCH();
+        TARGET(OP_FALSE):    push(false); DISPATCH();
+        TARGET(OP_POP):      pop(); DISPATCH();
+
+        TARGET(OP_GET_LOCAL):
+            push(frame->m_slots[READ_BYTE()]);
+            DISPATCH();
+        TARGET(OP_SET_LOCAL):
+            frame->m_slots[READ_BYTE()] = peek(0);
+            DISPATCH();
+        TARGET(OP_GET_GLOBAL):
+        {
+            ObjString* name = READ_STRING();
+            auto global = m_globals.find(name);
+            if (global == m_globals.end())
+                RUNTIME_ERROR("Undefined variable '" + name->m_chars + "'.");
+
+            push(global->second);
+            DISPATCH();
+        }
+        TARGET(OP_DEFINE_GLOBAL):
+            m_globals[READ_STRING()] = pop();
+            DISPATCH();
+        TARGET(OP_SET_GLOBAL):
+        {
+            ObjString* name = READ_STRING();
+            auto global = m_globals.find(name);
+            if (global == m_globals.end())
+                RUNTIME_ERROR("Undefined variable '" + name->m_chars + "'.");
+
+            global->second = peek(0);
+            DISPATCH();
+        }
+        TARGET(OP_GET_UPVALUE):
+            push(*frame->m_closure->m_upvalues[READ_BYTE()]->m_location);
+            DISPATCH();
+        TARGET(OP_SET_UPVALUE):
+            *frame->m_closure->m_upvalues[READ_BYTE()]->m_location = peek(0);
+            DISPATCH();
+
+        TARGET(OP_EQUAL):
+        {
+            Value b = pop();
+            Value a = pop();
+            push(a == b);
+            DISPATCH();
+        }
+        TARGET(OP_GREATER):       BINARY_OP(>); DISPATCH();
+        TARGET(OP_GREATER_EQUAL): BINARY_OP(>=); DISPATCH();
+        TARGET(OP_LESS):          BINARY_OP(<); DISPATCH();
+        TARGET(OP_LESS_EQUAL):    BINARY_OP(<=); DISPATCH();
+        TARGET(OP_SUBTRACT):      BINARY_OP(-); DISPATCH();
+        TARGET(OP_MULTIPLY):      BINARY_OP(*); DISPATCH();
+        TARGET(OP_DIVIDE):        BINARY_OP(/); DISPATCH();
+        TARGET(OP_ADD):
+        {
+            if (peek(0).is_number() && peek(1).is_number())
+            {
+                double b = pop().as_number();
+                double a = pop().as_number();
+                push(a + b);
+            }
+            else if (is_obj_type(peek(0), OBJ_STRING) && is_obj_type(peek(1), OBJ_STRING))
+            {
+                ObjString* b = as_string(pop());
+                ObjString* a = as_string(pop());
+                push(heap().intern(a->m_chars + b->m_chars));
+            }
+            else
+                RUNTIME_ERROR("Operands must be two number or two strings");
+            DISPATCH();
+        }
+        TARGET(OP_NOT):
+            push(pop().is_falsey());
+            DISPATCH();
+        TARGET(OP_NEGATE):
+            if (!peek(0).is_number())
+                RUNTIME_ERROR("Operand must be a number.");
+
+            push(-pop().as_number());
+            DISPATCH();
+
+        TARGET(OP_PRINT):
+            std::cout << to_string(pop()) << "\n";
+            DISPATCH();
+        TARGET(OP_JUMP):
+        {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+        TARGET(OP_JUMP_IF_FALSE):
+        {
+            uint16_t offset = READ_SHORT();
+            if (peek(0).is_falsey()) ip += offset;
+            DISPATCH();
+        }
+        TARGET(OP_LOOP):
+        {
+            uint16_t offset = READ_SHORT();
+            ip -= offset;
+            heap().safepoint();
+            DISPATCH();
+        }
+        TARGET(OP_CALL):
+        {
+            int arg_count = READ_BYTE();
+            heap().safepoint();
+            frame->m_ip = ip;
+            call_value(peek(arg_count), arg_count);
+            frame = &m_frames[m_frame_count - 1];
+            ip = frame->m_ip;
+            DISPATCH();
+        }
+        TARGET(OP_CLOSURE):
+        {
+            ObjFunction* function = static_cast<ObjFunction*>(READ_CONSTANT().as_obj());
+            ObjClosure* closure = heap().allocate<ObjClosure>(function);
+            push(closure);
+
+            for (ObjUpvalue*& upvalue : closure->m_upvalues)
+            {
+                uint8_t is_local = READ_BYTE();
+                uint8_t index = READ_BYTE();
+                if (is_local)
+                    upvalue = capture_upvalue(frame->m_slots + index);
+                else
+                    upvalue = frame->m_closure->m_upvalues[index];
+            }
+            DISPATCH();
+        }
+        TARGET(OP_CLOSE_UPVALUE):
+            close_upvalues(m_stack_top - 1);
+            pop();
+            DISPATCH();
+        TARGET(OP_RETURN):
+        {
+            Value result = pop();
+            close_upvalues(frame->m_slots);
+            m_frame_count--;
+            if (m_frame_count == 0)
+            {
+                pop();
+                return;
+            }
+
+            m_stack_top = frame->m_slots;
+            push(result);
+            frame = &m_frames[m_frame_count - 1];
+            ip = frame->m_ip;
+            DISPATCH();
+        }
+
+        // POP; GET_LOCAL slot
+        TARGET(OP_POP_GET_LOCAL):
+            m_stack_top[-1] = frame->m_slots[ip[1]];
+            ip += 2;
+            DISPATCH();
+        // GET_LOCAL a; GET_LOCAL b
+        TARGET(OP_GET_LOCAL_GET_LOCAL):
+            push(frame->m_slots[ip[0]]);
+            push(frame->m_slots[ip[2]]);
+            ip += 3;
+            DISPATCH();
+        // SET_LOCAL slot; POP
+        TARGET(OP_SET_LOCAL_POP):
+            frame->m_slots[ip[0]] = pop();
+            ip += 2;
+            DISPATCH();
+
+        // GET_LOCAL slot; CONSTANT index; <operator>. Operands that aren't
+        // two numbers are pushed, and the operator runs on its own.
+#define LOCAL_CONSTANT_OP(op) \
+    do { \
+      Value a = frame->m_slots[ip[0]]; \
+      Value b = frame->m_closure->m_function->m_chunk.m_constants[OPERAND_SHORT(2)]; \
+      if (a.is_number() && b.is_number()) \
+      { \
+          push(a.as_number() op b.as_number()); \
+          ip += 5; \
+      } \
+      else \
+      { \
+          push(a); \
+          push(b); \
+          ip += 4; \
+      } \
+    } while (false)
+
+        TARGET(OP_GET_LOCAL_CONSTANT_ADD):      LOCAL_CONSTANT_OP(+); DISPATCH();
+        TARGET(OP_GET_LOCAL_CONSTANT_SUBTRACT): LOCAL_CONSTANT_OP(-); DISPATCH();
+        TARGET(OP_GET_LOCAL_CONSTANT_LESS):     LOCAL_CONSTANT_OP(<); DISPATCH();
+#undef LOCAL_CONSTANT_OP
+
+        // JUMP_IF_FALSE offset; POP
+        TARGET(OP_JUMP_IF_FALSE_POP):
+        {
+            uint16_t offset = READ_SHORT();
+            if (peek(0).is_falsey())
+                ip += offset;
+            else
+            {
+                pop();
+                ip++;
+            }
+            DISPATCH();
+        }
+        // LESS; JUMP_IF_FALSE offset; POP. The comparison is only pushed
+        // on the branch that keeps it.
+        TARGET(OP_LESS_JUMP_IF_FALSE_POP):
+        {
+            if (!peek(0).is_number() || !peek(1).is_number())
+                RUNTIME_ERROR("Operands must be numbers.");
+
+            double b = pop().as_number();
+            double a = pop().as_number();
+            if (a < b)
+                ip += 4;
+            else
+            {
+                push(false);
+                ip += 3 + OPERAND_SHORT(1);
+            }
+            DISPATCH();
+        }
+    }
+
+#undef READ_BYTE
+#undef RUNTIME_ERROR
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef BINARY_OP
+#undef OPERAND_SHORT
+#undef TARGET
+#undef DISPATCH
+#undef DISPATCH_LOOP
+}
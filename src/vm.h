@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+class CallFrame
+{
+public:
+    ObjClosure* m_closure;
+    uint8_t* m_ip;
+    Value* m_slots;
+};
+
+// Stack-based bytecode interpreter, the alternative to walking the tree with
+// Interpreter. Run with --engine=vm.
+class VM : public RootSet
+{
+public:
+    static constexpr int FRAMES_MAX = 1024;
+    static constexpr int STACK_MAX = FRAMES_MAX * 256;
+
+    VM();
+    ~VM();
+
+    void interpret(ObjFunction* function);
+    void mark_roots(Heap& heap) override;
+
+private:
+    std::vector<Value> m_stack;
+    Value* m_stack_top;
+    std::vector<CallFrame> m_frames;
+    int m_frame_count = 0;
+    std::unordered_map<ObjString*, Value> m_globals;
+    ObjUpvalue* m_open_upvalues = nullptr;
+
+    void run();
+    void reset_stack();
+    void define_native(const std::string& name, NativeFn function, int arity);
+    [[noreturn]] void error(const std::string& message);
+
+    void push(Value value) { *m_stack_top++ = value; }
+    Value pop() { return *--m_stack_top; }
+    Value peek(int distance) { return m_stack_top[-1 - distance]; }
+
+    void call_value(Value callee, int arg_count);
+    void call(ObjClosure* closure, int arg_count);
+    ObjUpvalue* capture_upvalue(Value* local);
+    void close_upvalues(Value* last);
+};